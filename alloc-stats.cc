@@ -0,0 +1,119 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "alloc-stats.h"
+
+#ifdef RPT2PNP_ALLOC_STATS
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+namespace {
+// Counters are updated from any thread.
+struct PhaseCounters {
+    std::atomic<int64_t> allocations;
+    std::atomic<int64_t> bytes;
+    std::atomic<int64_t> live_bytes;
+};
+
+PhaseCounters counters[ALLOC_MAX_PHASES];
+std::atomic<int64_t> heap_bytes(0);
+std::atomic<int64_t> peak_heap_bytes(0);
+thread_local int current_phase = ALLOC_NO_PHASE;
+
+// In front of each block, so that delete knows what to account for. Keeps
+// the alignment malloc() guarantees.
+union BlockHeader {
+    struct {
+        size_t size;
+        int phase;
+    } info;
+    max_align_t align;
+};
+
+void *CountedAlloc(size_t size) {
+    BlockHeader *header = (BlockHeader*) malloc(sizeof(BlockHeader) + size);
+    if (header == NULL)
+        return NULL;
+    header->info.size = size;
+    header->info.phase = current_phase;
+    PhaseCounters &c = counters[current_phase];
+    c.allocations.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(size, std::memory_order_relaxed);
+    c.live_bytes.fetch_add(size, std::memory_order_relaxed);
+    const int64_t now = heap_bytes.fetch_add(size, std::memory_order_relaxed)
+        + size;
+    int64_t peak = peak_heap_bytes.load(std::memory_order_relaxed);
+    while (now > peak && !peak_heap_bytes.compare_exchange_weak(peak, now)) {
+    }
+    return header + 1;
+}
+
+void CountedFree(void *ptr) {
+    if (ptr == NULL)
+        return;
+    BlockHeader *header = (BlockHeader*) ptr - 1;
+    counters[header->info.phase].live_bytes.fetch_sub(
+        header->info.size, std::memory_order_relaxed);
+    heap_bytes.fetch_sub(header->info.size, std::memory_order_relaxed);
+    free(header);
+}
+
+void *CountedAllocOrDie(size_t size) {
+    void *result = CountedAlloc(size);
+    if (result == NULL) {
+        // We are compiled without exceptions, so can't throw bad_alloc.
+        fprintf(stderr, "Out of memory allocating %zu bytes\n", size);
+        abort();
+    }
+    return result;
+}
+}  // namespace
+
+void *operator new(size_t size) { return CountedAllocOrDie(size); }
+void *operator new[](size_t size) { return CountedAllocOrDie(size); }
+void *operator new(size_t size, const std::nothrow_t&) noexcept {
+    return CountedAlloc(size);
+}
+void *operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return CountedAlloc(size);
+}
+void operator delete(void *ptr) noexcept { CountedFree(ptr); }
+void operator delete[](void *ptr) noexcept { CountedFree(ptr); }
+void operator delete(void *ptr, const std::nothrow_t&) noexcept {
+    CountedFree(ptr);
+}
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept {
+    CountedFree(ptr);
+}
+
+bool AllocStatsEnabled() { return true; }
+
+void SetAllocPhase(int phase) {
+    current_phase = (phase >= 0 && phase < ALLOC_MAX_PHASES)
+        ? phase : ALLOC_NO_PHASE;
+}
+
+AllocCounts GetAllocCounts(int phase) {
+    AllocCounts result;
+    result.allocations = counters[phase].allocations.load();
+    result.bytes = counters[phase].bytes.load();
+    result.live_bytes = counters[phase].live_bytes.load();
+    return result;
+}
+
+int64_t GetPeakHeapBytes() { return peak_heap_bytes.load(); }
+
+#else  // RPT2PNP_ALLOC_STATS
+
+bool AllocStatsEnabled() { return false; }
+void SetAllocPhase(int phase) {}
+AllocCounts GetAllocCounts(int phase) { return AllocCounts(); }
+int64_t GetPeakHeapBytes() { return 0; }
+
+#endif  // RPT2PNP_ALLOC_STATS
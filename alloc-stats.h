@@ -0,0 +1,35 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Accounting of heap allocations by phase of the run. The global operator
+ * new and delete are only replaced when compiled with
+ * RPT2PNP_ALLOC_STATS ("make ALLOC_STATS=1"); otherwise nothing is counted.
+ */
+
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <stdint.h>
+
+// Allocations are attributed to a phase number, chosen per thread.
+#define ALLOC_NO_PHASE 0         // Allocations outside of any phase.
+#define ALLOC_MAX_PHASES 16
+
+struct AllocCounts {
+    int64_t allocations = 0;
+    int64_t bytes = 0;          // All bytes allocated.
+    int64_t live_bytes = 0;     // Allocated in this phase, not freed yet.
+};
+
+// Returns 'true' if compiled in.
+bool AllocStatsEnabled();
+
+// Attribute allocations of the current thread to "phase" from now on.
+void SetAllocPhase(int phase);
+
+AllocCounts GetAllocCounts(int phase);
+
+// Highest number of bytes allocated at the same time.
+int64_t GetPeakHeapBytes();
+
+#endif  // ALLOC_STATS_H
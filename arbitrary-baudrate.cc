@@ -0,0 +1,43 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * This lives in its own file, as the kernel termios2 definitions collide with
+ * the ones from <termios.h>.
+ */
+
+#include "arbitrary-baudrate.h"
+
+#include <stdio.h>
+
+#ifdef __linux__
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+bool SetArbitraryBaudrate(int fd, int baud) {
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) < 0) {
+        perror("TCGETS2");
+        return false;
+    }
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+    if (ioctl(fd, TCSETS2, &tio) < 0) {
+        perror("TCSETS2");
+        return false;
+    }
+    // The driver picks the closest rate its clock divider can do.
+    if (ioctl(fd, TCGETS2, &tio) == 0 && (int)tio.c_ospeed != baud) {
+        fprintf(stderr, "Requested %d baud, driver set %u baud\n",
+                baud, tio.c_ospeed);
+    }
+    return true;
+}
+#else
+bool SetArbitraryBaudrate(int fd, int baud) {
+    fprintf(stderr, "%d baud: arbitrary baudrates are only supported on "
+            "Linux.\n", baud);
+    return false;
+}
+#endif
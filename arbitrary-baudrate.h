@@ -0,0 +1,14 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#ifndef ARBITRARY_BAUDRATE_H
+#define ARBITRARY_BAUDRATE_H
+
+// Set any baudrate on the tty, not only the ones that have a B<rate>
+// constant in termios. Uses termios2/BOTHER, so only available on Linux.
+// All other tty parameters are expected to be set up already.
+// Returns 'true' on success.
+bool SetArbitraryBaudrate(int fd, int baud);
+
+#endif  // ARBITRARY_BAUDRATE_H
@@ -0,0 +1,86 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "board-cache.h"
+
+#include <stdio.h>
+
+#include <sstream>
+
+#include "checkpoint.h"
+
+// Read the whole content of the file. Returns 'false' if it can't be read.
+static bool ReadFile(const std::string &filename, std::string *content) {
+    FILE *in = fopen(filename.c_str(), "r");
+    if (!in) {
+        fprintf(stderr, "Can't open %s\n", filename.c_str());
+        return false;
+    }
+    char buffer[65536];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        content->append(buffer, len);
+    }
+    fclose(in);
+    return true;
+}
+
+const JobPlan &BoardCache::Entry::DispensePlan() {
+    std::lock_guard<std::mutex> l(tour_mutex_);
+    if (!tour_done_) {
+        tour_ = JobPlan::Dispense(board_, profile_);
+        tour_done_ = true;
+    }
+    return tour_;
+}
+
+BoardCache::BoardCache(int max_boards, const MachineProfile &profile)
+    : max_boards_(max_boards), profile_(profile) {
+}
+
+std::shared_ptr<BoardCache::Entry> BoardCache::Get(
+    const std::string &rpt_file, bool front, bool *hit) {
+    // The board is parsed from the same content that is hashed, so that it
+    // matches its key even if the file changes meanwhile.
+    std::string content;
+    if (!ReadFile(rpt_file, &content))
+        return NULL;
+    PlanHash hash;
+    hash.Add(content);
+    const Key key(hash.value(), front);
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto found = entries_.find(key);
+        if (found != entries_.end()) {
+            use_order_.splice(use_order_.begin(), use_order_,
+                              found->second.second);
+            *hit = true;
+            return found->second.first;
+        }
+    }
+
+    // Parsed outside the lock, so that other boards can be looked up
+    // meanwhile. If two requests parse the same file, the last one wins.
+    *hit = false;
+    std::shared_ptr<Entry> entry(new Entry(profile_));
+    std::istringstream in(content);
+    if (!entry->board_.ParseFromRpt(&in, [front](const Part &part) {
+                return part.is_front_layer == front;
+            }))
+        return NULL;
+
+    std::lock_guard<std::mutex> l(mutex_);
+    auto found = entries_.find(key);
+    if (found != entries_.end()) {
+        use_order_.erase(found->second.second);
+        entries_.erase(found);
+    }
+    use_order_.push_front(key);
+    entries_[key] = std::make_pair(entry, use_order_.begin());
+    while ((int)entries_.size() > max_boards_) {
+        entries_.erase(use_order_.back());
+        use_order_.pop_back();
+    }
+    return entry;
+}
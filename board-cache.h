@@ -0,0 +1,67 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Boards parsed from rpt files, kept while the files don't change so that
+ * repeated jobs on the same board skip parsing and tour optimization.
+ */
+
+#ifndef BOARD_CACHE_H
+#define BOARD_CACHE_H
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "board.h"
+#include "librpt2pnp.h"
+
+class BoardCache {
+public:
+    class Entry {
+    public:
+        const Board &board() const { return board_; }
+
+        // Pads in the order they are dispensed with the profile of the
+        // cache. Optimized on first use.
+        const JobPlan &DispensePlan();
+
+    private:
+        friend class BoardCache;
+        explicit Entry(const MachineProfile &profile) : profile_(profile) {}
+
+        const MachineProfile &profile_;
+        Board board_;
+        std::mutex tour_mutex_;
+        bool tour_done_ = false;
+        JobPlan tour_;
+    };
+
+    // Keep up to "max_boards"; the least recently used are dropped first.
+    // Tours are optimized for "profile", which has to outlive the cache.
+    BoardCache(int max_boards, const MachineProfile &profile);
+
+    // Board with the parts on the front or back of the rpt file. Parsed if
+    // a file with this content hasn't been seen before; "*hit" tells if it
+    // came from the cache. Returns NULL if the file can't be read. Entries
+    // stay valid while referenced, even if dropped from the cache.
+    // Thread-safe.
+    std::shared_ptr<Entry> Get(const std::string &rpt_file, bool front,
+                               bool *hit);
+
+private:
+    typedef std::pair<uint64_t, bool> Key;   // Content hash, front.
+    typedef std::list<Key> UseList;          // Most recently used first.
+
+    const int max_boards_;
+    const MachineProfile &profile_;
+    std::mutex mutex_;
+    UseList use_order_;
+    std::map<Key, std::pair<std::shared_ptr<Entry>, UseList::iterator> >
+    entries_;
+};
+
+#endif  // BOARD_CACHE_H
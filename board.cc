@@ -5,14 +5,18 @@
 #include "board.h"
 
 #include <math.h>
+
+#include <algorithm>
 #include <fstream>
 
 #include "rpt-parser.h"
 
 Position Part::padAbsPos(const Pad &p) const {
-    const float a = 2 * M_PI * angle / 360.0;
-    return { pos.x + p.pos.x * cos(a) - p.pos.y * sin(a),
-             pos.y + p.pos.x * sin(a) + p.pos.y * cos(a) };
+    // Only the rotation of the pad needs floating point.
+    const double a = 2 * M_PI * angle / 360.0;
+    const double x = p.pos.x_um * cos(a) - p.pos.y_um * sin(a);
+    const double y = p.pos.x_um * sin(a) + p.pos.y_um * cos(a);
+    return pos + Position::FromMicrometers(lround(x), lround(y));
 }
 
 namespace {
@@ -29,8 +33,7 @@ public:
 
 protected:
     void StartBoard(float max_x, float max_y) override {
-        board_dimension_->w = max_x;
-        board_dimension_->h = max_y;
+        *board_dimension_ = Dimension(max_x, max_y);
     }
 
     void StartComponent(const std::string &c) override {
@@ -88,30 +91,23 @@ protected:
         if (in_pad_) {
             current_pad_.pos.Set(x, y);
         } else {
-            current_part_->pos.x = x;
-            current_part_->pos.y = y;
+            current_part_->pos.Set(x, y);
         }
     }
 
     void Size(float w, float h) override {
         if (in_pad_) {
-            current_pad_.size.w = w;
-            current_pad_.size.h = h;
+            current_pad_.size = Dimension(w, h);
 
             // TODO:
-            float x, y;
-            x = current_pad_.pos.x - w/2;
-            if (x < current_part_->bounding_box.p0.x)
-                current_part_->bounding_box.p0.x = x;
-            x = current_pad_.pos.x + w/2;
-            if (x > current_part_->bounding_box.p1.x)
-                current_part_->bounding_box.p1.x = x;
-            y = current_pad_.pos.y - h/2;
-            if (y < current_part_->bounding_box.p0.y)
-                current_part_->bounding_box.p0.y = y;
-            y = current_pad_.pos.y + h/2;
-            if (y > current_part_->bounding_box.p1.y)
-                current_part_->bounding_box.p1.y = y;
+            const ::Position &pad = current_pad_.pos;
+            const Micrometers half_w = current_pad_.size.w_um / 2;
+            const Micrometers half_h = current_pad_.size.h_um / 2;
+            Box *box = &current_part_->bounding_box;
+            box->p0.x_um = std::min(box->p0.x_um, pad.x_um - half_w);
+            box->p1.x_um = std::max(box->p1.x_um, pad.x_um + half_w);
+            box->p0.y_um = std::min(box->p0.y_um, pad.y_um - half_h);
+            box->p1.y_um = std::max(box->p1.y_um, pad.y_um + half_h);
         }
     }
 
@@ -157,11 +153,15 @@ Board::~Board() {
 }
 
 bool Board::ParseFromRpt(const std::string& filename, ReadFilter filter) {
-    PartCollector collector(&parts_, &board_dim_, filter);
     std::ifstream in(filename);
     if (!in.is_open()) {
         fprintf(stderr, "Can't open %s\n", filename.c_str());
         return false;
     }
-    return RptParse(&in, &collector);
+    return ParseFromRpt(&in, filter);
+}
+
+bool Board::ParseFromRpt(std::istream *in, ReadFilter filter) {
+    PartCollector collector(&parts_, &board_dim_, filter);
+    return RptParse(in, &collector);
 }
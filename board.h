@@ -7,6 +7,7 @@
 #define PNP_BOARD_H
 
 #include <functional>
+#include <istream>
 #include <string>
 #include <vector>
 
@@ -49,6 +50,8 @@ public:
 
     // Read from kicad rpt file.
     bool ParseFromRpt(const std::string& filename, ReadFilter filter);
+    // Same, with the content of the file already read.
+    bool ParseFromRpt(std::istream *in, ReadFilter filter);
 
     // Parts. All positions are referenced to (0,0)
     const PartList& parts() const { return parts_; }
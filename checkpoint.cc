@@ -0,0 +1,99 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "checkpoint.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+void PlanHash::AddBytes(const void *data, size_t len) {
+    const uint8_t *bytes = (const uint8_t*) data;
+    for (size_t i = 0; i < len; ++i) {
+        hash_ ^= bytes[i];
+        hash_ *= 0x100000001b3ULL;
+    }
+}
+
+void PlanHash::Add(const std::string &s) {
+    AddBytes(s.c_str(), s.size() + 1);  // Including \0 as separator.
+}
+
+void PlanHash::Add(float value) {
+    // Rounded to what we output, so that float noise doesn't matter.
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", value);
+    Add(std::string(buffer));
+}
+
+void PlanHash::Add(int32_t micrometers) {
+    // Exact; as formatted above, so that plans hash as they did with float.
+    const int64_t um = micrometers;
+    const int64_t abs_um = um < 0 ? -um : um;
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%s%lld.%03lld", um < 0 ? "-" : "",
+             (long long)(abs_um / 1000), (long long)(abs_um % 1000));
+    Add(std::string(buffer));
+}
+
+JobCheckpoint::JobCheckpoint(const std::string &filename)
+    : filename_(filename), plan_hash_(0), total_steps_(0), steps_done_(0),
+      position_known_(false) {}
+
+bool JobCheckpoint::Load() {
+    FILE *in = fopen(filename_.c_str(), "r");
+    if (in == NULL) {
+        perror(filename_.c_str());
+        return false;
+    }
+    char line[256];
+    int fields = 0;
+    while (fgets(line, sizeof(line), in)) {
+        int known;
+        if (sscanf(line, "plan %" SCNx64, &plan_hash_) == 1) ++fields;
+        else if (sscanf(line, "steps %d", &total_steps_) == 1) ++fields;
+        else if (sscanf(line, "done %d", &steps_done_) == 1) ++fields;
+        else if (sscanf(line, "position-known %d", &known) == 1) {
+            position_known_ = known;
+            ++fields;
+        }
+    }
+    fclose(in);
+    if (fields != 4) {
+        fprintf(stderr, "%s: not a valid checkpoint file.\n",
+                filename_.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool JobCheckpoint::Save(uint64_t plan_hash, int total_steps, int steps_done,
+                         bool position_known) {
+    plan_hash_ = plan_hash;
+    total_steps_ = total_steps;
+    steps_done_ = steps_done;
+    position_known_ = position_known;
+
+    // Write new file, then rename: there is always a complete checkpoint,
+    // even if we get killed in the middle of writing.
+    const std::string tmp = filename_ + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "w");
+    if (out == NULL) {
+        perror(tmp.c_str());
+        return false;
+    }
+    fprintf(out, "# rpt2pnp job checkpoint. Continue job with -R\n"
+            "plan %016" PRIx64 "\n"
+            "steps %d\n"
+            "done %d\n"
+            "position-known %d\n",
+            plan_hash_, total_steps_, steps_done_, position_known_ ? 1 : 0);
+    bool success = (fflush(out) == 0 && fsync(fileno(out)) == 0);
+    success &= (fclose(out) == 0);
+    if (!success || rename(tmp.c_str(), filename_.c_str()) != 0) {
+        perror(filename_.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Progress of a job on the machine, persisted after every step, so that an
+ * interrupted job can be resumed where it stopped.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+#include <string>
+
+// Fingerprint of the steps of a job in the order they are executed
+// (FNV-1a). A checkpoint only applies to exactly the same plan.
+class PlanHash {
+public:
+    PlanHash() : hash_(0xcbf29ce484222325ULL) {}
+
+    void Add(const std::string &s);
+    void Add(float value);
+    void Add(int32_t micrometers);   // Same as the value in mm as float.
+
+    uint64_t value() const { return hash_; }
+
+private:
+    void AddBytes(const void *data, size_t len);
+
+    uint64_t hash_;
+};
+
+// A step is a pick and place of a part, or dispensing a pad.
+class JobCheckpoint {
+public:
+    explicit JobCheckpoint(const std::string &filename);
+
+    // Read checkpoint file. Returns 'false' and prints a message if it
+    // can't be read.
+    bool Load();
+
+    // Write checkpoint file, replacing the previous one atomically.
+    // "position_known" says if the machine stopped between steps with its
+    // motors left on, so that no homing is needed to continue.
+    bool Save(uint64_t plan_hash, int total_steps, int steps_done,
+              bool position_known);
+
+    const std::string &filename() const { return filename_; }
+    uint64_t plan_hash() const { return plan_hash_; }
+    int total_steps() const { return total_steps_; }
+    int steps_done() const { return steps_done_; }
+    bool position_known() const { return position_known_; }
+
+private:
+    const std::string filename_;
+    uint64_t plan_hash_;
+    int total_steps_;
+    int steps_done_;
+    bool position_known_;
+};
+
+#endif  // CHECKPOINT_H
@@ -0,0 +1,380 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "farm.h"
+
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "board.h"
+#include "machine.h"
+#include "machine-profile.h"
+#include "monotonic-clock.h"
+#include "pnp-config.h"
+#include "trace-writer.h"
+
+// Don't update the progress line more often than that.
+#define FARM_PROGRESS_MIN_UPDATE_SEC 0.2
+
+// While waiting for the operator, check that often if we should stop.
+#define FARM_STOP_POLL_MS 200
+
+namespace {
+class Farm {
+public:
+    Farm(const std::vector<FarmMachine> &machines, int boards,
+         const JobPlan &plan, const Board &board, const PnPConfig *config,
+         const MachineProfile &profile, const FarmOptions &options,
+         const std::string &comment);
+
+    bool Run();
+
+private:
+    struct MachineState {
+        int board = -1;             // Board worked on; -1 if none.
+        double predicted_done = 0;  // Of the board, in machine seconds.
+        bool started = false;       // A step of the board is done.
+        bool waiting = false;       // For the board to be put in place.
+        bool stalled = false;
+        bool taken_out = false;     // By the operator.
+        int boards_done = 0;
+        int boards_failed = 0;
+        double busy_sec = 0;
+    };
+
+    void DriveMachine(int m);
+
+    // Next board for machine "m". While there is none, waits as long as a
+    // board might come back from another machine. Returns 'false' if there
+    // is none left or we are asked to stop.
+    bool TakeBoard(int m, int *board);
+    bool BoardMightReturnLocked() const;
+
+    // Wait until "board" is in place on machine "m". Returns 'false' if
+    // the machine is to be taken out instead.
+    bool WaitForBoard(int m, int board);
+
+    // Machine "m" is done with its board, "steps_done" of it. The board is
+    // done, failed, or if no step was done, goes back to the others.
+    void ReleaseBoard(int m, int steps_done, bool stalled, double seconds);
+
+    void StepDone(int m, double predicted_done);
+
+    void PrintEventLocked(const char *format, ...)
+        __attribute__((format(printf, 2, 3)));
+    void PrintProgressLocked(bool force);
+    void PrintSummary();
+
+    const std::vector<FarmMachine> &machines_;
+    const int boards_;
+    const JobPlan &plan_;
+    const Board &board_;
+    const PnPConfig *const config_;
+    const MachineProfile &profile_;
+    const FarmOptions &options_;
+    const std::string comment_;
+    const int64_t start_usec_;
+    double predicted_board_sec_;
+
+    std::mutex mutex_;
+    std::deque<int> pending_;    // Boards not started yet.
+    std::condition_variable board_returned_;
+    std::vector<MachineState> states_;
+    int boards_done_;
+    int boards_failed_;
+    int64_t last_print_usec_;
+    bool progress_shown_;
+    int waiting_;                // Machines waiting for their board.
+};
+}  // namespace
+
+Farm::Farm(const std::vector<FarmMachine> &machines, int boards,
+           const JobPlan &plan, const Board &board, const PnPConfig *config,
+           const MachineProfile &profile, const FarmOptions &options,
+           const std::string &comment)
+    : machines_(machines), boards_(boards), plan_(plan), board_(board),
+      config_(config), profile_(profile), options_(options),
+      comment_(comment), start_usec_(GetMonotonicUsec()),
+      predicted_board_sec_(0), states_(machines.size()), boards_done_(0),
+      boards_failed_(0), last_print_usec_(0), progress_shown_(false),
+      waiting_(0) {
+    for (int i = 0; i < boards; ++i) pending_.push_back(i);
+}
+
+bool Farm::BoardMightReturnLocked() const {
+    for (const MachineState &state : states_) {
+        if (state.board >= 0 && !state.started)
+            return true;
+    }
+    return false;
+}
+
+bool Farm::TakeBoard(int m, int *board) {
+    const volatile sig_atomic_t *const stop = options_.job.stop;
+    std::unique_lock<std::mutex> l(mutex_);
+    while (pending_.empty() && !(stop && *stop) && BoardMightReturnLocked()) {
+        board_returned_.wait_for(
+            l, std::chrono::milliseconds(FARM_STOP_POLL_MS));
+    }
+    if (pending_.empty() || (stop && *stop))
+        return false;
+    *board = pending_.front();
+    pending_.pop_front();
+    states_[m].board = *board;
+    states_[m].started = false;
+    states_[m].predicted_done = 0;
+    PrintProgressLocked(true);
+    return true;
+}
+
+bool Farm::WaitForBoard(int m, int board) {
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        states_[m].waiting = true;
+        ++waiting_;
+        // The progress line would overwrite the question.
+        if (progress_shown_) fprintf(stderr, "\n");
+        progress_shown_ = false;
+    }
+    const bool ready = options_.board_ready(m, board);
+    std::lock_guard<std::mutex> l(mutex_);
+    states_[m].waiting = false;
+    states_[m].taken_out = !ready
+        && !(options_.job.stop && *options_.job.stop);
+    --waiting_;
+    PrintProgressLocked(true);
+    return ready;
+}
+
+void Farm::ReleaseBoard(int m, int steps_done, bool stalled, double seconds) {
+    std::lock_guard<std::mutex> l(mutex_);
+    MachineState &state = states_[m];
+    const int board = state.board;
+    state.board = -1;
+    state.busy_sec += seconds;
+    state.stalled = stalled;
+    if (steps_done == plan_.size()) {
+        ++state.boards_done;
+        ++boards_done_;
+    } else if (steps_done == 0) {
+        // Nothing done to the board yet, another machine can do it.
+        pending_.push_front(board);
+        if (stalled) {
+            PrintEventLocked("Machine %d (%s) didn't start board %d; "
+                             "left for the others.\n", m + 1,
+                             machines_[m].name.c_str(), board + 1);
+        }
+    } else {
+        ++state.boards_failed;
+        ++boards_failed_;
+        PrintEventLocked("Machine %d (%s) stopped on board %d after step "
+                         "%d of %d.\n", m + 1, machines_[m].name.c_str(),
+                         board + 1, steps_done, plan_.size());
+    }
+    board_returned_.notify_all();
+    PrintProgressLocked(true);
+}
+
+void Farm::StepDone(int m, double predicted_done) {
+    std::lock_guard<std::mutex> l(mutex_);
+    if (!states_[m].started) {
+        states_[m].started = true;   // The board won't come back.
+        board_returned_.notify_all();
+    }
+    states_[m].predicted_done = predicted_done;
+    PrintProgressLocked(false);
+}
+
+void Farm::PrintEventLocked(const char *format, ...) {
+    if (progress_shown_) fprintf(stderr, "\n");
+    progress_shown_ = false;
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+void Farm::PrintProgressLocked(bool force) {
+    const int64_t now = GetMonotonicUsec();
+    if (waiting_ > 0)
+        return;
+    if (!force && now - last_print_usec_ < FARM_PROGRESS_MIN_UPDATE_SEC * 1e6)
+        return;
+    last_print_usec_ = now;
+    fprintf(stderr, "\rBoards %d/%d", boards_done_, boards_);
+    for (size_t m = 0; m < states_.size(); ++m) {
+        const MachineState &state = states_[m];
+        char cell[32];   // Same width, so that the line doesn't shrink.
+        if (state.waiting) {
+            snprintf(cell, sizeof(cell), "#%d load", state.board + 1);
+        } else if (state.board >= 0) {
+            const double fraction = predicted_board_sec_ > 0
+                ? state.predicted_done / predicted_board_sec_ : 0;
+            snprintf(cell, sizeof(cell), "#%d %d%%", state.board + 1,
+                     (int)(100 * std::min(1.0, fraction)));
+        } else {
+            snprintf(cell, sizeof(cell), "%s", state.stalled ? "stalled"
+                     : state.taken_out ? "out" : "idle");
+        }
+        fprintf(stderr, " | %d: %-9s", (int)m + 1, cell);
+    }
+    const int elapsed = (now - start_usec_) / 1000000;
+    fprintf(stderr, " | %d:%02d elapsed   ", elapsed / 60, elapsed % 60);
+    fflush(stderr);
+    progress_shown_ = true;
+}
+
+void Farm::DriveMachine(int m) {
+    const FarmMachine &farm_machine = machines_[m];
+    const EmitOptions &job = options_.job;
+    const float start_ms = job.start_ms >= 0
+        ? job.start_ms : profile_.dispense_init_ms;
+    const float area_ms = job.start_ms >= 0
+        ? job.area_ms : profile_.dispense_area_ms;
+    const std::string thread_name = "machine " + std::to_string(m + 1);
+    if (job.trace) job.trace->NameThread(thread_name.c_str());
+
+    // Components placed by this machine come off its own tapes.
+    PrivateTapes tapes(config_);
+    int board;
+    bool first_board = true;
+    while (TakeBoard(m, &board)) {
+        // The first board was put in place before we started.
+        if (!first_board && options_.board_ready && !WaitForBoard(m, board)) {
+            ReleaseBoard(m, 0, false, 0);
+            break;
+        }
+        first_board = false;
+        const int64_t start_usec = GetMonotonicUsec();
+        GCodeMachine machine(farm_machine.fd, farm_machine.fd,
+                             start_ms, area_ms);
+        machine.set_quiet(true);
+        machine.set_profile(profile_);
+        machine.set_emergency_stop(options_.emergency_stop, job.stop);
+        machine.set_ack_timeout_slack_ms(options_.ack_timeout_slack_ms);
+        machine.set_trace(job.trace);
+        machine.set_progress(job.progress, predicted_board_sec_);
+        if (job.macro_dialect) machine.set_macro_dialect(job.macro_dialect);
+
+        // Once the machine stalled, the rest of the board is skipped.
+        volatile sig_atomic_t halt = 0;
+        int steps_done = 0;
+        if (machine.Init(tapes.config(),
+                         comment_ + " board " + std::to_string(board + 1),
+                         board_.dimension())) {
+            RunJob(plan_, tapes.config(), 0, &machine, [&](int done) {
+                    if (machine.aborted() || (job.stop && *job.stop)) {
+                        halt = 1;
+                        return;
+                    }
+                    steps_done = done;
+                    StepDone(m, machine.predicted_seconds());
+                }, &halt);
+            machine.Finish();
+        }
+        const int64_t end_usec = GetMonotonicUsec();
+        if (job.trace) {
+            job.trace->Complete("board " + std::to_string(board + 1),
+                                "farm", start_usec, end_usec);
+        }
+        const bool stopped = job.stop && *job.stop;
+        ReleaseBoard(m, steps_done, machine.aborted() && !stopped,
+                     (end_usec - start_usec) / 1e6);
+        if (steps_done < plan_.size())
+            break;  // Stalled or asked to stop.
+    }
+}
+
+void Farm::PrintSummary() {
+    fprintf(stderr, "%-24s %6s %6s %8s  %s\n", "machine", "boards", "failed",
+            "busy[s]", "status");
+    for (size_t m = 0; m < states_.size(); ++m) {
+        const MachineState &state = states_[m];
+        fprintf(stderr, "%-24s %6d %6d %8.1f  %s\n", machines_[m].name.c_str(),
+                state.boards_done, state.boards_failed, state.busy_sec,
+                state.stalled ? "stalled" : state.taken_out ? "taken out"
+                : "ok");
+    }
+    const int not_started = boards_ - boards_done_ - boards_failed_;
+    fprintf(stderr, "%d boards done (%d failed, %d not started) on %d "
+            "machines in %.1fs.\n", boards_done_, boards_failed_, not_started,
+            (int)machines_.size(),
+            (GetMonotonicUsec() - start_usec_) / 1e6);
+}
+
+bool Farm::Run() {
+    if (config_ == NULL) {
+        fprintf(stderr, "Need configuration\n");
+        return false;
+    }
+    const EmitOptions &job = options_.job;
+    predicted_board_sec_ = EstimateJobSeconds(
+        plan_, board_, config_, profile_, job.start_ms, job.area_ms, 0, true);
+
+    std::vector<std::thread> threads;
+    for (size_t m = 0; m < machines_.size(); ++m) {
+        threads.push_back(std::thread(&Farm::DriveMachine, this, (int)m));
+    }
+    for (std::thread &t : threads) t.join();
+
+    if (progress_shown_) fprintf(stderr, "\n");
+    PrintSummary();
+    return boards_done_ == boards_;
+}
+
+bool RunFarm(const std::vector<FarmMachine> &machines, int boards,
+             const JobPlan &plan, const Board &board, const PnPConfig *config,
+             const MachineProfile &profile, const FarmOptions &options,
+             const std::string &comment) {
+    // Check once here, not on every machine.
+    if (options.job.macro_dialect
+        && !GCodeMachine(stdout, 0, 0).set_macro_dialect(
+            options.job.macro_dialect)) {
+        return false;
+    }
+    Farm farm(machines, boards, plan, board, config, profile, options,
+              comment);
+    return farm.Run();
+}
+
+BoardReadyCallback PromptBoardChange(const std::vector<FarmMachine> &machines,
+                                     const volatile sig_atomic_t *stop) {
+    std::shared_ptr<std::mutex> terminal(new std::mutex());
+    return [machines, stop, terminal](int machine, int board) {
+        std::lock_guard<std::mutex> l(*terminal);
+        if (stop && *stop)
+            return false;
+        fprintf(stderr, "Machine %d (%s): put board %d in place and press "
+                "Enter, or q Enter to take the machine out: ", machine + 1,
+                machines[machine].name.c_str(), board + 1);
+        fflush(stderr);
+        // Ctrl-C might be handled on another thread, so look at "*stop"
+        // while waiting.
+        std::string answer;
+        for (;;) {
+            if (stop && *stop)
+                return false;
+            struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+            if (poll(&pfd, 1, FARM_STOP_POLL_MS) <= 0)
+                continue;
+            char c;
+            if (read(STDIN_FILENO, &c, 1) <= 0)
+                return false;   // No one there to answer.
+            if (c == '\n')
+                break;
+            answer.push_back(c);
+        }
+        return answer.empty() || answer[0] != 'q';
+    };
+}
@@ -0,0 +1,60 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Several machines working through copies of the same board, e.g. a row of
+ * printers converted to dispensers.
+ */
+
+#ifndef FARM_H
+#define FARM_H
+
+#include <signal.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "librpt2pnp.h"
+
+struct FarmMachine {
+    std::string name;   // Shown in progress and summary, e.g. the device.
+    int fd;             // Connection, see OpenMachineConnection().
+};
+
+// Waits until "board" is in place on "machine", the index of the machine.
+// Returns 'false' if the machine is to be taken out instead.
+typedef std::function<bool(int machine, int board)> BoardReadyCallback;
+
+struct FarmOptions {
+    EmitOptions job;              // Dispensing times, macros, progress, stop.
+    std::string emergency_stop;   // See GCodeMachine::set_emergency_stop()
+    int ack_timeout_slack_ms;
+
+    // Called on the thread of a machine before it starts on each board
+    // after its first. Not set: boards are changed without our help, e.g.
+    // by a conveyor, or there are none (emulated machines).
+    BoardReadyCallback board_ready;
+};
+
+// Board change by the operator: asks on the terminal to put the board in
+// place and press Enter, or "q" to take the machine out. One machine is
+// asked at a time; none once "*stop" is set.
+BoardReadyCallback PromptBoardChange(const std::vector<FarmMachine> &machines,
+                                     const volatile sig_atomic_t *stop);
+
+// Do the job of the plan on "boards" copies of the board, on all machines
+// at once. Each machine is driven by its own thread and takes the next
+// board whenever it is done with one, so faster machines do more.
+// A machine that stalls is taken out: a board it didn't start on yet goes to
+// the other machines, which wait for that before they stop; a board it was
+// working on counts as failed. Before a machine starts on another board,
+// options.board_ready has to agree. For pick'n place, each machine takes
+// the components off its own tapes of config. Progress of all machines is
+// shown on one line on stderr, a summary per machine at the end. Returns
+// 'true' if all boards were done.
+bool RunFarm(const std::vector<FarmMachine> &machines, int boards,
+             const JobPlan &plan, const Board &board, const PnPConfig *config,
+             const MachineProfile &profile, const FarmOptions &options,
+             const std::string &comment);
+
+#endif  // FARM_H
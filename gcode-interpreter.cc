@@ -0,0 +1,138 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "gcode-interpreter.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Until told otherwise, assume a slow-ish default feed in mm/s.
+#define DEFAULT_FEEDRATE 50.0
+
+void ParseGCodeLine(const char *line, size_t len,
+                    std::vector<GCodeCommand> *commands) {
+    const char *end = line + len;
+    GCodeCommand *current = NULL;
+    while (line < end) {
+        const char c = toupper(*line);
+        if (c == ';' || c == '\n' || c == '\0')
+            break;
+        if (c == '(') {
+            const char *close = (const char*) memchr(line, ')', end - line);
+            line = close ? close + 1 : end;
+            continue;
+        }
+        if (!isalpha(c)) {
+            ++line;
+            continue;
+        }
+        char *number_end;
+        const float value = strtof(line + 1, &number_end);
+        if (number_end == line + 1) {
+            ++line;   // Letter without number, e.g. "G28 X Y".
+            if (current) current->Set(c, 0);
+            continue;
+        }
+        line = number_end;
+        if (c == 'G' || c == 'M' || c == 'T') {
+            commands->push_back(GCodeCommand());
+            current = &commands->back();
+            current->letter = c;
+            current->code = (int)value;
+        } else {
+            if (current == NULL) {
+                commands->push_back(GCodeCommand());
+                current = &commands->back();
+                current->letter = 'G';
+                current->code = 1;
+            }
+            current->Set(c, value);
+        }
+    }
+}
+
+GCodeInterpreter::GCodeInterpreter()
+    : absolute_(true), feedrate_(DEFAULT_FEEDRATE), writing_file_(false) {
+    for (int i = 0; i < NUM_AXES; ++i) pos_[i] = 0;
+}
+
+void GCodeInterpreter::Interpret(const char *line, size_t len,
+                                 std::vector<Step> *steps) {
+    static const char kAxisLetter[NUM_AXES] = { 'X', 'Y', 'Z', 'E' };
+    std::vector<GCodeCommand> commands;
+    ParseGCodeLine(line, len, &commands);
+    for (const GCodeCommand &cmd : commands) {
+        // Between M28 and M29, lines are written to a file, not executed.
+        if (writing_file_) {
+            writing_file_ = !(cmd.letter == 'M' && cmd.code == 29);
+            continue;
+        }
+        Step step;
+        step.kind = Step::OTHER;
+        step.feedrate = feedrate_;
+        step.dwell_ms = 0;
+        step.code = (cmd.letter == 'M') ? -cmd.code : cmd.code;
+        for (int i = 0; i < NUM_AXES; ++i) step.delta[i] = 0;
+
+        if (cmd.letter == 'G') {
+            switch (cmd.code) {
+            case 0: case 1:
+                if (cmd.Has('F')) feedrate_ = cmd.Get('F', 0) / 60.0;
+                step.kind = Step::MOVE;
+                step.feedrate = feedrate_;
+                for (int i = 0; i < NUM_AXES; ++i) {
+                    if (!cmd.Has(kAxisLetter[i])) continue;
+                    const float v = cmd.Get(kAxisLetter[i], 0);
+                    const float target = absolute_ ? v : pos_[i] + v;
+                    step.delta[i] = target - pos_[i];
+                    pos_[i] = target;
+                }
+                break;
+            case 4:
+                step.kind = Step::DWELL;
+                step.dwell_ms = cmd.Get('P', 0) + 1000 * cmd.Get('S', 0);
+                break;
+            case 28:
+                step.kind = Step::HOME;
+                for (int i = 0; i < NUM_AXES; ++i) {
+                    if (cmd.params_set == 0 || cmd.Has(kAxisLetter[i]))
+                        pos_[i] = 0;
+                }
+                break;
+            case 90: absolute_ = true; break;
+            case 91: absolute_ = false; break;
+            case 92:
+                for (int i = 0; i < NUM_AXES; ++i) {
+                    if (cmd.Has(kAxisLetter[i]))
+                        pos_[i] = cmd.Get(kAxisLetter[i], 0);
+                }
+                break;
+            }
+        } else if (cmd.letter == 'M' && cmd.code == 400) {
+            step.kind = Step::WAIT_FOR_MOVES;
+        } else if (cmd.letter == 'M' && cmd.code == 28) {
+            writing_file_ = true;
+        }
+        steps->push_back(step);
+    }
+}
+
+double GCodeInterpreter::NominalSeconds(const Step &step) {
+    switch (step.kind) {
+    case Step::MOVE: {
+        // Like most firmwares: length of the XYZ move; E only if nothing else.
+        double len = sqrt(step.delta[AXIS_X] * step.delta[AXIS_X]
+                          + step.delta[AXIS_Y] * step.delta[AXIS_Y]
+                          + step.delta[AXIS_Z] * step.delta[AXIS_Z]);
+        if (len == 0) len = fabs(step.delta[AXIS_E]);
+        return step.feedrate > 0 ? len / step.feedrate : 0;
+    }
+    case Step::DWELL:
+        return step.dwell_ms / 1000.0;
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,82 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Minimal interpretation of the G-code we send to the machine, so that we
+ * know what each line is doing (moving, dwelling, homing) and how long it
+ * takes.
+ */
+
+#ifndef GCODE_INTERPRETER_H
+#define GCODE_INTERPRETER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// A single command: G or M word with its parameters.
+struct GCodeCommand {
+    GCodeCommand() : letter(0), code(0), params_set(0) {}
+
+    bool Has(char p) const { return params_set & (1 << (p - 'A')); }
+    float Get(char p, float fallback) const {
+        return Has(p) ? params[p - 'A'] : fallback;
+    }
+    void Set(char p, float value) {
+        params_set |= (1 << (p - 'A'));
+        params[p - 'A'] = value;
+    }
+
+    char letter;          // 'G', 'M', 'T'
+    int code;             // Number after the letter.
+    uint32_t params_set;  // Bit per letter A..Z
+    float params[26];
+};
+
+// Split a line into its commands. There can be more than one per line,
+// e.g. "G91 G1 Y-10 G90". Comments in parenthesis and after ';' are skipped.
+// Parameters without a preceding G/M word are attached to an implicit G1.
+void ParseGCodeLine(const char *line, size_t len,
+                    std::vector<GCodeCommand> *commands);
+
+// Keeps track of the modal state of the machine (position, feedrate,
+// absolute/relative) while G-code lines go by, and turns each line into
+// the steps the machine executes.
+class GCodeInterpreter {
+public:
+    enum Axis { AXIS_X, AXIS_Y, AXIS_Z, AXIS_E, NUM_AXES };
+
+    struct Step {
+        enum Kind {
+            OTHER,           // Something that takes no time worth mentioning
+            MOVE,            // Linear move by "delta" with "feedrate"
+            DWELL,           // Wait for moves to finish, then "dwell_ms"
+            WAIT_FOR_MOVES,  // Wait for moves to finish (M400)
+            HOME,            // Homing; duration unknown.
+        };
+        Kind kind;
+        float delta[NUM_AXES];
+        float feedrate;      // mm/s
+        float dwell_ms;
+        int code;            // Original G or M code; negative for M codes.
+    };
+
+    GCodeInterpreter();
+
+    // Interpret the line and append the resulting steps.
+    void Interpret(const char *line, size_t len, std::vector<Step> *steps);
+
+    // Seconds a step takes if moving with its feedrate all the way, without
+    // acceleration. Homing and waiting are reported as zero.
+    static double NominalSeconds(const Step &step);
+
+    float position(Axis a) const { return pos_[a]; }
+
+private:
+    float pos_[NUM_AXES];
+    bool absolute_;
+    float feedrate_;  // mm/s
+    bool writing_file_;  // M28 .. M29
+};
+
+#endif  // GCODE_INTERPRETER_H
@@ -34,44 +34,52 @@
 #include "machine.h"
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "tape.h"
 #include "board.h"
 
 #include "pnp-config.h"
 #include "machine-connection.h"
+#include "monotonic-clock.h"
+#include "job-stats.h"
+#include "sd-card.h"
+#include "time-estimator.h"
+#include "trace-writer.h"
 
-// TODO: most of these constants should be configurable or deduced from board/
-// configuration.
-
-// Hovering while transporting a component.
-// TODO: calculate that to not knock over already placed components.
-#define PNP_Z_HOVERING 10
+// Speeds, clearances and timing of pick'n place and dispensing are in the
+// MachineProfile.
 
-// Components are a bit higher as they are resting on some card-board. Let's
-// assume some value here.
-// Ultimately, we want the placement operation be a bit spring-loaded.
-#define PNP_TAPE_THICK 0.0
+// How long to wait for acknowledge of commands during emergency stop.
+// Some stop commands (M112) kill the firmware, so there might never be one.
+#define ESTOP_ACK_TIMEOUT_MS 2000
 
-// Multiplication to get 360 degrees mapped to one turn. This is specific to
-// our stepper motor.
-#define PNP_ANGLE_FACTOR (50.34965 / 360)
+// Timeout waiting for an 'ok' is derived from the expected duration of the
+// commands: times this factor (acceleration, machine speed limits) plus slack.
+#define ACK_TIMEOUT_FACTOR 3.0
+#define ACK_TIMEOUT_SLACK_MS 5000    // Default; see set_ack_timeout_slack_ms()
+#define ACK_TIMEOUT_HOMING_SEC 60   // We don't know how far away home is.
 
-// Speeds in mm/s
-#define PNP_TO_TAPE_SPEED 1000      // moving needle to tape
-#define PNP_TO_BOARD_SPEED 100      // moving component from tape to board
+// Command to see if the machine is still alive after it stalled. Every
+// firmware answers that.
+#define STALL_PROBE_COMMAND "M105"
+#define STALL_PROBE_TIMEOUT_MS 2000
 
-#define DISP_MOVE_SPEED 400         // move dispensing unit to next pad
-#define DISP_DISPENSE_SPEED 100     // speed when doing the dispensing down/up
+// Number of times we send a line again if the machine asks for it.
+#define MAX_RESENDS 3
 
-#define DISP_Z_DISPENSING_ABOVE 0.3      // Above board when dispensing
-#define DISP_Z_HOVER_ABOVE 2             // Above board when moving around
-#define DISP_Z_SEPARATE_DROPLET_ABOVE 5  // Above board right after dispensing.
+// While printing from SD card, ask for progress that often.
+#define SD_POLL_INTERVAL_MS 2000
 
 // All templates should be in a separate file somewhere so that we don't
 // have to compile.
@@ -101,26 +109,28 @@ G92 E0     ('home' E axis)
 G1 Z%.1f E0 (Move needle out of way)
 )";
 
-// param: name, move-speed, x, y, zup, zdown, a, zup
+// param: name, move-speed, x, y, zup, a, zdown, plunge-speed, zup
+// (macro parameters: see kPickParams)
 static const char *const gcode_pick = R"(
 ( -- Pick %s -- )
 G0 F%d X%.3f Y%.3f Z%.3f E%.3f (Move over component to pick.)
-G1 Z%-6.2f   F4000 (move down on tape)
+G1 Z%-6.2f   F%d (move down on tape)
 G4                 (flush buffer)
 M42 P6 S255        (turn on suckage)
 G1 Z%-6.3f         (Move up a bit for travelling)
 )";
 
-// param: name, place-speed, x, y, zup, a, zdown, zup
+// param: name, place-speed, x, y, zup, a, zdown, plunge-speed, blow-ms, zup
+// (macro parameters: see kPlaceParams)
 static const char *const gcode_place = R"(
 ( -- Place %s -- )
 G0 F%d X%.3f Y%.3f Z%.3f E%.3f (Move component to place on board.)
-G1 Z%-6.3f F4000 (move down over board thickness)
+G1 Z%-6.3f F%d (move down over board thickness)
 G4               (flush buffer.)
 M42 P6 S0        (turn off suckage)
 G4               (flush buffer.)
 M42 P8 S255      (blow)
-G4 P40           (.. for 40ms)
+G4 P%-4d         (.. a bit)
 M42 P8 S0        (done.)
 G1 Z%-6.2f       (Move up)
 )";
@@ -142,6 +152,98 @@ M107            (switch off solenoid)
 G1 Z%.2f        (high above to have paste separated)
 )";
 
+// Parameter letters of the conversions in gcode_pick and gcode_place, for
+// their firmware macros. The name in the first line is not passed.
+static const char kPickParams[] = "FXYZEDSU";
+static const char kPlaceParams[] = "FXYZEDSBU";
+
+// Pick and place as firmware macros: defined once in the preamble, then
+// each pick or place is a single call. Both the macro bodies and the calls
+// are generated from gcode_pick and gcode_place, see BuildMacro().
+struct MacroDialect {
+    const char *name;
+    const char *note;          // For the operator; can be NULL.
+    const char *header;        // Before the definitions.
+    const char *define_begin;  // Format with the macro name.
+    const char *line_prefix;   // Of each line in the macro body.
+    const char *define_end;
+    const char *parameter;     // Format with the letter, in the body.
+    const char *call;          // Format with the macro name.
+    const char *assign;        // Between letter and value in the call.
+    const char *pick_macro;
+    const char *place_macro;
+};
+
+static const MacroDialect kMacroDialects[] = {
+    // RepRapFirmware: macros are files on the SD card, written with M28/M29
+    // and called with M98; call parameters are available as {param.<letter>}.
+    { "rrf", NULL, "\n",
+      "M28 \"0:/macros/%s.g\"\n", "", "M29\n", "{param.%c}",
+      "M98 P\"0:/macros/%s.g\"", "", "pnp-pick", "pnp-place",
+    },
+    // Klipper: macros can only be defined in printer.cfg, so we can't send
+    // them. Shown as comment in the preamble to be copied from there.
+    { "klipper",
+      "PNP_PICK and PNP_PLACE need to be in printer.cfg; see the preamble "
+      "of the G-code output for their definition.",
+      "\n; Klipper: these macros need to be in printer.cfg\n",
+      "; [gcode_macro %s]\n; gcode:\n", ";   ", ";\n", "{params.%c}",
+      "%s", "=", "PNP_PICK", "PNP_PLACE",
+    },
+};
+
+// Turns a pick or place template into the body of a macro and the format
+// of its call, which takes the same parameters as the template.
+static void BuildMacro(const MacroDialect &dialect, const char *name,
+                       const char *format, const char *params,
+                       std::string *definition, std::string *call) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), dialect.define_begin, name);
+    definition->append(buffer);
+    std::string call_args;
+    const char *param = params;
+    for (const char *line = format; *line; /**/) {
+        const char *eol = strchrnul(line, '\n');
+        std::string body;
+        bool is_name = false;
+        for (const char *c = line; c < eol; ++c) {
+            if (*c == '(') {   // Comment; only the name line has a conversion.
+                const char *close = std::find(c, eol, ')');
+                is_name |= (std::find(c, close, '%') != close);
+                c = close;
+                continue;
+            }
+            if (*c != '%') {
+                if (*c != ' ' || (!body.empty() && body.back() != ' '))
+                    body.push_back(*c);
+                continue;
+            }
+            // Conversion: flags and width only matter for the layout of the
+            // plain G-code; the call keeps the precision.
+            ++c;
+            while (*c == '-' || isdigit(*c)) ++c;
+            const char *precision = c;
+            while (*c == '.' || isdigit(*c)) ++c;
+            snprintf(buffer, sizeof(buffer), dialect.parameter, *param);
+            body.append(buffer);
+            call_args.append(" ").append(1, *param).append(dialect.assign)
+                .append("%").append(precision, c - precision + 1);
+            ++param;
+        }
+        while (!body.empty() && body.back() == ' ') body.pop_back();
+        if (is_name) {
+            call->append(line, eol - line).append("\n");
+        } else if (!body.empty()) {
+            definition->append(dialect.line_prefix).append(body).append("\n");
+        }
+        line = *eol ? eol + 1 : eol;
+    }
+    assert(*param == '\0');  // Each parameter has a letter.
+    definition->append(dialect.define_end);
+    snprintf(buffer, sizeof(buffer), dialect.call, name);
+    call->append(buffer).append(call_args).append("\n");
+}
+
 static const char *const gcode_finish = R"(
 M107       (turn off dispensing solenoid)
 M42 P6 S0  (turn off pnp vacuum)
@@ -152,11 +254,30 @@ G28 X0 Y0  (Home x/y, but leave z clear)
 M84        (stop motors)
 )";
 
+// Stopped between steps on request: like gcode_finish, but the motors stay on
+// so that the machine keeps its position and the job can be resumed without
+// homing.
+static const char *const gcode_finish_hold = R"(
+M107       (turn off dispensing solenoid)
+M42 P6 S0  (turn off pnp vacuum)
+G91        (we want to move z relative)
+G1 Z10     (move above any obstacles)
+G90        (back to sane absolute position default)
+M400       (motors stay on, so position is kept)
+)";
+
 GCodeMachine::GCodeMachine(
     std::function<void(const char *str, size_t len)> write_line,
     float init_ms, float area_ms)
     : write_line_(std::move(write_line)), init_ms_(init_ms), area_ms_(area_ms),
-      config_(NULL), do_homing_(true) {}
+      input_fd_(-1), output_fd_(-1),
+      config_(NULL), do_homing_(true), quiet_(false), stop_requested_(NULL),
+      aborted_(false), position_held_(false),
+      ack_timeout_slack_ms_(ACK_TIMEOUT_SLACK_MS),
+      pending_motion_sec_(0), pending_motion_update_ms_(0), sd_printing_(false), macros_(NULL),
+      progress_estimator_(NULL), progress_style_(PROGRESS_NONE),
+      progress_interval_sec_(0), progress_total_sec_(0),
+      next_progress_sec_(0), stats_(NULL), trace_(NULL) {}
 
 GCodeMachine::GCodeMachine(FILE *output, float init_ms, float area_ms)
     : GCodeMachine([output](const char *str, size_t len) {
@@ -167,12 +288,36 @@ GCodeMachine::GCodeMachine(FILE *output, float init_ms, float area_ms)
 
 GCodeMachine::GCodeMachine(int input_fd, int output_fd,
                            float init_ms, float area_ms)
-    : GCodeMachine([input_fd, output_fd](const char *str, size_t len) {
-            if (len == 0 || *str == '\n' || *str == ';' || *str == '(')
-                return;  // Ignore empty lines or all-comment lines.
-            write(output_fd, str, len);
-            WaitForOkAck(input_fd);
+    : GCodeMachine([this](const char *str, size_t len) {
+            StreamLine(str, len);
         }, init_ms, area_ms) {
+    input_fd_ = input_fd;
+    output_fd_ = output_fd;
+}
+
+GCodeMachine::~GCodeMachine() {
+    delete progress_estimator_;
+}
+
+bool GCodeMachine::set_macro_dialect(const std::string &dialect) {
+    for (const MacroDialect &d : kMacroDialects) {
+        if (dialect == d.name) {
+            macros_ = &d;
+            macro_definitions_ = d.header;
+            pick_call_.clear();
+            place_call_.clear();
+            BuildMacro(d, d.pick_macro, gcode_pick, kPickParams,
+                       &macro_definitions_, &pick_call_);
+            BuildMacro(d, d.place_macro, gcode_place, kPlaceParams,
+                       &macro_definitions_, &place_call_);
+            return true;
+        }
+    }
+    fprintf(stderr, "Unknown macro dialect '%s'. Choose one of:",
+            dialect.c_str());
+    for (const MacroDialect &d : kMacroDialects) fprintf(stderr, " %s", d.name);
+    fprintf(stderr, "\n");
+    return false;
 }
 
 bool GCodeMachine::Init(const PnPConfig *config,
@@ -184,8 +329,10 @@ bool GCodeMachine::Init(const PnPConfig *config,
         fprintf(stderr, "Need configuration\n");
         return false;
     }
-    fprintf(stderr, "Board-thickness = %.1fmm\n",
-            config_->board.top - config_->bed_level);
+    if (!quiet_) {
+        fprintf(stderr, "Board-thickness = %.1fmm\n",
+                config_->board.top - config_->bed_level);
+    }
     SendFormattedCommands("( %s )\n", init_comment.c_str());
     float highest_tape = config_->board.top;
     for (const auto &t : config_->tape_for_component) {
@@ -194,70 +341,378 @@ bool GCodeMachine::Init(const PnPConfig *config,
     SendFormattedCommands(gcode_preamble_safe_state);
     if (do_homing_) SendFormattedCommands(gcode_preamble_homing);
     SendFormattedCommands(gcode_preamble_defaults, highest_tape + 10);
+    if (macros_) {
+        if (macros_->note && !quiet_) fprintf(stderr, "%s\n", macros_->note);
+        SendFormattedCommands("%s", macro_definitions_.c_str());
+    }
+    return true;
+}
+
+bool GCodeMachine::ParseProgressSpec(const char *spec, ProgressStyle *style,
+                                     float *interval_sec) {
+    const char *comma = strchr(spec, ',');
+    const std::string name(spec, comma ? comma - spec : strlen(spec));
+    if (name == "m73") {
+        *style = PROGRESS_M73;
+    } else if (name == "m117") {
+        *style = PROGRESS_M117;
+    } else {
+        fprintf(stderr, "Unknown progress style '%s'. Choose m73 or m117\n",
+                name.c_str());
+        return false;
+    }
+    if (comma && (sscanf(comma + 1, "%f", interval_sec) != 1
+                  || *interval_sec <= 0)) {
+        fprintf(stderr, "Invalid progress interval '%s'\n", comma + 1);
+        return false;
+    }
     return true;
 }
 
+bool GCodeMachine::set_progress(const char *spec, double total_sec) {
+    ProgressStyle style = PROGRESS_NONE;
+    float interval_sec = DEFAULT_PROGRESS_INTERVAL_SEC;
+    if (spec && !ParseProgressSpec(spec, &style, &interval_sec))
+        return false;
+    set_progress(style, interval_sec, total_sec);
+    return true;
+}
+
+void GCodeMachine::set_progress(ProgressStyle style, float interval_sec,
+                                double total_sec) {
+    delete progress_estimator_;
+    progress_estimator_ = new JobTimeEstimator(profile_);
+    progress_style_ = style;
+    progress_interval_sec_ = interval_sec;
+    progress_total_sec_ = total_sec;
+    next_progress_sec_ = interval_sec;
+}
+
+double GCodeMachine::predicted_seconds() const {
+    return progress_estimator_ ? progress_estimator_->total_seconds() : 0;
+}
+
+void GCodeMachine::ReportProgress(bool done) {
+    if (progress_style_ == PROGRESS_NONE)
+        return;
+    const double predicted = predicted_seconds();
+    if (!done && predicted < next_progress_sec_)
+        return;
+    while (next_progress_sec_ <= predicted)
+        next_progress_sec_ += progress_interval_sec_;
+    int percent = 100, minutes_left = 0;
+    if (!done && progress_total_sec_ > 0) {
+        // Never claim to be done before we are.
+        percent = std::min(99, (int)(100 * predicted / progress_total_sec_));
+        minutes_left = std::max(0, (int)ceil((progress_total_sec_ - predicted)
+                                             / 60));
+    }
+    // Not part of the time model, so that it matches the prediction.
+    char line[64];
+    int len;
+    if (progress_style_ == PROGRESS_M73) {
+        len = snprintf(line, sizeof(line), "M73 P%d R%d\n",
+                       percent, minutes_left);
+    } else {
+        len = snprintf(line, sizeof(line), "M117 %d%% %d:%02d left\n",
+                       percent, minutes_left / 60, minutes_left % 60);
+    }
+    SendLines(line, len);
+}
+
+// Feedrates in G-code are in mm/min.
+static int MmPerMinute(float mm_per_second) {
+    return lroundf(60 * mm_per_second);
+}
+
 void GCodeMachine::PickPart(const Part &part, const Tape *tape) {
     if (tape == NULL) return;
     float px, py;
     if (!tape->GetPos(&px, &py)) {
-        fprintf(stderr, "We are out of components for %s %s\n",
-                part.footprint.c_str(), part.value.c_str());
+        if (!quiet_) {
+            fprintf(stderr, "We are out of components for %s %s\n",
+                    part.footprint.c_str(), part.value.c_str());
+        }
         return;
     }
 
     const float board_thick = config_->board.top - config_->bed_level;
-    const float travel_height = tape->height() + board_thick + PNP_Z_HOVERING;
+    const float travel_height = tape->height() + board_thick
+        + profile_.pnp_hover;
     const std::string print_name = part.component_name + " ("
         + part.footprint + "@" + part.value + ")";
 
     // param: name, x, y, zdown, a, zup
-    SendFormattedCommands(
-        gcode_pick,
+    SendCommandsOrMacroCall(
+        gcode_pick, macros_ ? pick_call_.c_str() : NULL,
         print_name.c_str(),
-        60 * PNP_TO_TAPE_SPEED,
-        px, py, tape->height() + PNP_Z_HOVERING,     // component pos.
-        PNP_ANGLE_FACTOR * fmod(tape->angle(), 360.0),   // pickup angle
+        MmPerMinute(profile_.pnp_to_tape_speed),
+        px, py, tape->height() + profile_.pnp_hover,  // component pos.
+        profile_.pnp_angle_factor * fmod(tape->angle(), 360.0),  // pickup angle
         tape->height(),                              // down to component
+        MmPerMinute(profile_.pnp_plunge_speed),
         travel_height);                              // up for travel.
+    ReportProgress(false);
 }
 
 void GCodeMachine::PlacePart(const Part &part, const Tape *tape) {
     if (tape == NULL) return;
     const float board_thick = config_->board.top - config_->bed_level;
-    const float travel_height = tape->height() + board_thick + PNP_Z_HOVERING;
+    const float travel_height = tape->height() + board_thick
+        + profile_.pnp_hover;
     const std::string print_name = part.component_name + " ("
         + part.footprint + "@" + part.value + ")";
 
     // param: name, x, y, zup, a, zdown, zup
-    SendFormattedCommands(
-        gcode_place,
+    SendCommandsOrMacroCall(
+        gcode_place, macros_ ? place_call_.c_str() : NULL,
         print_name.c_str(),
-        60 * PNP_TO_BOARD_SPEED,
-        part.pos.x + config_->board.origin.x,
-        part.pos.y + config_->board.origin.y,
+        MmPerMinute(profile_.pnp_to_board_speed),
+        (part.pos + config_->board.origin).x(),
+        (part.pos + config_->board.origin).y(),
         travel_height,
-        PNP_ANGLE_FACTOR * fmod(part.angle - tape->angle() + 360, 360.0),
-        tape->height() + board_thick - PNP_TAPE_THICK,
+        profile_.pnp_angle_factor
+        * fmod(part.angle - tape->angle() + 360, 360.0),
+        tape->height() + board_thick - profile_.pnp_tape_thick,
+        MmPerMinute(profile_.pnp_plunge_speed),
+        (int) profile_.pnp_blow_ms,
         travel_height);
+    ReportProgress(false);
 }
 
  void GCodeMachine::Dispense(const Part &part, const Pad &pad) {
      const Position pad_pos = config_->board.origin + part.padAbsPos(pad);
-     const float area = pad.size.w * pad.size.h;
+     const float area = pad.size.w() * pad.size.h();
      SendFormattedCommands(gcode_dispense_move,
                            part.component_name.c_str(), pad.name.c_str(),
-                           DISP_MOVE_SPEED * 60,
-                           pad_pos.x, pad_pos.y,
-                           config_->board.top + DISP_Z_HOVER_ABOVE);
-     SendFormattedCommands(gcode_dispense_paste, DISP_DISPENSE_SPEED * 60,
-                           config_->board.top + DISP_Z_DISPENSING_ABOVE,
+                           MmPerMinute(profile_.dispense_move_speed),
+                           pad_pos.x(), pad_pos.y(),
+                           config_->board.top + profile_.dispense_z_hover);
+     SendFormattedCommands(gcode_dispense_paste,
+                           MmPerMinute(profile_.dispense_speed),
+                           config_->board.top + profile_.dispense_z_dispensing,
                            init_ms_ + area * area_ms_, area,
-                           config_->board.top + DISP_Z_SEPARATE_DROPLET_ABOVE);
+                           config_->board.top + profile_.dispense_z_separate);
+     ReportProgress(false);
+}
+
+void GCodeMachine::PrintFromSD() {
+    const std::string filename = sd_filename_;
+    sd_filename_.clear();  // From now on, we talk to the machine directly.
+    JobStats::Scope stream_scope(stats_, JobStats::PHASE_STREAM);
+    // SD card functions expect the usual bi-directional connection.
+    if (!UploadToSDCard(output_fd_, filename, sd_program_)
+        || !StartSDPrint(output_fd_)) {
+        fprintf(stderr, "SD print failed.\n");
+        aborted_ = true;
+        return;
+    }
+    sd_printing_ = true;
+    long done = 0, total = 0;
+    while (sd_printing_) {
+        // Sleep is cut short by Ctrl-C.
+        usleep(SD_POLL_INTERVAL_MS * 1000);
+        if (stop_requested_ != NULL && *stop_requested_) {
+            if (!emergency_stop_command_.empty()) {
+                EmergencyStop(0);
+            } else {
+                AbortSDPrint(output_fd_);
+                sd_printing_ = false;
+                EnterSafeState();
+            }
+            break;
+        }
+        const SDPrintState state = PollSDPrint(output_fd_, &done, &total);
+        if (state == SD_PRINT_ERROR) {
+            // The machine might still be printing; all we can do is tell.
+            fprintf(stderr, "SD print state unknown; check the machine.\n");
+            aborted_ = true;
+            sd_printing_ = false;
+            return;
+        }
+        if (state == SD_PRINT_FINISHED) {
+            sd_printing_ = false;
+            break;
+        }
+        fprintf(stderr, "\rSD print: %5.1f%% (%ld/%ld bytes)",
+                total > 0 ? 100.0 * done / total : 0, done, total);
+    }
+    fprintf(stderr, "\nSD print %s.\n", aborted_ ? "aborted" : "done");
 }
 
 void GCodeMachine::Finish() {
-    SendFormattedCommands(gcode_finish);
+    position_held_ = (input_fd_ >= 0 && sd_filename_.empty() && !aborted_
+                      && stop_requested_ != NULL && *stop_requested_);
+    SendFormattedCommands(position_held_ ? gcode_finish_hold : gcode_finish);
+    if (progress_estimator_) progress_estimator_->Finish();
+    ReportProgress(true);
+    if (!sd_filename_.empty() && !aborted_)
+        PrintFromSD();
+    if (!quiet_) link_stats_.PrintSummary(stderr);
+    if (!link_stats_file_.empty())
+        link_stats_.WriteJson(link_stats_file_);
+}
+
+int GCodeMachine::ExpectedAckMillis(const char *str, size_t len) {
+    // An 'ok' might only come back after the moves queued up in the machine
+    // are done, so everything not synchronized yet counts. The machine has
+    // been working on these moves since we last looked, so they drain with
+    // the time passed; otherwise a long job without dwell or M400 would
+    // expect ever longer.
+    const double now_ms = GetMonotonicMillis();
+    pending_motion_sec_ = std::max(
+        0.0, pending_motion_sec_ - (now_ms - pending_motion_update_ms_) / 1000);
+    pending_motion_update_ms_ = now_ms;
+    std::vector<GCodeInterpreter::Step> steps;
+    const char *const end = str + len;
+    while (str < end) {  // Macro expansions have multiple lines.
+        const char *eol = (const char*) memchr(str, '\n', end - str);
+        if (eol == NULL) eol = end;
+        interpreter_.Interpret(str, eol - str, &steps);
+        str = eol + 1;
+    }
+    double expected = 0;
+    for (const GCodeInterpreter::Step &step : steps) {
+        switch (step.kind) {
+        case GCodeInterpreter::Step::MOVE:
+            pending_motion_sec_ += GCodeInterpreter::NominalSeconds(step);
+            break;
+        case GCodeInterpreter::Step::DWELL:
+        case GCodeInterpreter::Step::WAIT_FOR_MOVES:
+            expected += pending_motion_sec_
+                + GCodeInterpreter::NominalSeconds(step);
+            pending_motion_sec_ = 0;
+            break;
+        case GCodeInterpreter::Step::HOME:
+            expected += pending_motion_sec_ + ACK_TIMEOUT_HOMING_SEC;
+            pending_motion_sec_ = 0;
+            break;
+        case GCodeInterpreter::Step::OTHER:
+            break;
+        }
+    }
+    return 1000 * (expected + pending_motion_sec_);
+}
+
+void GCodeMachine::StreamLine(const char *str, size_t len) {
+    if (len == 0 || *str == '\n' || *str == ';' || *str == '(')
+        return;  // Ignore empty lines or all-comment lines.
+    if (!sd_filename_.empty()) {
+        sd_program_.append(str, len);  // Sent in one go in Finish()
+        return;
+    }
+    JobStats::Scope stream_scope(stats_, JobStats::PHASE_STREAM);
+    if (!aborted_ && EmergencyStopRequested())
+        EmergencyStop(0);
+    if (aborted_)
+        return;  // Drop everything that is still queued up.
+
+    // A macro call takes as long as the commands it stands for.
+    const int expected_ms = macro_expansion_.empty()
+        ? ExpectedAckMillis(str, len)
+        : ExpectedAckMillis(macro_expansion_.data(), macro_expansion_.size());
+    macro_expansion_.clear();
+    const double deadline = (ack_timeout_slack_ms_ > 0)
+        ? GetMonotonicMillis() + ACK_TIMEOUT_FACTOR * expected_ms
+          + ack_timeout_slack_ms_
+        : -1;
+    const double send_time = GetMonotonicMillis();
+    const int64_t send_usec = GetMonotonicUsec();
+    link_stats_.LineSent(str, len);
+    write(output_fd_, str, len);
+    int resends = 0;
+    for (;;) {
+        const int timeout = (deadline < 0)
+            ? -1 : std::max(0, (int)(deadline - GetMonotonicMillis()));
+        bool resend_requested = false;
+        if (WaitForOkAck(input_fd_, timeout, &resend_requested)) {
+            if (resend_requested && resends++ < MAX_RESENDS) {
+                write(output_fd_, str, len);  // Line got garbled on the way.
+                continue;
+            }
+            link_stats_.AckReceived();
+            if (trace_) {
+                trace_->Complete(std::string(str, len - 1), "link", send_usec,
+                                 GetMonotonicUsec());
+            }
+            return;
+        }
+        // The wait is interrupted by a signal, so that we can stop
+        // while the machine is still busy with this command.
+        if (EmergencyStopRequested()) {
+            EmergencyStop(1);
+            return;
+        }
+        if (errno != EINTR)
+            break;  // Timeout or connection trouble.
+    }
+
+    // Stalled. Is the machine still alive ? Then we get two 'ok's: the
+    // late one and the one for the probe.
+    const std::string line(str, strchrnul(str, '\n'));
+    fprintf(stderr, "\nMachine stalled: no ok for line #%lld '%s' sent "
+            "%.1fs ago (expected %.1fs).\n",
+            (long long) link_stats_.lines_sent(), line.c_str(),
+            (GetMonotonicMillis() - send_time) / 1000.0, expected_ms / 1000.0);
+    static const char probe[] = STALL_PROBE_COMMAND "\n";
+    write(output_fd_, probe, strlen(probe));
+    int acks = 0;
+    while (acks < 2 && WaitForOkAck(input_fd_, STALL_PROBE_TIMEOUT_MS))
+        ++acks;
+    if (acks == 2) {
+        fprintf(stderr, "Machine responds to %s again, continuing.\n",
+                STALL_PROBE_COMMAND);
+        link_stats_.AckReceived();
+        return;
+    }
+    fprintf(stderr, "Machine %s to %s. Aborting.\n",
+            acks == 0 ? "does not respond" : "only partially responds",
+            STALL_PROBE_COMMAND);
+    EnterSafeState();
+}
+
+void GCodeMachine::EmergencyStop(int pending_acks) {
+    aborted_ = true;
+    const std::string stop_line = emergency_stop_command_ + "\n";
+    const double start_time = GetMonotonicMillis();
+    write(output_fd_, stop_line.data(), stop_line.size());
+    fprintf(stderr, "Emergency stop: sent %s\n", emergency_stop_command_.c_str());
+
+    // The stop command itself is acknowledged after the commands that were
+    // still in flight.
+    for (++pending_acks; pending_acks > 0; --pending_acks) {
+        if (!WaitForOkAck(input_fd_, ESTOP_ACK_TIMEOUT_MS))
+            break;
+    }
+    const double latency = GetMonotonicMillis() - start_time;
+    if (pending_acks == 0) {
+        fprintf(stderr, "Emergency stop: %s acknowledged after %.1fms\n",
+                emergency_stop_command_.c_str(), latency);
+    } else {
+        fprintf(stderr, "Emergency stop: no acknowledge of %s within "
+                "%.1fms\n", emergency_stop_command_.c_str(), latency);
+    }
+    if (sd_printing_) {
+        AbortSDPrint(output_fd_);  // Otherwise it would just go on.
+        sd_printing_ = false;
+    }
+    EnterSafeState();
+}
+
+void GCodeMachine::EnterSafeState() {
+    aborted_ = true;
+    // Vacuum and solenoid off. Bypasses write_line_(), as that now drops
+    // everything.
+    const char *pos = gcode_preamble_safe_state;
+    while (*pos) {
+        const char *eol = strchrnul(pos, '\n');
+        if (eol > pos) {
+            write(output_fd_, pos, eol - pos);
+            write(output_fd_, "\n", 1);
+            WaitForOkAck(input_fd_, ESTOP_ACK_TIMEOUT_MS);
+        }
+        pos = *eol ? eol + 1 : eol;
+    }
 }
 
 void GCodeMachine::SendFormattedCommands(const char *format, ...) {
@@ -266,7 +721,46 @@ void GCodeMachine::SendFormattedCommands(const char *format, ...) {
     va_start(ap, format);
     int len = vasprintf(&buffer, format, ap);
     va_end(ap);
+    PredictTime(buffer, len);
+    SendLines(buffer, len);
+    free(buffer);
+}
+
+void GCodeMachine::SendCommandsOrMacroCall(const char *format,
+                                           const char *macro_call, ...) {
+    char *buffer = NULL;
+    va_list ap;
+    if (macro_call != NULL && (input_fd_ >= 0 || progress_estimator_)) {
+        // Remember what the call stands for, to know how long it takes.
+        va_start(ap, macro_call);
+        int len = vasprintf(&buffer, format, ap);
+        va_end(ap);
+        macro_expansion_.assign(buffer, len);
+        free(buffer);
+        PredictTime(macro_expansion_.data(), macro_expansion_.size());
+        if (input_fd_ < 0) macro_expansion_.clear();
+    }
+    va_start(ap, macro_call);
+    int len = vasprintf(&buffer, macro_call ? macro_call : format, ap);
+    va_end(ap);
+    if (macro_call == NULL) PredictTime(buffer, len);
+    SendLines(buffer, len);
+    free(buffer);
+}
 
+void GCodeMachine::PredictTime(const char *buffer, int len) {
+    if (progress_estimator_ == NULL || aborted_)
+        return;
+    const char *pos = buffer;
+    const char *end = buffer + len;
+    while (pos < end) {
+        const char *eol = strchrnul(pos, '\n');
+        progress_estimator_->AddLine(pos, eol - pos);
+        pos = eol + 1;
+    }
+}
+
+void GCodeMachine::SendLines(const char *buffer, int len) {
     // Now we have a buffer that we can send line-by-line. The write function
     // is owned by the caller, so they can implement e.g. flow control.
     const char *pos = buffer;
@@ -276,8 +770,11 @@ void GCodeMachine::SendFormattedCommands(const char *format, ...) {
         // If a formatting string does not have a \n at the end of a line,
         // this is not allowed as we want to send full lines to write_line_().
         assert(*eol != '\0');  // error in templates above.
+        if (stats_) {
+            stats_->Add(JobStats::COUNT_LINES, 1);
+            stats_->Add(JobStats::COUNT_BYTES, eol - pos + 1);
+        }
         write_line_(pos, eol - pos + 1);
         pos = eol + 1;
     }
-    free(buffer);
 }
@@ -0,0 +1,342 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "job-manifest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "board.h"
+#include "machine.h"
+#include "machine-profile.h"
+#include "monotonic-clock.h"
+#include "option-list.h"
+#include "thread-pool.h"
+#include "trace-writer.h"
+
+static const struct { const char *name; OutputFormat format; } kFormats[] = {
+    { "gcode", OUTPUT_GCODE },
+    { "ps", OUTPUT_POSTSCRIPT },
+    { "estimate", OUTPUT_ESTIMATE },
+    { "motion", OUTPUT_MOTION_REPORT },
+};
+
+static bool ParseFormat(const std::string &name, OutputFormat *format) {
+    for (const auto &f : kFormats) {
+        if (name == f.name) {
+            *format = f.format;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parse "<key>=<value>" option of the job. Returns 'false' if "word" is
+// none; "*valid" tells if its value is.
+static bool ParseJobOption(const std::string &word, BatchJob *job,
+                           bool *valid) {
+    std::string key, value;
+    if (!SplitKeyValue(word, &key, &value))
+        return false;
+    *valid = !value.empty();
+    if (key == "exclude") {
+        const std::vector<std::string> parts = SplitCommaSeparated(value);
+        job->exclude = std::set<std::string>(parts.begin(), parts.end());
+    } else if (key == "dispense") {
+        *valid = (sscanf(value.c_str(), "%f,%f",
+                         &job->start_ms, &job->area_ms) == 2
+                  && job->start_ms >= 0);
+    } else if (key == "macros") {
+        job->macro_dialect = value;
+    } else if (key == "progress") {
+        job->progress = value;
+    } else if (key == "profile") {
+        job->profile_file = value;
+    } else if (key == "set") {
+        job->profile_options = value;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parse the words of one line into "job".
+static bool ParseJob(const std::vector<std::string> &words, BatchJob *job) {
+    job->outputs.clear();
+    if (words.size() < 4)
+        return false;
+    job->rpt_file = words[0];
+
+    const std::string &op = words[1];
+    if (op.empty() || (op[0] != 'd' && op[0] != 'p')
+        || op.size() > 2 || (op.size() == 2 && op[1] != 'b'))
+        return false;
+    job->dispensing = (op[0] == 'd');
+    job->back_of_board = (op.size() == 2);
+
+    static const char kHomerPrefix[] = "homer:";
+    if (words[2].compare(0, strlen(kHomerPrefix), kHomerPrefix) == 0) {
+        job->config_file = words[2].substr(strlen(kHomerPrefix));
+        job->homer_config = true;
+    } else if (words[2] != "-") {
+        job->config_file = words[2];
+    }
+
+    size_t i = 3;
+    bool valid;
+    for (/**/; i < words.size() && ParseJobOption(words[i], job, &valid); ++i) {
+        if (!valid)
+            return false;
+    }
+    for (/**/; i < words.size(); ++i) {
+        const size_t colon = words[i].find(':');
+        BatchJob::Output output;
+        if (!ParseFormat(words[i].substr(0, colon), &output.format))
+            return false;
+        if (colon != std::string::npos)
+            output.filename = words[i].substr(colon + 1);
+        job->outputs.push_back(output);
+    }
+    return true;
+}
+
+// Split at whitespace, up to a '#' comment.
+static std::vector<std::string> SplitWords(const std::string &line) {
+    std::vector<std::string> words;
+    const std::string content = line.substr(0, line.find('#'));
+    size_t pos = 0;
+    for (;;) {
+        const size_t start = content.find_first_not_of(" \t\r\n", pos);
+        if (start == std::string::npos)
+            break;
+        pos = content.find_first_of(" \t\r\n", start);
+        words.push_back(content.substr(start, pos - start));
+    }
+    return words;
+}
+
+bool ParseJobLine(const std::string &line, BatchJob *job) {
+    return ParseJob(SplitWords(line), job);
+}
+
+bool ParseJobManifest(const std::string &filename,
+                      std::vector<BatchJob> *jobs) {
+    FILE *in = fopen(filename.c_str(), "r");
+    if (!in) {
+        fprintf(stderr, "Can't open %s\n", filename.c_str());
+        return false;
+    }
+    char buffer[4096];
+    int line = 0;
+    bool success = true;
+    while (success && fgets(buffer, sizeof(buffer), in)) {
+        ++line;
+        const std::vector<std::string> words = SplitWords(buffer);
+        if (words.empty())
+            continue;
+        BatchJob job;
+        job.line = line;
+        bool valid = ParseJob(words, &job) && !job.outputs.empty();
+        for (const BatchJob::Output &output : job.outputs) {
+            valid &= !output.filename.empty();
+        }
+        if (!valid) {
+            fprintf(stderr, "%s:%d: expected <rpt-file> <d|p>[b] <config> "
+                    "[<option>=<value> ...] "
+                    "<gcode|ps|estimate|motion>:<file> ...\n",
+                    filename.c_str(), line);
+            success = false;
+        }
+        jobs->push_back(job);
+    }
+    fclose(in);
+    return success;
+}
+
+std::string FormatJobLine(const BatchJob &job) {
+    std::string line = job.rpt_file;
+    line.append(job.dispensing ? " d" : " p");
+    line.append(job.back_of_board ? "b" : "");
+    if (job.config_file.empty())
+        line.append(" -");
+    else
+        line.append(job.homer_config ? " homer:" : " ").append(job.config_file);
+    if (!job.exclude.empty()) {
+        line.append(" exclude=");
+        for (const std::string &name : job.exclude) {
+            if (name != *job.exclude.begin()) line.append(",");
+            line.append(name);
+        }
+    }
+    if (job.start_ms >= 0) {
+        char times[64];
+        snprintf(times, sizeof(times), " dispense=%g,%g",
+                 job.start_ms, job.area_ms);
+        line.append(times);
+    }
+    if (!job.macro_dialect.empty())
+        line.append(" macros=").append(job.macro_dialect);
+    if (!job.progress.empty())
+        line.append(" progress=").append(job.progress);
+    if (!job.profile_file.empty())
+        line.append(" profile=").append(job.profile_file);
+    if (!job.profile_options.empty())
+        line.append(" set=").append(job.profile_options);
+    for (const BatchJob::Output &output : job.outputs) {
+        for (const auto &f : kFormats) {
+            if (f.format == output.format) line.append(" ").append(f.name);
+        }
+        if (!output.filename.empty())
+            line.append(":").append(output.filename);
+    }
+    return line;
+}
+
+std::shared_ptr<PnPConfig> LoadJobConfig(const BatchJob &job,
+                                         const Board &board) {
+    if (!job.config_file.empty() || job.dispensing)
+        return LoadConfig(job.config_file, job.homer_config, board);
+    return NULL;
+}
+
+bool ApplyJobOptions(const BatchJob &job, MachineProfile *profile,
+                     EmitOptions *options) {
+    if (!job.profile_file.empty()) {
+        *profile = MachineProfile();
+        if (!ParseMachineProfile(job.profile_file, profile))
+            return false;
+    }
+    if (!job.profile_options.empty()
+        && !ParseMachineProfileOptions(job.profile_options.c_str(), profile))
+        return false;
+    if (job.start_ms >= 0) {
+        options->start_ms = job.start_ms;
+        options->area_ms = job.area_ms;
+    }
+    if (!job.macro_dialect.empty())
+        options->macro_dialect = job.macro_dialect.c_str();
+    if (!job.progress.empty()) {
+        GCodeMachine::ProgressStyle style;
+        float interval_sec;
+        if (!GCodeMachine::ParseProgressSpec(job.progress.c_str(), &style,
+                                             &interval_sec))
+            return false;
+        options->progress = job.progress.c_str();
+    }
+    return true;
+}
+
+bool HasOwnProfile(const BatchJob &job) {
+    return !job.profile_file.empty() || !job.profile_options.empty();
+}
+
+namespace {
+// Outcome of a job, for the summary.
+struct BatchResult {
+    bool success = false;
+    int parts = 0;
+    int pads = 0;
+    double parse_sec = 0;   // Reading board and config.
+    double write_sec = 0;   // Planning and writing all outputs.
+};
+}  // namespace
+
+static void RunBatchJob(const BatchJob &job, const std::string &description,
+                        MachineProfile profile,
+                        EmitOptions options, BatchResult *result) {
+    if (!ApplyJobOptions(job, &profile, &options))
+        return;
+    const int64_t start_usec = GetMonotonicUsec();
+    const std::shared_ptr<Board> board
+        = LoadBoard(job.rpt_file, !job.back_of_board, job.exclude);
+    if (board == NULL)
+        return;
+    const std::shared_ptr<PnPConfig> config = LoadJobConfig(job, *board);
+    result->parts = board->parts().size();
+    for (const Part *part : board->parts())
+        result->pads += part->pads.size();
+    const int64_t parsed_usec = GetMonotonicUsec();
+    result->parse_sec = (parsed_usec - start_usec) / 1e6;
+
+    if (config != NULL || job.config_file.empty()) {
+        result->success = true;
+        const JobPlan plan = job.dispensing
+            ? JobPlan::Dispense(*board, profile)
+            : JobPlan::PickNPlace(*board, config.get());
+        for (const BatchJob::Output &out : job.outputs) {
+            FILE *output = fopen(out.filename.c_str(), "w");
+            if (output == NULL) {
+                perror(out.filename.c_str());
+                result->success = false;
+                continue;
+            }
+            options.format = out.format;
+            if (!EmitJob(plan, *board, config.get(), profile, options,
+                         description, FileSink(output))) {
+                result->success = false;
+            }
+            fclose(output);
+        }
+        result->write_sec = (GetMonotonicUsec() - parsed_usec) / 1e6;
+    }
+}
+
+bool RunBatch(const std::string &manifest, int threads,
+              const MachineProfile &profile, const EmitOptions &options,
+              TraceWriter *trace) {
+    std::vector<BatchJob> jobs;
+    if (!ParseJobManifest(manifest, &jobs))
+        return false;
+    std::vector<BatchResult> results(jobs.size());
+    const int64_t start_usec = GetMonotonicUsec();
+    int pool_size;
+    {
+        ThreadPool pool(threads);
+        pool_size = pool.size();
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            pool.Submit([&, i]() {
+                const BatchJob &job = jobs[i];
+                const std::string description = manifest + ":"
+                    + std::to_string(job.line) + ": " + job.rpt_file
+                    + (job.dispensing ? " dispensing" : " pick'n place");
+                const int64_t job_start_usec = GetMonotonicUsec();
+                RunBatchJob(job, description, profile, options, &results[i]);
+                if (trace) {
+                    trace->NameThread("batch");
+                    trace->Complete(description, "job", job_start_usec,
+                                    GetMonotonicUsec());
+                }
+            });
+        }
+        pool.Wait();
+    }
+    const double wall_sec = (GetMonotonicUsec() - start_usec) / 1e6;
+
+    int longest = strlen("rpt-file");
+    for (const BatchJob &job : jobs)
+        longest = std::max(longest, (int)job.rpt_file.length());
+    fprintf(stderr, "%5s %-*s %-3s %6s %7s %10s %10s  %s\n", "line", longest,
+            "rpt-file", "op", "parts", "pads", "parse[ms]", "write[ms]",
+            "status");
+    int failed = 0;
+    double job_sec = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const BatchJob &job = jobs[i];
+        const BatchResult &r = results[i];
+        fprintf(stderr, "%5d %-*s %-3s %6d %7d %10.1f %10.1f  %s\n",
+                job.line, longest, job.rpt_file.c_str(),
+                job.dispensing ? (job.back_of_board ? "db" : "d")
+                : (job.back_of_board ? "pb" : "p"),
+                r.parts, r.pads, 1000 * r.parse_sec, 1000 * r.write_sec,
+                r.success ? "ok" : "FAILED");
+        if (!r.success) ++failed;
+        job_sec += r.parse_sec + r.write_sec;
+    }
+    fprintf(stderr, "%d jobs (%d failed) on %d threads in %.2fs; "
+            "%.2fs job time.\n", (int)jobs.size(), failed, pool_size,
+            wall_sec, job_sec);
+    return failed == 0;
+}
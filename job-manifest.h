@@ -0,0 +1,82 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * List of jobs for batch mode: which board to process how, and where the
+ * results go.
+ */
+
+#ifndef JOB_MANIFEST_H
+#define JOB_MANIFEST_H
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "librpt2pnp.h"
+
+struct BatchJob {
+    struct Output {
+        OutputFormat format;
+        std::string filename;
+    };
+
+    int line = 0;                   // In the manifest, for messages.
+    std::string rpt_file;
+    bool dispensing = false;        // Otherwise pick'n place.
+    bool back_of_board = false;
+    std::string config_file;        // Empty: none.
+    bool homer_config = false;      // config_file is from homer (-C).
+    std::vector<Output> outputs;
+
+    // Options of this job only; unset ones are those of the batch or server.
+    std::set<std::string> exclude;  // exclude=<ref>,...   as -x
+    float start_ms = -1;            // dispense=<init>,<area>   as -D
+    float area_ms = -1;
+    std::string macro_dialect;      // macros=<dialect>   as -M
+    std::string progress;           // progress=<style>[,<sec>]   as -i
+    std::string profile_file;       // profile=<file>   as -k
+    std::string profile_options;    // set=<key>=<value>,...   as -e
+};
+
+// Read manifest with one job per line and '#' comments:
+//   <rpt-file> <operation> <config> [<option>=<value> ...]
+//       <format>:<output-file> ...
+// Operation is 'd' (dispensing) or 'p' (pick'n place), with a 'b' appended
+// for the back of the board. Config is a file as given with -c,
+// "homer:<file>" for one as given with -C, or "-" for none. Options are
+// those of BatchJob. Formats are gcode, ps, estimate and motion.
+// Returns 'false' and prints an error if the manifest is invalid.
+bool ParseJobManifest(const std::string &filename,
+                      std::vector<BatchJob> *jobs);
+
+// Parse a single job in the format of a manifest line. Outputs can leave
+// out the ":<output-file>", then their filename is empty.
+// Returns 'false' if invalid.
+bool ParseJobLine(const std::string &line, BatchJob *job);
+
+// The job as a manifest line.
+std::string FormatJobLine(const BatchJob &job);
+
+// Config of the job, NULL if there is none or it can't be read.
+std::shared_ptr<PnPConfig> LoadJobConfig(const BatchJob &job,
+                                         const Board &board);
+
+// Apply the options of the job to "profile" and "options", which have to
+// be used while "job" is around. Returns 'false' and prints an error if
+// its profile can't be read or an option is invalid.
+bool ApplyJobOptions(const BatchJob &job, MachineProfile *profile,
+                     EmitOptions *options);
+
+// If the job's profile is another than the one of the batch or server.
+bool HasOwnProfile(const BatchJob &job);
+
+// Run the jobs of the manifest on "threads" threads (zero: one per CPU),
+// each with its own board and config. Outputs are emitted with "options",
+// in their own format. Prints the time each job took. Returns 'true' if
+// all jobs succeeded.
+bool RunBatch(const std::string &manifest, int threads,
+              const MachineProfile &profile, const EmitOptions &options,
+              TraceWriter *trace);
+
+#endif  // JOB_MANIFEST_H
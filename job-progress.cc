@@ -0,0 +1,72 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "job-progress.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+
+#include "monotonic-clock.h"
+
+// Don't update the line more often than that.
+#define PROGRESS_MIN_UPDATE_SEC 0.2
+
+// The observed speed of the machine is trusted more and more over the
+// prediction, fully after it ran that long.
+#define PROGRESS_TRUST_OBSERVED_SEC 10.0
+
+static std::string FormatDuration(double sec) {
+    const int s = std::max(0, (int)(sec + 0.5));
+    char buffer[32];
+    if (s >= 3600) {
+        snprintf(buffer, sizeof(buffer), "%d:%02d:%02d",
+                 s / 3600, (s / 60) % 60, s % 60);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%d:%02d", s / 60, s % 60);
+    }
+    return buffer;
+}
+
+JobProgress::JobProgress(FILE *out, int total_parts, int total_pads,
+                         double predicted_total_sec)
+    : out_(out), total_parts_(total_parts), total_pads_(total_pads),
+      predicted_total_sec_(predicted_total_sec),
+      start_(GetMonotonicSeconds()), last_print_(-1), printed_(false) {}
+
+void JobProgress::Update(int parts_done, int pads_done,
+                         double predicted_done_sec) {
+    const double now = GetMonotonicSeconds();
+    const bool complete = (parts_done == total_parts_);
+    if (!complete && now - last_print_ < PROGRESS_MIN_UPDATE_SEC)
+        return;
+    last_print_ = now;
+    const double elapsed = now - start_;
+
+    // Machine slower or faster than predicted: the rest will be, too.
+    double actual_per_predicted = 1.0;
+    if (predicted_done_sec > 0) {
+        const double trust = std::min(1.0,
+                                      elapsed / PROGRESS_TRUST_OBSERVED_SEC);
+        actual_per_predicted = (1 - trust)
+            + trust * elapsed / predicted_done_sec;
+    }
+    const double remaining = (predicted_total_sec_ - predicted_done_sec)
+        * actual_per_predicted;
+
+    fprintf(out_, "\rParts %d/%d", parts_done, total_parts_);
+    if (total_pads_ > 0)
+        fprintf(out_, ", pads %d/%d", pads_done, total_pads_);
+    fprintf(out_, " | %s elapsed | %s left   ",
+            FormatDuration(elapsed).c_str(),
+            FormatDuration(complete ? 0 : remaining).c_str());
+    fflush(out_);
+    printed_ = true;
+}
+
+void JobProgress::Finish() {
+    if (printed_) fprintf(out_, "\n");
+    printed_ = false;
+}
@@ -0,0 +1,38 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Progress line for the operator while the machine works on a job.
+ */
+
+#ifndef JOB_PROGRESS_H
+#define JOB_PROGRESS_H
+
+#include <stdio.h>
+
+// Shows parts and pads done, elapsed and remaining time on one line that is
+// updated in place. The remaining time comes from the time model, scaled by
+// how fast the machine actually acknowledged the commands so far.
+class JobProgress {
+public:
+    // "total_pads" is zero if pads don't matter (pick'n place).
+    // "predicted_total_sec" is the machine time the time model predicts.
+    JobProgress(FILE *out, int total_parts, int total_pads,
+                double predicted_total_sec);
+
+    // Update with what is done and the predicted machine time for that.
+    void Update(int parts_done, int pads_done, double predicted_done_sec);
+
+    // End the progress line.
+    void Finish();
+
+private:
+    FILE *const out_;
+    const int total_parts_;
+    const int total_pads_;
+    const double predicted_total_sec_;
+    const double start_;
+    double last_print_;
+    bool printed_;
+};
+
+#endif  // JOB_PROGRESS_H
@@ -0,0 +1,340 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "job-server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "board-cache.h"
+#include "job-manifest.h"
+#include "machine-profile.h"
+#include "monotonic-clock.h"
+#include "thread-pool.h"
+
+// While waiting for connections or requests, check that often if we
+// should stop.
+#define STOP_POLL_MS 200
+
+// A client sending a longer line without newline is disconnected.
+#define MAX_REQUEST_BYTES 65536
+
+// No SIGPIPE if the other side went away.
+static bool WriteAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        const ssize_t w = send(fd, data, len, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        data += w;
+        len -= w;
+    }
+    return true;
+}
+
+static bool MakeAddress(const std::string &path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+        return false;
+    }
+    strncpy(addr->sun_path, path.c_str(), sizeof(addr->sun_path) - 1);
+    return true;
+}
+
+// Returns connected socket or -1.
+static int ConnectTo(const std::string &path) {
+    struct sockaddr_un addr;
+    if (!MakeAddress(path, &addr))
+        return -1;
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        const int connect_errno = errno;
+        close(fd);
+        errno = connect_errno;
+        return -1;
+    }
+    return fd;
+}
+
+// Read a line without its newline from "fd". Whatever was read beyond it
+// is kept in "pending" for the next call. Returns 'false' on end of file or
+// error.
+static bool ReadLine(int fd, std::string *pending, std::string *line) {
+    for (;;) {
+        const size_t newline = pending->find('\n');
+        if (newline != std::string::npos) {
+            line->assign(*pending, 0, newline);
+            pending->erase(0, newline + 1);
+            return true;
+        }
+        char buffer[4096];
+        const ssize_t r = read(fd, buffer, sizeof(buffer));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        pending->append(buffer, r);
+    }
+}
+
+// Handle request and send the response. Returns 'false' if the client
+// went away.
+static bool Respond(int fd, const std::string &request,
+                    const RequestHandler &handler) {
+    std::string response, header;
+    if (handler(request, &response)) {
+        header = "ok " + std::to_string(response.size()) + "\n";
+    } else {
+        std::replace(response.begin(), response.end(), '\n', ' ');
+        header = "error " + response + "\n";
+        response.clear();
+    }
+    return WriteAll(fd, header.data(), header.size())
+        && WriteAll(fd, response.data(), response.size());
+}
+
+namespace {
+// A client connection. While a request of it is handled on the pool, it
+// is not read from.
+struct Client {
+    std::string pending;   // Received, not taken as request yet.
+    bool busy = false;
+};
+}  // namespace
+
+bool ServeRequests(const std::string &path, int threads,
+                   const RequestHandler &handler,
+                   volatile sig_atomic_t *stop) {
+    struct sockaddr_un addr;
+    if (!MakeAddress(path, &addr))
+        return false;
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        const int other = ConnectTo(path);
+        if (other >= 0 || !S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s: %s\n", path.c_str(), other >= 0
+                    ? "another server is listening there"
+                    : "exists and is not a socket");
+            if (other >= 0) close(other);
+            return false;
+        }
+        unlink(path.c_str());  // Left over from a previous server.
+    }
+
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0
+        || bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+        || listen(listen_fd, 16) < 0) {
+        perror(path.c_str());
+        if (listen_fd >= 0) close(listen_fd);
+        return false;
+    }
+    // Workers tell the loop below when they are done with a connection.
+    int wake_pipe[2];
+    if (pipe(wake_pipe) < 0) {
+        perror("pipe");
+        close(listen_fd);
+        return false;
+    }
+
+    // Connections are polled here; only complete requests take a thread of
+    // the pool, so idle clients don't hold up others.
+    std::map<int, Client> clients;
+    std::mutex done_mutex;
+    std::vector<std::pair<int, bool> > done;   // fd, client still there.
+    {
+        ThreadPool pool(threads);
+        fprintf(stderr, "Serving on %s with %d threads.\n", path.c_str(),
+                pool.size());
+        while (!*stop) {
+            {
+                std::lock_guard<std::mutex> l(done_mutex);
+                for (const auto &d : done) {
+                    if (d.second) {
+                        clients[d.first].busy = false;
+                    } else {
+                        close(d.first);
+                        clients.erase(d.first);
+                    }
+                }
+                done.clear();
+            }
+
+            std::vector<struct pollfd> fds;
+            fds.push_back({ listen_fd, POLLIN, 0 });
+            fds.push_back({ wake_pipe[0], POLLIN, 0 });
+            for (auto &c : clients) {
+                if (c.second.busy)
+                    continue;
+                const size_t newline = c.second.pending.find('\n');
+                if (newline == std::string::npos) {
+                    fds.push_back({ c.first, POLLIN, 0 });
+                    continue;
+                }
+                const std::string request(c.second.pending, 0, newline);
+                c.second.pending.erase(0, newline + 1);
+                c.second.busy = true;
+                const int fd = c.first;
+                pool.Submit([&, fd, request]() {
+                        const bool connected = Respond(fd, request, handler);
+                        std::lock_guard<std::mutex> l(done_mutex);
+                        done.push_back(std::make_pair(fd, connected));
+                        write(wake_pipe[1], "", 1);
+                    });
+            }
+
+            if (poll(fds.data(), fds.size(), STOP_POLL_MS) <= 0)
+                continue;
+            char buffer[4096];
+            if (fds[1].revents)
+                read(wake_pipe[0], buffer, sizeof(buffer));
+            if (fds[0].revents) {
+                const int fd = accept(listen_fd, NULL, NULL);
+                if (fd >= 0) clients[fd];
+            }
+            for (size_t i = 2; i < fds.size(); ++i) {
+                if (!fds[i].revents)
+                    continue;
+                const int fd = fds[i].fd;
+                const ssize_t r = read(fd, buffer, sizeof(buffer));
+                if (r < 0 && errno == EINTR)
+                    continue;
+                std::string &pending = clients[fd].pending;
+                if (r > 0) pending.append(buffer, r);
+                if (r <= 0 || (pending.size() > MAX_REQUEST_BYTES
+                               && pending.find('\n') == std::string::npos)) {
+                    close(fd);   // Gone, or not talking our protocol.
+                    clients.erase(fd);
+                }
+            }
+        }
+    }  // Waits for the requests being handled.
+    for (const auto &c : clients) close(c.first);
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    close(listen_fd);
+    unlink(path.c_str());
+    return true;
+}
+
+bool SendRequest(const std::string &path, const std::string &request,
+                 FILE *output) {
+    const int fd = ConnectTo(path);
+    if (fd < 0) {
+        fprintf(stderr, "Can't connect to server at %s: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+    const std::string line = request + "\n";
+    std::string pending, header;
+    bool success = false;
+    if (!WriteAll(fd, line.data(), line.size())
+        || !ReadLine(fd, &pending, &header)) {
+        fprintf(stderr, "Lost connection to server.\n");
+    } else if (header.compare(0, 6, "error ") == 0) {
+        fprintf(stderr, "%s\n", header.c_str() + 6);
+    } else if (header.compare(0, 3, "ok ") == 0) {
+        size_t remaining = strtoull(header.c_str() + 3, NULL, 10);
+        const size_t from_pending = std::min(remaining, pending.size());
+        fwrite(pending.data(), 1, from_pending, output);
+        remaining -= from_pending;
+        char buffer[65536];
+        while (remaining > 0) {
+            const ssize_t r = read(fd, buffer,
+                                   std::min(remaining, sizeof(buffer)));
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                break;
+            fwrite(buffer, 1, r, output);
+            remaining -= r;
+        }
+        success = (remaining == 0);
+        if (!success) fprintf(stderr, "Lost connection to server.\n");
+    } else {
+        fprintf(stderr, "Unexpected response from server: '%s'\n",
+                header.c_str());
+    }
+    close(fd);
+    return success;
+}
+
+static bool HandleJobRequest(const std::string &request, BoardCache *cache,
+                             MachineProfile profile,
+                             EmitOptions options, std::string *response) {
+    const int64_t start_usec = GetMonotonicUsec();
+    BatchJob job;
+    if (!ParseJobLine(request, &job) || job.outputs.size() != 1
+        || !job.outputs[0].filename.empty()) {
+        *response = "Expected <rpt-file> <d|p>[b] <config|homer:<file>|-> "
+            "[<option>=<value> ...] <gcode|ps|estimate|motion>";
+        return false;
+    }
+    if (!ApplyJobOptions(job, &profile, &options)) {
+        *response = "Invalid options: " + request;
+        return false;
+    }
+    // Boards with parts excluded are not shared with other jobs.
+    bool cached = false;
+    std::shared_ptr<BoardCache::Entry> entry;
+    std::shared_ptr<Board> own_board;
+    if (job.exclude.empty())
+        entry = cache->Get(job.rpt_file, !job.back_of_board, &cached);
+    else
+        own_board = LoadBoard(job.rpt_file, !job.back_of_board, job.exclude);
+    if (!entry && own_board == NULL) {
+        *response = "Can't read " + job.rpt_file;
+        return false;
+    }
+    const Board &board = entry ? entry->board() : *own_board;
+    const std::shared_ptr<PnPConfig> config = LoadJobConfig(job, board);
+    if (config == NULL && !job.config_file.empty()) {
+        *response = "Can't read config " + job.config_file;
+        return false;
+    }
+
+    // The cached tour is only good for the profile of the server.
+    options.format = job.outputs[0].format;
+    const bool success = EmitJob(
+        !job.dispensing ? JobPlan::PickNPlace(board, config.get())
+        : (entry && !HasOwnProfile(job)) ? entry->DispensePlan()
+        : JobPlan::Dispense(board, profile),
+        board, config.get(), profile, options, "rpt2pnp --serve " + request,
+        [response](const char *data, size_t len) {
+            response->append(data, len);
+        });
+    if (!success)
+        *response = "Job failed: " + request;
+    fprintf(stderr, "%s: %s board, %.1fms%s\n", request.c_str(),
+            cached ? "cached" : "parsed",
+            (GetMonotonicUsec() - start_usec) / 1000.0,
+            success ? "" : " FAILED");
+    return success;
+}
+
+bool ServeJobs(const std::string &path, int threads, int cache_boards,
+               const MachineProfile &profile, const EmitOptions &options,
+               volatile sig_atomic_t *stop) {
+    BoardCache cache(cache_boards, profile);
+    return ServeRequests(
+        path, threads,
+        [&](const std::string &request, std::string *response) {
+            return HandleJobRequest(request, &cache, profile, options,
+                                    response);
+        }, stop);
+}
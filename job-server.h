@@ -0,0 +1,54 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Requests to a long-running rpt2pnp over a local Unix socket, so that
+ * callers don't pay for process start and parsing each time.
+ *
+ * The client sends one request per line; the server answers each with
+ *   "ok <length>\n" followed by <length> bytes of output, or
+ *   "error <message>\n".
+ */
+
+#ifndef JOB_SERVER_H
+#define JOB_SERVER_H
+
+#include <signal.h>
+#include <stdio.h>
+
+#include <functional>
+#include <string>
+
+#include "librpt2pnp.h"
+
+// Handle the request line (without newline). Returns 'true' with the output
+// in "response", or 'false' with an error message in it.
+typedef std::function<bool(const std::string &request,
+                           std::string *response)> RequestHandler;
+
+// Listen on the Unix socket at "path" and handle up to "threads" requests
+// at once (zero: one per CPU) until "*stop" is set. Any number of clients
+// can stay connected; only a complete request line takes a thread. A
+// client's next request is read once the previous one is answered. A
+// socket left over from a server no longer running is replaced. Returns
+// 'false' if it can't listen.
+bool ServeRequests(const std::string &path, int threads,
+                   const RequestHandler &handler,
+                   volatile sig_atomic_t *stop);
+
+// Send "request" to the server at "path" and write the output it responds
+// with to "output". Returns 'false' and prints the error if the request
+// failed.
+bool SendRequest(const std::string &path, const std::string &request,
+                 FILE *output);
+
+// Serve jobs on the Unix socket at "path" until "*stop" is set. A request
+// is a job like a line of a --batch manifest (see job-manifest.h) with one
+// output format and no file, e.g. "/path/board.rpt d /path/config.txt ps".
+// Its options override "profile" and "options". The last "cache_boards"
+// boards and their dispensing tours are kept while their rpt files don't
+// change; configs are read for each job.
+bool ServeJobs(const std::string &path, int threads, int cache_boards,
+               const MachineProfile &profile, const EmitOptions &options,
+               volatile sig_atomic_t *stop);
+
+#endif  // JOB_SERVER_H
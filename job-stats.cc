@@ -0,0 +1,173 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "job-stats.h"
+
+#include <sys/resource.h>
+#include <time.h>
+
+#include "alloc-stats.h"
+#include "monotonic-clock.h"
+#include "trace-writer.h"
+
+// Allocations outside of any phase are ALLOC_NO_PHASE.
+static int AllocPhase(int phase) { return phase + 1; }
+
+static const char *const kCounterName[JobStats::NUM_COUNTERS] = {
+    "parts", "pads", "lines", "bytes"
+};
+
+static double GetSeconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// All phases run on the main thread; helper threads (emulator, recorder)
+// are not counted.
+static double GetWallSeconds() { return GetMonotonicSeconds(); }
+static double GetCpuSeconds() { return GetSeconds(CLOCK_THREAD_CPUTIME_ID); }
+
+JobStats::JobStats()
+    : trace_(NULL), start_wall_(GetWallSeconds()), start_cpu_(GetCpuSeconds()),
+      mark_wall_(start_wall_), mark_cpu_(start_cpu_) {
+    for (int i = 0; i < NUM_COUNTERS; ++i) counters_[i] = 0;
+    static_assert(NUM_PHASES < ALLOC_MAX_PHASES, "Phases for allocations");
+}
+
+const char *JobStats::PhaseName(Phase phase) {
+    static const char *const kPhaseName[NUM_PHASES] = {
+        "parse-rpt", "parse-config", "filter", "optimize", "predict",
+        "emit", "stream"
+    };
+    return kPhaseName[phase];
+}
+
+void JobStats::ChargeCurrentPhase() {
+    const double now_wall = GetWallSeconds();
+    const double now_cpu = GetCpuSeconds();
+    if (!active_.empty()) {
+        PhaseTime &p = phases_[active_.back()];
+        p.wall_sec += now_wall - mark_wall_;
+        p.cpu_sec += now_cpu - mark_cpu_;
+    }
+    mark_wall_ = now_wall;
+    mark_cpu_ = now_cpu;
+}
+
+void JobStats::Begin(Phase phase) {
+    ChargeCurrentPhase();
+    active_.push_back(phase);
+    phases_[phase].count++;
+    SetAllocPhase(AllocPhase(phase));
+    if (trace_) trace_->Begin(PhaseName(phase), "phase");
+}
+
+void JobStats::End() {
+    ChargeCurrentPhase();
+    active_.pop_back();
+    SetAllocPhase(active_.empty() ? ALLOC_NO_PHASE
+                  : AllocPhase(active_.back()));
+    if (trace_) trace_->End();
+}
+
+long JobStats::PeakRssKiB() const {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+    return usage.ru_maxrss;  // Linux: KiB
+}
+
+void JobStats::PrintSummary(FILE *out) const {
+    const double total_wall = GetWallSeconds() - start_wall_;
+    const double total_cpu = GetCpuSeconds() - start_cpu_;
+    fprintf(out, "%-13s %7s %10s %10s %6s\n",
+            "phase", "count", "wall[ms]", "cpu[ms]", "wall%");
+    double phases_wall = 0, phases_cpu = 0;
+    for (int i = 0; i < NUM_PHASES; ++i) {
+        const PhaseTime &p = phases_[i];
+        if (p.count == 0) continue;
+        fprintf(out, "%-13s %7lld %10.3f %10.3f %5.1f%%\n",
+                PhaseName((Phase)i), (long long)p.count,
+                p.wall_sec * 1e3, p.cpu_sec * 1e3,
+                total_wall > 0 ? 100 * p.wall_sec / total_wall : 0);
+        phases_wall += p.wall_sec;
+        phases_cpu += p.cpu_sec;
+    }
+    fprintf(out, "%-13s %7s %10.3f %10.3f %5.1f%%\n", "other", "",
+            (total_wall - phases_wall) * 1e3, (total_cpu - phases_cpu) * 1e3,
+            total_wall > 0 ? 100 * (total_wall - phases_wall) / total_wall
+            : 0);
+    fprintf(out, "%-13s %7s %10.3f %10.3f\n", "total", "",
+            total_wall * 1e3, total_cpu * 1e3);
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+        fprintf(out, "%s%s %lld", i == 0 ? "" : ", ", kCounterName[i],
+                (long long)counters_[i]);
+    }
+    fprintf(out, "; peak RSS %.1f MiB\n", PeakRssKiB() / 1024.0);
+    if (AllocStatsEnabled())
+        PrintAllocations(out);
+}
+
+void JobStats::PrintAllocations(FILE *out) const {
+    fprintf(out, "%-13s %10s %12s %12s\n",
+            "heap", "allocs", "alloc[KiB]", "live[KiB]");
+    for (int i = 0; i <= NUM_PHASES; ++i) {
+        // Outside of any phase last.
+        const int alloc_phase = (i < NUM_PHASES) ? AllocPhase(i)
+            : ALLOC_NO_PHASE;
+        const AllocCounts c = GetAllocCounts(alloc_phase);
+        if (c.allocations == 0) continue;
+        fprintf(out, "%-13s %10lld %12.1f %12.1f\n",
+                i < NUM_PHASES ? PhaseName((Phase)i) : "other",
+                (long long)c.allocations, c.bytes / 1024.0,
+                c.live_bytes / 1024.0);
+    }
+    fprintf(out, "peak heap %.1f KiB\n", GetPeakHeapBytes() / 1024.0);
+}
+
+bool JobStats::WriteJson(const std::string &filename) const {
+    FILE *out = fopen(filename.c_str(), "w");
+    if (out == NULL) {
+        perror(filename.c_str());
+        return false;
+    }
+    fprintf(out, "{\n  \"wall_ms\": %.3f,\n  \"cpu_ms\": %.3f,\n"
+            "  \"peak_rss_kib\": %ld,\n  \"phases\": {",
+            (GetWallSeconds() - start_wall_) * 1e3,
+            (GetCpuSeconds() - start_cpu_) * 1e3, PeakRssKiB());
+    const char *separator = "\n";
+    for (int i = 0; i < NUM_PHASES; ++i) {
+        const PhaseTime &p = phases_[i];
+        fprintf(out, "%s    \"%s\": { \"count\": %lld, \"wall_ms\": %.3f, "
+                "\"cpu_ms\": %.3f", separator, PhaseName((Phase)i),
+                (long long)p.count, p.wall_sec * 1e3, p.cpu_sec * 1e3);
+        if (AllocStatsEnabled()) {
+            const AllocCounts c = GetAllocCounts(AllocPhase(i));
+            fprintf(out, ", \"allocations\": %lld, \"alloc_bytes\": %lld, "
+                    "\"live_bytes\": %lld", (long long)c.allocations,
+                    (long long)c.bytes, (long long)c.live_bytes);
+        }
+        fprintf(out, " }");
+        separator = ",\n";
+    }
+    fprintf(out, "\n  },\n  \"counters\": {");
+    separator = "\n";
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+        fprintf(out, "%s    \"%s\": %lld", separator, kCounterName[i],
+                (long long)counters_[i]);
+        separator = ",\n";
+    }
+    fprintf(out, "\n  }");
+    if (AllocStatsEnabled()) {
+        const AllocCounts c = GetAllocCounts(ALLOC_NO_PHASE);
+        fprintf(out, ",\n  \"heap\": { \"peak_bytes\": %lld, "
+                "\"other_allocations\": %lld, \"other_alloc_bytes\": %lld, "
+                "\"other_live_bytes\": %lld }",
+                (long long)GetPeakHeapBytes(), (long long)c.allocations,
+                (long long)c.bytes, (long long)c.live_bytes);
+    }
+    fprintf(out, "\n}\n");
+    return fclose(out) == 0;
+}
@@ -0,0 +1,94 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Where the time of a run goes: wall and CPU time per phase, counters
+ * and peak memory.
+ */
+
+#ifndef JOB_STATS_H
+#define JOB_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+class TraceWriter;
+
+class JobStats {
+public:
+    enum Phase {
+        PHASE_PARSE_RPT,
+        PHASE_PARSE_CONFIG,
+        PHASE_FILTER,      // Choosing parts while reading the rpt file.
+        PHASE_OPTIMIZE,    // Order of parts and pads.
+        PHASE_PREDICT,     // Dry-run of the time model for progress.
+        PHASE_EMIT,        // Generating G-code or PostScript.
+        PHASE_STREAM,      // Sending to machine and waiting for it.
+        NUM_PHASES
+    };
+
+    enum Counter {
+        COUNT_PARTS,
+        COUNT_PADS,
+        COUNT_LINES,       // Lines of output generated.
+        COUNT_BYTES,
+        NUM_COUNTERS
+    };
+
+    JobStats();
+
+    // Phases nest: time spent in an inner phase does not count for the
+    // outer one. Use the Scope below.
+    void Begin(Phase phase);
+    void End();
+
+    void Add(Counter counter, int64_t n) { counters_[counter] += n; }
+
+    // Also show phases as spans in this trace.
+    void set_trace(TraceWriter *trace) { trace_ = trace; }
+
+    // Time while "phase" is active, e.g.
+    // { JobStats::Scope s(stats, JobStats::PHASE_OPTIMIZE); ... }
+    // "stats" can be NULL, then nothing is recorded.
+    class Scope {
+    public:
+        Scope(JobStats *stats, Phase phase) : stats_(stats) {
+            if (stats_) stats_->Begin(phase);
+        }
+        ~Scope() { if (stats_) stats_->End(); }
+
+    private:
+        JobStats *const stats_;
+    };
+
+    // Human readable table. When compiled with allocation accounting (see
+    // alloc-stats.h), also heap allocations by phase.
+    void PrintSummary(FILE *out) const;
+
+    // Write statistics as JSON to given file. Returns 'true' on success.
+    bool WriteJson(const std::string &filename) const;
+
+    static const char *PhaseName(Phase phase);
+
+private:
+    struct PhaseTime {
+        double wall_sec = 0;
+        double cpu_sec = 0;
+        int64_t count = 0;
+    };
+
+    void ChargeCurrentPhase();
+    void PrintAllocations(FILE *out) const;
+    long PeakRssKiB() const;
+
+    PhaseTime phases_[NUM_PHASES];
+    int64_t counters_[NUM_COUNTERS];
+    std::vector<Phase> active_;
+    TraceWriter *trace_;
+    double start_wall_, start_cpu_;
+    double mark_wall_, mark_cpu_;   // Time last charged to a phase.
+};
+
+#endif  // JOB_STATS_H
@@ -0,0 +1,390 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "librpt2pnp.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "board.h"
+#include "checkpoint.h"
+#include "job-stats.h"
+#include "machine.h"
+#include "machine-profile.h"
+#include "monotonic-clock.h"
+#include "motion-report.h"
+#include "pnp-config.h"
+#include "rpt2pnp.h"
+#include "tape.h"
+#include "time-estimator.h"
+#include "trace-writer.h"
+
+std::shared_ptr<Board> LoadBoard(const std::string &rpt_file, bool front,
+                                 const std::set<std::string> &exclude,
+                                 JobStats *stats) {
+    std::shared_ptr<Board> board(new Board());
+    {
+        JobStats::Scope parse_scope(stats, JobStats::PHASE_PARSE_RPT);
+        const Board::ReadFilter filter = [&](const Part &part) {
+            JobStats::Scope filter_scope(stats, JobStats::PHASE_FILTER);
+            return part.is_front_layer == front
+                && exclude.find(part.component_name) == exclude.end();
+        };
+        if (!board->ParseFromRpt(rpt_file, filter))
+            return NULL;
+    }
+    if (stats) {
+        stats->Add(JobStats::COUNT_PARTS, board->parts().size());
+        for (const Part *part : board->parts())
+            stats->Add(JobStats::COUNT_PADS, part->pads.size());
+    }
+    return board;
+}
+
+std::shared_ptr<PnPConfig> LoadConfig(const std::string &filename,
+                                      bool homer_format, const Board &board,
+                                      JobStats *stats) {
+    if (filename.empty())
+        return std::shared_ptr<PnPConfig>(CreateEmptyConfiguration());
+    JobStats::Scope config_scope(stats, JobStats::PHASE_PARSE_CONFIG);
+    return std::shared_ptr<PnPConfig>(homer_format
+        ? ParseSimplePnPConfiguration(board, filename)
+        : ParsePnPConfiguration(filename));
+}
+
+std::shared_ptr<MachineProfile> LoadMachineProfile(
+    const std::string &filename, const std::string &options) {
+    std::shared_ptr<MachineProfile> profile(new MachineProfile());
+    if (!filename.empty() && !ParseMachineProfile(filename, profile.get()))
+        return NULL;
+    if (!options.empty()
+        && !ParseMachineProfileOptions(options.c_str(), profile.get()))
+        return NULL;
+    return profile;
+}
+
+Tape *FindTapeForPart(const PnPConfig *config, const Part *part) {
+    const std::string key = part->footprint + "@" + part->value;
+    auto found = config->tape_for_component.find(key);
+    if (found == config->tape_for_component.end())
+        return NULL;
+    return found->second;
+}
+
+std::map<const Tape*, std::string> NameTapes(const PnPConfig *config) {
+    std::map<const Tape*, std::string> names;
+    if (config == NULL)
+        return names;
+    for (const auto &t : config->tape_for_component) {
+        std::string &name = names[t.second];
+        name.append(name.empty() ? "" : " ").append(t.first);
+    }
+    return names;
+}
+
+struct ComponentHeightComparator {
+    ComponentHeightComparator(const PnPConfig *config) : config_(config) {}
+
+    bool operator()(const Part *a, const Part *b) {
+        if (a == b) return 0;
+        const float a_height = GetHeight(a);
+        const float b_height = GetHeight(b);
+        if (a_height == b_height) {
+            return a->component_name < b->component_name;
+        }
+        return a_height < b_height;
+    }
+
+    float GetHeight(const Part *part) {
+        const Tape *tape = FindTapeForPart(config_, part);
+        return tape == NULL ? -1 : tape->height();
+    }
+    const PnPConfig *config_;
+};
+
+JobPlan JobPlan::Dispense(const Board &board, const MachineProfile &profile) {
+    JobPlan plan;
+    plan.dispensing_ = true;
+    for (const Part *part : board.parts()) {
+        for (const Pad &pad : part->pads) {
+            plan.pads_.push_back(std::make_pair(part, &pad));
+        }
+    }
+    OptimizeParts(&plan.pads_, profile.from_file ? &profile : NULL);
+    return plan;
+}
+
+JobPlan JobPlan::PickNPlace(const Board &board, const PnPConfig *config) {
+    JobPlan plan;
+    // Lowest height components first to not knock over bigger ones.
+    plan.parts_ = board.parts();
+    if (config) {
+        std::sort(plan.parts_.begin(), plan.parts_.end(),
+                  ComponentHeightComparator(config));
+        // Said once here; the job is run more often to estimate its time.
+        for (const Part *part : plan.parts_) {
+            if (FindTapeForPart(config, part) == NULL) {
+                fprintf(stderr, "No tape for '%s'\n",
+                        part->component_name.c_str());
+            }
+        }
+    }
+    return plan;
+}
+
+int JobPlan::size() const {
+    return dispensing_ ? pads_.size() : parts_.size();
+}
+
+const Part *JobPlan::part(int step) const {
+    return dispensing_ ? pads_[step].first : parts_[step];
+}
+
+const Pad *JobPlan::pad(int step) const {
+    return dispensing_ ? pads_[step].second : NULL;
+}
+
+std::string JobPlan::StepName(int step) const {
+    return dispensing_
+        ? pads_[step].first->component_name + "." + pads_[step].second->name
+        : parts_[step]->component_name;
+}
+
+uint64_t JobPlan::Hash() const {
+    PlanHash hash;
+    if (dispensing_) {
+        hash.Add(std::string("dispense"));
+        for (const auto &p : pads_) {
+            const Position pos = p.first->padAbsPos(*p.second);
+            hash.Add(p.first->component_name);
+            hash.Add(p.second->name);
+            hash.Add(pos.x_um);
+            hash.Add(pos.y_um);
+        }
+    } else {
+        hash.Add(std::string("pnp"));
+        for (const Part *part : parts_) {
+            hash.Add(part->component_name);
+            hash.Add(part->footprint + "@" + part->value);
+            hash.Add(part->pos.x_um);
+            hash.Add(part->pos.y_um);
+            hash.Add(part->angle);
+        }
+    }
+    return hash.value();
+}
+
+void RunJob(const JobPlan &plan, PnPConfig *config, int first_step,
+            Machine *machine, const StepDoneCallback &step_done,
+            const volatile sig_atomic_t *stop) {
+    for (int i = 0; i < plan.size(); ++i) {
+        const Part *part = plan.part(i);
+        if (i < first_step) {
+            // Components of parts placed before are gone from the tape.
+            Tape *tape = (config && !plan.dispensing())
+                ? FindTapeForPart(config, part) : NULL;
+            if (tape) tape->Advance();
+            continue;
+        }
+        if (stop && *stop)
+            break;
+
+        if (plan.dispensing()) {
+            machine->Dispense(*part, *plan.pad(i));
+        } else {
+            Tape *tape = config ? FindTapeForPart(config, part) : NULL;
+            machine->PickPart(*part, tape);
+            machine->PlacePart(*part, tape);
+            if (tape) tape->Advance();
+        }
+        step_done(i + 1);
+    }
+}
+
+double EstimateJobSeconds(const JobPlan &plan, const Board &board,
+                          const PnPConfig *config,
+                          const MachineProfile &profile,
+                          float start_ms, float area_ms,
+                          int first_step, bool homing) {
+    PrivateTapes tapes(config);
+    if (start_ms < 0) {
+        start_ms = profile.dispense_init_ms;
+        area_ms = profile.dispense_area_ms;
+    }
+
+    JobTimeEstimator estimator(profile);
+    GCodeMachine machine([&estimator](const char *str, size_t len) {
+            estimator.AddLine(str, len);
+        }, start_ms, area_ms);
+    machine.set_profile(profile);
+    machine.set_quiet(true);
+    machine.set_homing(homing);
+    if (machine.Init(tapes.config(), "", board.dimension())) {
+        RunJob(plan, tapes.config(), first_step, &machine, [](int) {});
+    }
+    machine.Finish();
+    estimator.Finish();
+    return estimator.total_seconds();
+}
+
+OutputSink FileSink(FILE *out) {
+    return [out](const char *data, size_t len) { fwrite(data, 1, len, out); };
+}
+
+// Stream passing everything written to it on to "sink".
+static FILE *OpenSinkStream(const OutputSink *sink) {
+    cookie_io_functions_t io = {};
+    io.write = [](void *cookie, const char *data, size_t len) -> ssize_t {
+        (*(const OutputSink*) cookie)(data, len);
+        return len;
+    };
+    return fopencookie((void*) sink, "w", io);
+}
+
+bool EmitJob(const JobPlan &plan, const Board &board,
+             const PnPConfig *config, const MachineProfile &profile,
+             const EmitOptions &options, const std::string &comment,
+             const OutputSink &sink, const StepDoneCallback &step_done) {
+    const bool times_given = (options.start_ms >= 0);
+    const float start_ms = times_given
+        ? options.start_ms : profile.dispense_init_ms;
+    const float area_ms = times_given
+        ? options.area_ms : profile.dispense_area_ms;
+    FILE *output = OpenSinkStream(&sink);
+    if (output == NULL) {
+        perror("Opening output stream");
+        return false;
+    }
+    PrivateTapes tapes(config);
+
+    Machine *machine = NULL;
+    JobTimeEstimator *estimator = NULL;
+    MotionReport *motion_report = NULL;
+    switch (options.format) {
+    case OUTPUT_GCODE:
+        machine = new GCodeMachine(output, start_ms, area_ms);
+        break;
+    case OUTPUT_POSTSCRIPT:
+        machine = new PostScriptMachine(output);
+        break;
+    case OUTPUT_ESTIMATE:
+        estimator = new JobTimeEstimator(profile);
+        machine = new GCodeMachine([estimator](const char *str, size_t len) {
+                estimator->AddLine(str, len);
+            }, start_ms, area_ms);
+        break;
+    case OUTPUT_MOTION_REPORT:
+        motion_report = new MotionReport(profile.pnp_angle_factor);
+        machine = new GCodeMachine([motion_report](const char *str,
+                                                   size_t len) {
+                motion_report->AddLine(str, len);
+            }, start_ms, area_ms);
+        break;
+    }
+    bool success = true;
+    if (options.format != OUTPUT_POSTSCRIPT) {
+        GCodeMachine *gcode = static_cast<GCodeMachine*>(machine);
+        gcode->set_profile(profile);
+        gcode->set_quiet(options.quiet);
+        gcode->set_job_stats(options.stats);
+        gcode->set_trace(options.trace);
+        if (options.format == OUTPUT_GCODE && options.progress) {
+            double predicted_seconds;
+            {
+                JobStats::Scope predict_scope(options.stats,
+                                              JobStats::PHASE_PREDICT);
+                predicted_seconds = EstimateJobSeconds(
+                    plan, board, config, profile, start_ms, area_ms, 0, true);
+            }
+            success = gcode->set_progress(options.progress,
+                                          predicted_seconds);
+        }
+        if (success && options.macro_dialect)
+            success = gcode->set_macro_dialect(options.macro_dialect);
+    }
+
+    // For the motion report, lines of a step are accounted to its part
+    // kind and tape.
+    const std::map<const Tape*, std::string> tape_names
+        = NameTapes(tapes.config());
+    const auto begin_step = [&](int step) {
+        if (motion_report == NULL) return;
+        if (step >= plan.size()) {
+            motion_report->SetGroup("", "");
+            return;
+        }
+        const Part *part = plan.part(step);
+        const Tape *tape = (plan.dispensing() || tapes.config() == NULL)
+            ? NULL : FindTapeForPart(tapes.config(), part);
+        motion_report->SetGroup(part->footprint + "@" + part->value,
+                                tape ? tape_names.at(tape) : "");
+    };
+
+    if (success && !machine->Init(tapes.config(), comment,
+                                  board.dimension())) {
+        fprintf(stderr, "Initialization failed\n");
+        success = false;
+    }
+    if (success) {
+        begin_step(0);
+        int64_t step_start_usec = GetMonotonicUsec();
+        RunJob(plan, tapes.config(), 0, machine, [&](int done) {
+                begin_step(done);
+                if (options.trace) {
+                    const int64_t now = GetMonotonicUsec();
+                    options.trace->Complete(plan.StepName(done - 1), "step",
+                                            step_start_usec, now);
+                    step_start_usec = now;
+                }
+                if (step_done) step_done(done);
+            }, options.stop);
+        machine->Finish();
+    }
+
+    if (estimator) {
+        estimator->Finish();
+        if (success) estimator->PrintSummary(output);
+        delete estimator;
+    }
+    if (motion_report) {
+        if (success) motion_report->Print(output);
+        delete motion_report;
+    }
+    delete machine;
+    fclose(output);
+    return success;
+}
+
+bool EmitDispenseAndPlace(const Board &board, const PnPConfig *config,
+                          const MachineProfile &profile,
+                          const EmitOptions &options,
+                          const std::string &comment,
+                          const OutputSink &dispense_sink,
+                          const OutputSink &place_sink) {
+    // Stats aren't thread-safe.
+    EmitOptions job_options = options;
+    job_options.stats = NULL;
+    job_options.trace = NULL;
+    bool success[2] = { false, false };
+    const auto write_job = [&](bool dispensing, const OutputSink &sink) {
+        const int64_t start_usec = GetMonotonicUsec();
+        const JobPlan plan = dispensing
+            ? JobPlan::Dispense(board, profile)
+            : JobPlan::PickNPlace(board, config);
+        success[dispensing] = EmitJob(plan, board, config, profile,
+                                      job_options, comment, sink);
+        if (options.trace) {
+            options.trace->NameThread(dispensing ? "dispense" : "pnp");
+            options.trace->Complete(dispensing ? "dispense" : "pnp", "job",
+                                    start_usec, GetMonotonicUsec());
+        }
+    };
+    std::thread dispense_thread(write_job, true, std::cref(dispense_sink));
+    std::thread place_thread(write_job, false, std::cref(place_sink));
+    dispense_thread.join();
+    place_thread.join();
+    return success[0] && success[1];
+}
@@ -0,0 +1,170 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Interface of librpt2pnp.a, to create dispensing and pick'n place jobs
+ * from within other programs: load a board and a config, plan the job and
+ * emit it as G-code, PostScript, time estimate or motion report to a sink,
+ * or run it on a Machine. A loaded board and config can be used for any
+ * number of jobs, also concurrently.
+ *
+ * Boards, configs and machine profiles are only handled through pointers
+ * and references here, so that their layout is not part of the interface.
+ * Within the same RPT2PNP_API_VERSION, changes to this interface are
+ * backward compatible.
+ */
+
+#ifndef LIBRPT2PNP_H
+#define LIBRPT2PNP_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define RPT2PNP_API_VERSION 1
+
+class Board;
+class JobStats;
+class Machine;
+class Tape;
+class TraceWriter;
+struct MachineProfile;
+struct Pad;
+struct Part;
+struct PnPConfig;
+
+// Board with the parts on the front or back of a KiCad rpt file, except
+// the ones with references in "exclude". Returns NULL if the file can't be
+// read. With "stats", parsing and filtering are accounted and parts and
+// pads counted.
+std::shared_ptr<Board> LoadBoard(const std::string &rpt_file, bool front,
+                                 const std::set<std::string> &exclude = {},
+                                 JobStats *stats = NULL);
+
+// Config from a file as created with -t, or with "homer_format" one
+// created by homer from -H. Returns NULL if it can't be read. Without
+// filename, the config is empty, which is enough for dispensing.
+std::shared_ptr<PnPConfig> LoadConfig(const std::string &filename,
+                                      bool homer_format, const Board &board,
+                                      JobStats *stats = NULL);
+
+// Machine profile from a file as written with -S, defaults without
+// filename; then with the comma separated key=value "options" as given
+// with -e. Returns NULL and prints an error if invalid.
+std::shared_ptr<MachineProfile> LoadMachineProfile(
+    const std::string &filename, const std::string &options = "");
+
+// The steps of a job in order: pads to dispense or parts to pick and place.
+// Refers to the parts of the board, so the board has to outlive it.
+class JobPlan {
+public:
+    JobPlan() : dispensing_(false) {}
+
+    // Pads of all parts, ordered for the least travel time with profile if
+    // it is from a file, otherwise for the shortest distance.
+    static JobPlan Dispense(const Board &board, const MachineProfile &profile);
+
+    // All parts; with config, the lowest ones first. Warns about parts
+    // without a tape in config.
+    static JobPlan PickNPlace(const Board &board, const PnPConfig *config);
+
+    bool dispensing() const { return dispensing_; }
+    int size() const;
+    const Part *part(int step) const;
+    const Pad *pad(int step) const;         // NULL if not dispensing.
+    std::string StepName(int step) const;   // e.g. "R1" or pad "R1.2"
+
+    // Same for the same steps at the same positions, to tell if a
+    // checkpoint belongs to this job.
+    uint64_t Hash() const;
+
+private:
+    bool dispensing_;
+    std::vector<std::pair<const Part *, const Pad *> > pads_;
+    std::vector<const Part *> parts_;
+};
+
+// Called after each step of a job with the number of steps done so far.
+typedef std::function<void(int steps_done)> StepDoneCallback;
+
+// Tape holding the components of part, NULL if none.
+Tape *FindTapeForPart(const PnPConfig *config, const Part *part);
+
+// Names of the tapes by the components they hold.
+std::map<const Tape*, std::string> NameTapes(const PnPConfig *config);
+
+// Do the steps of the plan on the machine, skipping the first
+// "first_step" ones. Parts take their components off the tapes of config,
+// the skipped ones too. Stops early once "*stop" is set (if given).
+void RunJob(const JobPlan &plan, PnPConfig *config, int first_step,
+            Machine *machine, const StepDoneCallback &step_done,
+            const volatile sig_atomic_t *stop = NULL);
+
+// Estimated seconds the job takes on a machine with profile, starting at
+// "first_step". Dispensing times from profile if "start_ms" is negative.
+// Works on its own copy of the tapes, so can be called from multiple
+// threads.
+double EstimateJobSeconds(const JobPlan &plan, const Board &board,
+                          const PnPConfig *config,
+                          const MachineProfile &profile,
+                          float start_ms, float area_ms,
+                          int first_step, bool homing);
+
+enum OutputFormat {
+    OUTPUT_GCODE,
+    OUTPUT_POSTSCRIPT,
+    OUTPUT_ESTIMATE,         // Summary of estimated job time.
+    OUTPUT_MOTION_REPORT,    // Travel and motion per part kind and tape.
+};
+
+// Receives the output of EmitJob().
+typedef std::function<void(const char *data, size_t len)> OutputSink;
+
+// Sink writing to "out".
+OutputSink FileSink(FILE *out);
+
+struct EmitOptions {
+    OutputFormat format = OUTPUT_GCODE;
+    float start_ms = -1;               // Dispensing; from profile if < 0.
+    float area_ms = -1;
+    const char *macro_dialect = NULL;  // See GCodeMachine.
+    const char *progress = NULL;       // "<style>[,<sec>]" as with -i.
+    bool quiet = false;                // No informational messages.
+    const volatile sig_atomic_t *stop = NULL;  // Stop early once set.
+
+    // Optional; used from one job at a time only. The trace shows steps
+    // and lines.
+    JobStats *stats = NULL;
+    TraceWriter *trace = NULL;
+};
+
+// Emit the job of the plan to "sink" in the chosen format, with "comment"
+// in its header. Works on its own copy of the tapes, so that jobs on the
+// same board and config can be emitted concurrently. "step_done" is
+// optional. Returns 'false' and prints a message on failure.
+bool EmitJob(const JobPlan &plan, const Board &board,
+             const PnPConfig *config, const MachineProfile &profile,
+             const EmitOptions &options, const std::string &comment,
+             const OutputSink &sink,
+             const StepDoneCallback &step_done = NULL);
+
+// Emit both the dispensing and the pick'n place job of the board, planned
+// and emitted concurrently, to "dispense_sink" and "place_sink". The
+// trace of "options" shows the two jobs; stats are not kept. Returns
+// 'true' if both succeeded.
+bool EmitDispenseAndPlace(const Board &board, const PnPConfig *config,
+                          const MachineProfile &profile,
+                          const EmitOptions &options,
+                          const std::string &comment,
+                          const OutputSink &dispense_sink,
+                          const OutputSink &place_sink);
+
+#endif  // LIBRPT2PNP_H
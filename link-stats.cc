@@ -0,0 +1,158 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "link-stats.h"
+
+#include <ctype.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "monotonic-clock.h"
+
+// Values below 2^kSubBucketBits get their own bucket. Above, each power of
+// two is split into 2^(kSubBucketBits-1) buckets.
+static const int kSubBucketBits = 5;
+static const int kSubBuckets = 1 << kSubBucketBits;
+static const int kHalfSubBuckets = kSubBuckets / 2;
+
+static int MostSignificantBit(uint64_t v) { return 63 - __builtin_clzll(v); }
+
+static int BucketIndex(int64_t value) {
+    if (value < kSubBuckets)
+        return value < 0 ? 0 : value;
+    const int shift = MostSignificantBit(value) - (kSubBucketBits - 1);
+    const int top = value >> shift;  // in [kHalfSubBuckets, kSubBuckets)
+    return kSubBuckets + (shift - 1) * kHalfSubBuckets
+        + (top - kHalfSubBuckets);
+}
+
+// Smallest value that lands in given bucket.
+static int64_t BucketStart(int index) {
+    if (index < kSubBuckets)
+        return index;
+    const int shift = (index - kSubBuckets) / kHalfSubBuckets + 1;
+    const int top = (index - kSubBuckets) % kHalfSubBuckets + kHalfSubBuckets;
+    return (int64_t)top << shift;
+}
+
+static int64_t BucketWidth(int index) {
+    if (index < kSubBuckets)
+        return 1;
+    return (int64_t)1 << ((index - kSubBuckets) / kHalfSubBuckets + 1);
+}
+
+LatencyHistogram::LatencyHistogram()
+    : buckets_(BucketIndex(INT64_MAX) + 1),
+      count_(0), total_(0), min_(0), max_(0) {}
+
+void LatencyHistogram::Add(int64_t usec) {
+    if (usec < 0) usec = 0;
+    buckets_[BucketIndex(usec)]++;
+    if (count_ == 0 || usec < min_) min_ = usec;
+    if (count_ == 0 || usec > max_) max_ = usec;
+    ++count_;
+    total_ += usec;
+}
+
+int64_t LatencyHistogram::Percentile(double p) const {
+    if (count_ == 0) return 0;
+    const int64_t wanted = (int64_t)(p / 100.0 * count_ + 0.5);
+    int64_t seen = 0;
+    for (size_t i = 0; i < buckets_.size(); ++i) {
+        seen += buckets_[i];
+        if (seen >= wanted && seen > 0) {
+            // Middle of the bucket, but never outside of what we've seen.
+            const int64_t value = BucketStart(i) + BucketWidth(i) / 2;
+            return std::min(std::max(value, min_), max_);
+        }
+    }
+    return max_;
+}
+
+// Command type is the first word, normalized: "g01 x5" -> "G1"
+static std::string CommandType(const char *line, size_t len) {
+    const char *end = line + len;
+    while (line < end && isspace(*line))
+        ++line;
+    if (line == end || !isalpha(*line))
+        return "other";
+    std::string result(1, toupper(*line++));
+    while (line < end - 1 && *line == '0' && isdigit(line[1]))
+        ++line;  // leading zeros.
+    while (line < end && (isdigit(*line) || *line == '.'))
+        result.append(1, *line++);
+    return result;
+}
+
+LinkStats::LinkStats()
+    : pending_send_time_(-1), first_send_time_(-1), last_ack_time_(-1),
+      lines_(0), bytes_(0) {}
+
+void LinkStats::LineSent(const char *line, size_t len) {
+    pending_command_ = CommandType(line, len);
+    pending_send_time_ = GetMonotonicUsec();
+    if (first_send_time_ < 0) first_send_time_ = pending_send_time_;
+    ++lines_;
+    bytes_ += len;
+}
+
+void LinkStats::AckReceived() {
+    if (pending_send_time_ < 0)
+        return;  // Unsolicited ok.
+    last_ack_time_ = GetMonotonicUsec();
+    per_command_[pending_command_].Add(last_ack_time_ - pending_send_time_);
+    pending_send_time_ = -1;
+}
+
+void LinkStats::PrintSummary(FILE *out) const {
+    const double elapsed = (last_ack_time_ - first_send_time_) / 1e6;
+    if (lines_ == 0 || elapsed <= 0)
+        return;
+    fprintf(out, "Machine link: %lld lines, %lld bytes in %.2fs; "
+            "%.1f lines/s, %.1f bytes/s\n",
+            (long long)lines_, (long long)bytes_, elapsed,
+            lines_ / elapsed, bytes_ / elapsed);
+    fprintf(out, "%-8s %7s %9s %9s %9s %9s %9s %9s\n", "command", "count",
+            "total[s]", "mean[ms]", "p50[ms]", "p90[ms]", "p99[ms]",
+            "max[ms]");
+    for (const auto &c : per_command_) {
+        const LatencyHistogram &h = c.second;
+        fprintf(out, "%-8s %7lld %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+                c.first.c_str(), (long long)h.count(), h.total_usec() / 1e6,
+                h.total_usec() / 1e3 / h.count(),
+                h.Percentile(50) / 1e3, h.Percentile(90) / 1e3,
+                h.Percentile(99) / 1e3, h.max_usec() / 1e3);
+    }
+}
+
+bool LinkStats::WriteJson(const std::string &filename) const {
+    FILE *out = fopen(filename.c_str(), "w");
+    if (out == NULL) {
+        perror(filename.c_str());
+        return false;
+    }
+    const double elapsed = (last_ack_time_ - first_send_time_) / 1e6;
+    fprintf(out, "{\n  \"lines\": %lld,\n  \"bytes\": %lld,\n"
+            "  \"elapsed_sec\": %.6f,\n"
+            "  \"lines_per_sec\": %.3f,\n  \"bytes_per_sec\": %.3f,\n"
+            "  \"commands\": {",
+            (long long)lines_, (long long)bytes_, elapsed > 0 ? elapsed : 0,
+            elapsed > 0 ? lines_ / elapsed : 0,
+            elapsed > 0 ? bytes_ / elapsed : 0);
+    const char *separator = "\n";
+    for (const auto &c : per_command_) {
+        const LatencyHistogram &h = c.second;
+        fprintf(out, "%s    \"%s\": { \"count\": %lld, \"total_ms\": %.3f, "
+                "\"min_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, "
+                "\"p99_ms\": %.3f, \"max_ms\": %.3f }",
+                separator, c.first.c_str(), (long long)h.count(),
+                h.total_usec() / 1e3, h.min_usec() / 1e3,
+                h.Percentile(50) / 1e3, h.Percentile(90) / 1e3,
+                h.Percentile(99) / 1e3, h.max_usec() / 1e3);
+        separator = ",\n";
+    }
+    fprintf(out, "\n  }\n}\n");
+    return fclose(out) == 0;
+}
@@ -0,0 +1,76 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Statistics of the communication with the machine.
+ */
+
+#ifndef LINK_STATS_H
+#define LINK_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Histogram with logarithmic buckets, each power of two split up into
+// linear sub-buckets (the idea of HDR histograms). This keeps the relative
+// error constant (~3%) no matter if a value is a couple of microseconds or
+// a couple of minutes.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void Add(int64_t usec);
+
+    int64_t count() const { return count_; }
+    int64_t total_usec() const { return total_; }
+    int64_t min_usec() const { return min_; }
+    int64_t max_usec() const { return max_; }
+
+    // Value at given percentile (0..100). Exact up to the bucket resolution.
+    int64_t Percentile(double p) const;
+
+private:
+    std::vector<int64_t> buckets_;
+    int64_t count_;
+    int64_t total_;
+    int64_t min_;
+    int64_t max_;
+};
+
+// Round-trip latency of each line sent to the machine until its 'ok' comes
+// back, bucketed by command type (G0, G1, G4, M42, ...). Also counts bytes
+// and lines to determine the throughput.
+class LinkStats {
+public:
+    LinkStats();
+
+    // A line is about to be sent to the machine.
+    void LineSent(const char *line, size_t len);
+
+    // The 'ok' for the last line sent arrived.
+    void AckReceived();
+
+    int64_t lines_sent() const { return lines_; }
+
+    // Human readable summary.
+    void PrintSummary(FILE *out) const;
+
+    // Write statistics as JSON to given file. Returns 'true' on success.
+    bool WriteJson(const std::string &filename) const;
+
+private:
+    typedef std::map<std::string, LatencyHistogram> CommandHistograms;
+
+    CommandHistograms per_command_;
+    std::string pending_command_;
+    int64_t pending_send_time_;
+    int64_t first_send_time_;
+    int64_t last_ack_time_;
+    int64_t lines_;
+    int64_t bytes_;
+};
+
+#endif  // LINK_STATS_H
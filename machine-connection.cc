@@ -2,38 +2,82 @@
  * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
  */
 
+#include "machine-connection.h"
+
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <string>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "arbitrary-baudrate.h"
+#include "monotonic-clock.h"
+
+#define TCP_CONNECT_TIMEOUT_MS 5000
+#define TCP_KEEPALIVE_IDLE_SEC 5
+#define TCP_KEEPALIVE_INTERVAL_SEC 2
+#define TCP_KEEPALIVE_COUNT 3
+
+// Map baudrate to termios speed constant. Returns false if there is
+// none for this rate.
+static bool BaudToSpeed(int baud, speed_t *speed) {
+    switch (baud) {
+    case 9600:    *speed = B9600; return true;
+    case 19200:   *speed = B19200; return true;
+    case 38400:   *speed = B38400; return true;
+    case 57600:   *speed = B57600; return true;
+    case 115200:  *speed = B115200; return true;
+    case 230400:  *speed = B230400; return true;
+    case 460800:  *speed = B460800; return true;
+#ifdef B500000
+    case 500000:  *speed = B500000; return true;
+#endif
+#ifdef B921600
+    case 921600:  *speed = B921600; return true;
+#endif
+#ifdef B1000000
+    case 1000000: *speed = B1000000; return true;
+#endif
+#ifdef B1500000
+    case 1500000: *speed = B1500000; return true;
+#endif
+#ifdef B2000000
+    case 2000000: *speed = B2000000; return true;
+#endif
+    default:
+        return false;
+    }
+}
+
 static bool SetTTYParams(int fd, const char *params) {
-    speed_t speed = B115200;
+    int baud = 115200;
     if (params[0] == 'b' || params[0] == 'B')
         params = params + 1;
     if (*params) {
-        int speed_number = atoi(params);
-        switch (speed_number) {
-        case 9600:   speed = B9600; break;
-        case 19200:  speed = B19200; break;
-        case 38400:  speed = B38400; break;
-        case 57600:  speed = B57600; break;
-        case 115200: speed = B115200; break;
-        case 230400: speed = B230400; break;
-        case 460800: speed = B460800; break;
-        default:
-            fprintf(stderr, "Invalid speed '%s'; valid speeds are "
-                    "[9600, 19200, 38400, 57600, 115200, 230400, 460800]\n",
-                    params);
+        baud = atoi(params);
+        if (baud <= 0) {
+            fprintf(stderr, "Invalid speed '%s'\n", params);
             return false;
-            break;
         }
     }
+    // Rates without a termios constant (e.g. 250000) are set afterwards.
+    speed_t speed = B38400;
+    const bool is_standard_rate = BaudToSpeed(baud, &speed);
 
     struct termios tty;
     if (tcgetattr(fd, &tty) < 0) {
@@ -63,12 +107,14 @@ static bool SetTTYParams(int fd, const char *params) {
         printf("Error from tcsetattr: %s\n", strerror(errno));
         return false;
     }
+    if (!is_standard_rate && !SetArbitraryBaudrate(fd, baud))
+        return false;
     return true;
  }
 
 // Wait for input to become ready for read or timeout reached.
 // If the file-descriptor becomes readable, returns number of milli-seconds
-// left.
+// left (at least 1).
 // Returns 0 on timeout (i.e. no millis left and nothing to be read).
 // Returns -1 on error.
 static int AwaitReadReady(int fd, int timeout_millis) {
@@ -77,22 +123,35 @@ static int AwaitReadReady(int fd, int timeout_millis) {
     FD_SET(fd, &read_fds);
 
     struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = timeout_millis * 1000;
+    tv.tv_sec = timeout_millis / 1000;
+    tv.tv_usec = (timeout_millis % 1000) * 1000;
 
     FD_SET(fd, &read_fds);
     int s = select(fd + 1, &read_fds, NULL, NULL, &tv);
     if (s < 0)
         return -1;
-    return tv.tv_usec / 1000;
+    if (s == 0)
+        return 0;
+    const int left = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    return left > 0 ? left : 1;
 }
 
 static int ReadLine(int fd, char *result, int len, bool do_echo) {
     int bytes_read = 0;
     char c = 0;
     while (c != '\n' && c != '\r' && bytes_read < len) {
-        if (read(fd, &c, 1) < 0)
+        const int r = read(fd, &c, 1);
+        if (r < 0) {
+            // A signal only interrupts us between lines; a started line is
+            // read to the end so that we don't lose track of it.
+            if (errno == EINTR && bytes_read > 0)
+                continue;
+            return -1;
+        }
+        if (r == 0) {
+            errno = EPIPE;  // Other end closed connection.
             return -1;
+        }
         ++bytes_read;
         *result++ = c;
         if (do_echo) write(STDERR_FILENO, &c, 1);  // echo back.
@@ -101,6 +160,109 @@ static int ReadLine(int fd, char *result, int len, bool do_echo) {
     return bytes_read;
 }
 
+// "hostname:port", "192.168.1.5:4444" or "[::1]:4444". Anything that has
+// a slash is a tty path.
+static bool ParseHostPort(const char *descriptor,
+                          std::string *host, std::string *port) {
+    if (strchr(descriptor, '/') != NULL)
+        return false;
+    const char *colon = strrchr(descriptor, ':');
+    if (colon == NULL || colon == descriptor || colon[1] == '\0')
+        return false;
+    for (const char *p = colon + 1; *p; ++p) {
+        if (!isdigit(*p)) return false;
+    }
+    const char *host_start = descriptor;
+    const char *host_end = colon;
+    if (*host_start == '[' && host_end[-1] == ']') {
+        ++host_start;
+        --host_end;
+    }
+    host->assign(host_start, host_end);
+    port->assign(colon + 1);
+    return true;
+}
+
+// Connect with timeout, so that an unreachable controller doesn't block us
+// for minutes.
+static bool ConnectWithTimeout(int fd, const struct sockaddr *addr,
+                               socklen_t addr_len, int timeout_ms) {
+    const int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    if (connect(fd, addr, addr_len) < 0) {
+        if (errno != EINPROGRESS)
+            return false;
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        const int r = poll(&pfd, 1, timeout_ms);
+        if (r == 0)
+            errno = ETIMEDOUT;
+        if (r <= 0)
+            return false;
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+        if (err != 0) {
+            errno = err;
+            return false;
+        }
+    }
+    fcntl(fd, F_SETFL, flags);  // Back to blocking, as with the tty.
+    return true;
+}
+
+static int OpenTCPConnection(const std::string &host, const std::string &port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses = NULL;
+    const int gai_result = getaddrinfo(host.c_str(), port.c_str(),
+                                       &hints, &addresses);
+    if (gai_result != 0) {
+        fprintf(stderr, "Resolving %s: %s\n", host.c_str(),
+                gai_strerror(gai_result));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *a = addresses; a != NULL; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (ConnectWithTimeout(fd, a->ai_addr, a->ai_addrlen,
+                               TCP_CONNECT_TIMEOUT_MS))
+            break;
+        fprintf(stderr, "Connecting to %s:%s: %s\n", host.c_str(),
+                port.c_str(), strerror(errno));
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0)
+        return -1;
+
+    // We send one short line at a time and wait for the ok; don't let Nagle
+    // hold it back.
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    // Notice if the controller silently went away.
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+#ifdef TCP_KEEPIDLE
+    int keep_idle = TCP_KEEPALIVE_IDLE_SEC;
+    int keep_interval = TCP_KEEPALIVE_INTERVAL_SEC;
+    int keep_count = TCP_KEEPALIVE_COUNT;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &keep_idle, sizeof(keep_idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL,
+               &keep_interval, sizeof(keep_interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &keep_count, sizeof(keep_count));
+#endif
+
+    // A controller closing the connection should be an error on write(),
+    // not a signal killing us.
+    signal(SIGPIPE, SIG_IGN);
+    return fd;
+}
+
 /*
  *
  *  Public interface functions
@@ -109,6 +271,9 @@ static int ReadLine(int fd, char *result, int len, bool do_echo) {
 
 int OpenMachineConnection(const char *descriptor) {
     if (descriptor == nullptr) return -1;
+    std::string host, port;
+    if (ParseHostPort(descriptor, &host, &port))
+        return OpenTCPConnection(host, port);
     const char *comma = strchrnul(descriptor, ',');
     const std::string path(descriptor, comma);
     int fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_SYNC);
@@ -139,14 +304,93 @@ int DiscardPendingInput(int fd, int timeout_ms) {
 }
 
 // 'ok' comes on a single line, maybe followed by something.
-void WaitForOkAck(int fd) {
+// Wait for 'ok'. Lines before it are appended to "response" if given,
+// otherwise printed.
+static bool WaitForOkAckInternal(int fd, int timeout_ms, bool *resend_requested,
+                                 std::string *response) {
+    const int full_timeout_ms = timeout_ms;
     char buffer[512];
     for (;;) {
+        if (timeout_ms >= 0) {
+            timeout_ms = AwaitReadReady(fd, timeout_ms);
+            if (timeout_ms == 0)
+                errno = ETIMEDOUT;
+            if (timeout_ms <= 0)
+                return false;
+        }
         if (ReadLine(fd, buffer, sizeof(buffer), false) < 0)
-            break;
+            return false;
         if (strncasecmp(buffer, "ok", 2) == 0)
-            break;
+            return true;
+        // Keepalive while executing long commands. Machine is alive, so
+        // the timeout starts over.
+        if (strncasecmp(buffer, "echo:busy", 9) == 0) {
+            timeout_ms = full_timeout_ms;
+            continue;
+        }
+        if (resend_requested && (strncasecmp(buffer, "Resend", 6) == 0
+                                 || strncasecmp(buffer, "rs ", 3) == 0)) {
+            *resend_requested = true;
+        }
+        if (response) {
+            response->append(buffer);
+            continue;
+        }
         // If we didn't get 'ok', it might be an important error message. Print.
         fprintf(stderr, "%s", buffer);
     }
 }
+
+bool WaitForOkAck(int fd, int timeout_ms, bool *resend_requested) {
+    return WaitForOkAckInternal(fd, timeout_ms, resend_requested, NULL);
+}
+
+bool WaitForOkAckCollect(int fd, int timeout_ms, std::string *response) {
+    return WaitForOkAckInternal(fd, timeout_ms, NULL, response);
+}
+
+// Send "count" copies of "line", each waiting for its ok. Returns seconds
+// it took or -1 on failure.
+static double TimeLineRoundtrips(int fd, const std::string &line, int count) {
+    const double start = GetMonotonicSeconds();
+    for (int i = 0; i < count; ++i) {
+        write(fd, line.data(), line.size());
+        if (!WaitForOkAck(fd, 5000))
+            return -1;
+    }
+    return GetMonotonicSeconds() - start;
+}
+
+bool ProbeLinkThroughput(int fd, int count) {
+    // A command that doesn't do anything if no moves are pending, once
+    // short and once padded with a comment to longer than typical lines.
+    // Time per line = fixed latency + bytes * time-per-byte; two line lengths
+    // give us both.
+    const std::string short_line = "M400\n";
+    const std::string long_line = "M400 (" + std::string(90, '-') + ")\n";
+    DiscardPendingInput(fd, 100);
+    const double short_time = TimeLineRoundtrips(fd, short_line, count);
+    const double long_time = TimeLineRoundtrips(fd, long_line, count);
+    if (short_time < 0 || long_time < 0) {
+        fprintf(stderr, "Link probe: machine did not acknowledge.\n");
+        return false;
+    }
+    const double per_short = short_time / count;
+    const double per_long = long_time / count;
+    const double per_byte = (per_long - per_short)
+        / (long_line.size() - short_line.size());
+    const double per_line = per_short - per_byte * short_line.size();
+    fprintf(stderr, "Link probe: %d lines of each size\n"
+            "  %3d byte lines: %7.1f lines/s %9.0f bytes/s\n"
+            "  %3d byte lines: %7.1f lines/s %9.0f bytes/s\n",
+            count,
+            (int)short_line.size(), 1 / per_short,
+            short_line.size() / per_short,
+            (int)long_line.size(), 1 / per_long,
+            long_line.size() / per_long);
+    if (per_byte > 0) {
+        fprintf(stderr, "  => %.2fms fixed round-trip per line + %.1f bytes/s "
+                "transfer\n", 1000 * std::max(per_line, 0.0), 1 / per_byte);
+    }
+    return true;
+}
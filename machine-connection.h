@@ -5,12 +5,17 @@
 #ifndef MACHINE_CONN_H
 #define MACHINE_CONN_H
 
+#include <stddef.h>
+
+#include <string>
+
 // Open a connection to a machine. The "descriptor" is a string describing
 // the connection to the machine. This can be different ways to connect to
 // a machine.
 // Supported formats
-//   - terminal: path, optional speed "/dev/ttyUSB0,b115200"
-//   - "hostname:port"  (in fact: not yet supported, but needed for BeagleG)
+//   - terminal: path, optional speed "/dev/ttyUSB0,b115200". Any speed
+//     is accepted, e.g. "b250000" or "b2000000" (non-standard ones on Linux).
+//   - TCP: "hostname:port", e.g. for BeagleG. Also "[::1]:4444" for IPv6.
 //
 // Returns a bi-directional file-descriptor or -1 if opening failed.
 int OpenMachineConnection(const char *descriptor);
@@ -23,6 +28,23 @@ int DiscardPendingInput(int fd, int timeout_ms);
 // For for "ok" string that 3D printers use as 'flow control'. It is important
 // to wait for this ack after each command sent to he printer otherwise
 // commands might get lost.
-void WaitForOkAck(int fd);
+// Returns 'true' if we got the "ok". Returns 'false' on read error, if
+// a signal interrupted the wait (errno == EINTR) or if no "ok" arrived within
+// "timeout_ms" (errno == ETIMEDOUT; negative timeout: wait forever).
+// A "busy" keepalive from the machine restarts the timeout.
+// If the machine asks for the line to be sent again, "*resend_requested" is
+// set to true (if given); the "ok" still follows.
+bool WaitForOkAck(int fd, int timeout_ms = -1, bool *resend_requested = NULL);
+
+// Like WaitForOkAck(), but instead of printing whatever the machine
+// answered before the "ok", it is appended to "response".
+bool WaitForOkAckCollect(int fd, int timeout_ms, std::string *response);
+
+// Measure the rate at which lines can be streamed to the machine: send
+// "count" no-op lines one by one, each waiting for the "ok", once with short
+// and once with long lines. Reports lines/s and bytes/s on stderr, as well as
+// the fixed per-line round-trip and the effective transfer rate.
+// Returns 'false' if the machine did not acknowledge.
+bool ProbeLinkThroughput(int fd, int count);
 
 #endif // MACHINE_CONN_H
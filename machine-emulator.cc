@@ -0,0 +1,472 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "machine-emulator.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "gcode-interpreter.h"
+#include "monotonic-clock.h"
+#include "option-list.h"
+#include "trace-writer.h"
+
+// Marlin sends a busy keepalive every couple of seconds while blocked.
+#define BUSY_INTERVAL_SEC 2.0
+
+bool MachineEmulator::ParseOptions(const char *spec, Options *options) {
+    for (const std::string &option : SplitCommaSeparated(spec ? spec : "")) {
+        std::string key, value_str;
+        if (!SplitKeyValue(option, &key, &value_str)) {
+            fprintf(stderr, "Emulator option '%s': expected key=value\n",
+                    option.c_str());
+            return false;
+        }
+        const float value = atof(value_str.c_str());
+        if (key == "planner") options->planner_slots = value;
+        else if (key == "rx") options->rx_buffer = value;
+        else if (key == "baud") options->baud = value;
+        else if (key == "overhead") options->command_overhead_ms = value;
+        else if (key == "speed") options->speed = value;
+        else if (key == "resend") options->resend_rate = value;
+        else if (key == "busy") options->busy_rate = value;
+        else if (key == "busy-ms") options->busy_ms = value;
+        else if (key == "drop") options->drop_rate = value;
+        else if (key == "seed") options->seed = value;
+        else if (key == "tcp") options->tcp_port = value;
+        else {
+            fprintf(stderr, "Unknown emulator option '%s'\n", key.c_str());
+            return false;
+        }
+    }
+    if (options->planner_slots < 1 || options->rx_buffer < 1
+        || options->baud <= 0 || options->speed <= 0) {
+        fprintf(stderr, "Emulator: planner, rx, baud and speed need to be "
+                "positive.\n");
+        return false;
+    }
+    if (options->tcp_port > 65535) {
+        fprintf(stderr, "Emulator: invalid tcp port %d\n", options->tcp_port);
+        return false;
+    }
+    return true;
+}
+
+MachineEmulator::MachineEmulator(const Options &options)
+    : options_(options), master_fd_(-1), slave_fd_(-1), listen_fd_(-1),
+      running_(false),
+      start_(0), link_free_(0), random_state_(options.seed), trace_(NULL),
+      sd_pos_(0), sd_printing_(false) {}
+
+MachineEmulator::~MachineEmulator() {
+    if (running_) Stop();
+}
+
+bool MachineEmulator::Start() {
+    if (!(options_.tcp_port >= 0 ? StartTCP() : StartPseudoTerminal()))
+        return false;
+    start_ = GetMonotonicSeconds();
+    running_ = true;
+    thread_ = std::thread(&MachineEmulator::Run, this);
+    return true;
+}
+
+bool MachineEmulator::StartPseudoTerminal() {
+    master_fd_ = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd_ < 0 || grantpt(master_fd_) < 0 || unlockpt(master_fd_) < 0) {
+        perror("Emulator: creating pseudo terminal");
+        return false;
+    }
+    device_ = ptsname(master_fd_);
+
+    // Keep the slave side open ourselves, so that the master doesn't see a
+    // hangup in-between the host opening and closing it. Also raw right away,
+    // so nothing is echoed back before the host sets up the terminal.
+    slave_fd_ = open(device_.c_str(), O_RDWR | O_NOCTTY);
+    if (slave_fd_ < 0) {
+        perror("Emulator: opening pseudo terminal");
+        return false;
+    }
+    struct termios tty;
+    tcgetattr(slave_fd_, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(slave_fd_, TCSANOW, &tty);
+    return true;
+}
+
+// Like a networked controller, e.g. a BeagleG or a WiFi bridge. Only
+// listens on the loopback interface.
+bool MachineEmulator::StartTCP() {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(options_.tcp_port);
+    socklen_t addr_len = sizeof(addr);
+    int on = 1;
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0
+        || setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR,
+                      &on, sizeof(on)) < 0
+        || bind(listen_fd_, (struct sockaddr*) &addr, sizeof(addr)) < 0
+        || listen(listen_fd_, 1) < 0
+        || getsockname(listen_fd_, (struct sockaddr*) &addr, &addr_len) < 0) {
+        perror("Emulator: listening on TCP port");
+        return false;
+    }
+    device_ = "127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+    return true;
+}
+
+bool MachineEmulator::AcceptHost() {
+    struct pollfd pfd = { listen_fd_, POLLIN, 0 };
+    if (poll(&pfd, 1, 50) <= 0)
+        return false;
+    master_fd_ = accept(listen_fd_, NULL, NULL);
+    if (master_fd_ < 0)
+        return false;
+    int on = 1;
+    setsockopt(master_fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+MachineEmulator::Stats MachineEmulator::Stop() {
+    running_ = false;
+    if (thread_.joinable()) thread_.join();
+    if (master_fd_ >= 0) close(master_fd_);
+    if (slave_fd_ >= 0) close(slave_fd_);
+    if (listen_fd_ >= 0) close(listen_fd_);
+    master_fd_ = slave_fd_ = listen_fd_ = -1;
+    return stats_;
+}
+
+void MachineEmulator::PrintStats(const char *name, const Stats &stats,
+                                 double job_seconds) {
+    fprintf(stderr, "%s: job completed in %.2fs (%.2fs machine time).\n"
+            "  %lld lines, %lld bytes, %lld moves; %lld waits for planner "
+            "slot, %lld bytes RX overflow\n"
+            "  injected: %lld resend, %lld busy, %lld dropped\n",
+            name, job_seconds, stats.machine_seconds,
+            (long long)stats.lines, (long long)stats.bytes,
+            (long long)stats.moves, (long long)stats.planner_full_waits,
+            (long long)stats.rx_overflow_bytes,
+            (long long)stats.injected_resends,
+            (long long)stats.injected_busy,
+            (long long)stats.injected_drops);
+}
+
+double MachineEmulator::Now() const {
+    return (GetMonotonicSeconds() - start_) * options_.speed;
+}
+
+void MachineEmulator::SleepUntil(double emulated_time) {
+    const double wakeup = start_ + emulated_time / options_.speed;
+    struct timespec ts;
+    ts.tv_sec = (time_t) wakeup;
+    ts.tv_nsec = (long) ((wakeup - ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+void MachineEmulator::Reply(const char *msg) {
+    if (listen_fd_ >= 0)   // No SIGPIPE if the host went away.
+        send(master_fd_, msg, strlen(msg), MSG_NOSIGNAL);
+    else
+        write(master_fd_, msg, strlen(msg));
+}
+
+bool MachineEmulator::Inject(float rate) {
+    return rate > 0 && rand_r(&random_state_) < rate * RAND_MAX;
+}
+
+void MachineEmulator::WaitForPlannerSlot() {
+    const double now = Now();
+    while (!planner_.empty() && planner_.front() <= now)
+        planner_.erase(planner_.begin());
+    if ((int)planner_.size() >= options_.planner_slots) {
+        ++stats_.planner_full_waits;
+        SleepUntil(planner_.front());
+        planner_.erase(planner_.begin());
+    }
+}
+
+void MachineEmulator::WaitForMovesDone(bool send_busy) {
+    if (planner_.empty()) return;
+    const double done = planner_.back();
+    double now;
+    while ((now = Now()) < done) {
+        const double next = std::min(done, now + BUSY_INTERVAL_SEC);
+        SleepUntil(next);
+        if (send_busy && next < done) Reply("echo:busy: processing\n");
+    }
+    planner_.clear();
+}
+
+void MachineEmulator::ProcessLine(const std::string &line) {
+    ++stats_.lines;
+    stats_.bytes += line.size() + 1;
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+        return;  // Empty lines are not acknowledged.
+
+    if (!sd_writing_.empty()) {
+        // Everything goes to the file, until M29.
+        if (line.compare(0, 3, "M29") == 0) {
+            sd_writing_.clear();
+            Reply("Done saving file.\nok\n");
+        } else {
+            sd_files_[sd_writing_].append(line).append("\n");
+            Reply("ok\n");
+        }
+        return;
+    }
+
+    if (Inject(options_.drop_rate)) {
+        ++stats_.injected_drops;
+        return;
+    }
+    if (Inject(options_.resend_rate)) {
+        ++stats_.injected_resends;
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Error:checksum mismatch, Last Line: %lld\n"
+                 "Resend: %lld\nok\n", (long long) stats_.lines - 1,
+                 (long long) stats_.lines);
+        Reply(msg);
+        return;
+    }
+
+    if (!HandleSDCommand(line))
+        Execute(line);
+
+    if (Inject(options_.busy_rate)) {
+        ++stats_.injected_busy;
+        planner_.push_back(std::max(Now(), planner_.empty() ? 0 : planner_.back())
+                           + options_.busy_ms / 1000.0);
+        WaitForMovesDone(true);
+    }
+    SleepUntil(Now() + options_.command_overhead_ms / 1000.0);
+    Reply("ok\n");
+}
+
+void MachineEmulator::Execute(const std::string &line) {
+    float home_distance = 0;  // Where homing would start.
+    for (int a = 0; a < GCodeInterpreter::AXIS_E; ++a) {
+        home_distance = std::max(home_distance, fabsf(interpreter_.position(
+                                     (GCodeInterpreter::Axis) a)));
+    }
+    std::vector<GCodeInterpreter::Step> steps;
+    interpreter_.Interpret(line.data(), line.size(), &steps);
+    for (const GCodeInterpreter::Step &step : steps) {
+        switch (step.kind) {
+        case GCodeInterpreter::Step::MOVE: {
+            WaitForPlannerSlot();
+            const double start = planner_.empty()
+                ? Now() : std::max(Now(), planner_.back());
+            planner_.push_back(start + GCodeInterpreter::NominalSeconds(step));
+            ++stats_.moves;
+            break;
+        }
+        case GCodeInterpreter::Step::DWELL:
+            WaitForMovesDone(true);
+            SleepUntil(Now() + step.dwell_ms / 1000.0);
+            break;
+        case GCodeInterpreter::Step::WAIT_FOR_MOVES:
+            WaitForMovesDone(true);
+            break;
+        case GCodeInterpreter::Step::HOME:
+            WaitForMovesDone(true);
+            planner_.push_back(Now() + home_distance / options_.home_feedrate);
+            WaitForMovesDone(true);
+            break;
+        case GCodeInterpreter::Step::OTHER:
+            break;
+        }
+    }
+}
+
+bool MachineEmulator::HandleSDCommand(const std::string &line) {
+    int code;
+    int name_start = 0;
+    if (sscanf(line.c_str(), "M%d %n", &code, &name_start) < 1)
+        return false;
+    std::string name = line.substr(name_start);
+    name.erase(name.find_last_not_of(" \t\r") + 1);
+    if (name.size() >= 2 && name[0] == '"' && name.back() == '"')
+        name = name.substr(1, name.size() - 2);  // RepRapFirmware style.
+    char msg[256];
+    switch (code) {
+    case 20:  // List files
+        Reply("Begin file list\n");
+        for (const auto &f : sd_files_) {
+            snprintf(msg, sizeof(msg), "%s %d\n", f.first.c_str(),
+                     (int)f.second.size());
+            Reply(msg);
+        }
+        Reply("End file list\n");
+        return true;
+    case 23: {  // Select file
+        const auto found = sd_files_.find(name);
+        if (found == sd_files_.end()) {
+            snprintf(msg, sizeof(msg), "open failed, File: %s.\n", name.c_str());
+            Reply(msg);
+            return true;
+        }
+        sd_selected_ = name;
+        sd_pos_ = 0;
+        snprintf(msg, sizeof(msg), "File opened: %s Size: %d\nFile selected\n",
+                 name.c_str(), (int)found->second.size());
+        Reply(msg);
+        return true;
+    }
+    case 24:  // Start/resume
+        sd_printing_ = !sd_selected_.empty();
+        return true;
+    case 25:  // Pause
+        sd_printing_ = false;
+        return true;
+    case 27:  // Progress
+        if (sd_printing_) {
+            snprintf(msg, sizeof(msg), "SD printing byte %d/%d\n",
+                     (int)sd_pos_, (int)sd_files_[sd_selected_].size());
+            Reply(msg);
+        } else {
+            Reply("Not SD printing\n");
+        }
+        return true;
+    case 28:  // Start writing
+        if (name.empty()) {
+            Reply("open failed, File: .\n");
+            return true;
+        }
+        sd_writing_ = name;
+        sd_files_[name].clear();
+        snprintf(msg, sizeof(msg), "Writing to file: %s\n", name.c_str());
+        Reply(msg);
+        return true;
+    case 98:   // Call macro file, RepRapFirmware style.
+        CallMacro(line);
+        return true;
+    case 524:  // Abort
+        sd_printing_ = false;
+        sd_selected_.clear();
+        return true;
+    }
+    return false;
+}
+
+void MachineEmulator::CallMacro(const std::string &line) {
+    // M98 P"<file>" <letter><value> ... ; values replace {param.<letter>}
+    const size_t name_start = line.find("P\"");
+    const size_t name_end = (name_start == std::string::npos)
+        ? std::string::npos : line.find('"', name_start + 2);
+    if (name_end == std::string::npos) {
+        Reply("Error: M98: missing P\"<file>\"\n");
+        return;
+    }
+    const std::string name = line.substr(name_start + 2,
+                                         name_end - name_start - 2);
+    const auto found = sd_files_.find(name);
+    if (found == sd_files_.end()) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Error: M98: macro %s not found\n",
+                 name.c_str());
+        Reply(msg);
+        return;
+    }
+    std::map<char, std::string> params;
+    std::istringstream in(line.substr(name_end + 1));
+    std::string word;
+    while (in >> word) {
+        if (isalpha(word[0])) params[toupper(word[0])] = word.substr(1);
+    }
+    std::istringstream body(found->second);
+    std::string body_line;
+    while (std::getline(body, body_line)) {
+        size_t pos;
+        while ((pos = body_line.find("{param.")) != std::string::npos
+               && pos + 8 < body_line.size() && body_line[pos + 8] == '}') {
+            body_line.replace(pos, 9, params[body_line[pos + 7]]);
+        }
+        Execute(body_line);
+    }
+}
+
+void MachineEmulator::PrintNextSDLine() {
+    const std::string &file = sd_files_[sd_selected_];
+    if (sd_pos_ >= file.size()) {
+        sd_printing_ = false;
+        sd_selected_.clear();
+        Reply("Done printing file\n");
+        return;
+    }
+    size_t eol = file.find('\n', sd_pos_);
+    if (eol == std::string::npos) eol = file.size();
+    const std::string line = file.substr(sd_pos_, eol - sd_pos_);
+    sd_pos_ = eol + 1;
+    Execute(line);
+    SleepUntil(Now() + options_.command_overhead_ms / 1000.0);
+}
+
+void MachineEmulator::Run() {
+    std::string rx;   // Received, but not processed yet.
+    char buffer[4096];
+    const double seconds_per_byte = 10.0 / options_.baud;  // 8N1
+    while (running_) {
+        if (master_fd_ < 0) {
+            AcceptHost();
+            continue;
+        }
+        // Printing from SD card: only check for commands in-between.
+        if (sd_printing_ && rx.empty())
+            PrintNextSDLine();
+        struct pollfd pfd = { master_fd_, POLLIN, 0 };
+        if (poll(&pfd, 1, sd_printing_ ? 0 : 50) <= 0)
+            continue;
+        const int r = read(master_fd_, buffer, sizeof(buffer));
+        if (r <= 0) {
+            usleep(10000);   // Host not connected (yet).
+            continue;
+        }
+        // While we were busy, nobody emptied the receive buffer: everything
+        // beyond its size is lost, just like in the firmware.
+        const int room = std::max(0, options_.rx_buffer - (int)rx.size());
+        const int accepted = std::min(r, room);
+        stats_.rx_overflow_bytes += r - accepted;
+        rx.append(buffer, accepted);
+
+        size_t eol;
+        while ((eol = rx.find_first_of("\r\n")) != std::string::npos) {
+            const std::string line = rx.substr(0, eol);
+            rx.erase(0, eol + 1);
+            // Bytes need time to get through the wire.
+            link_free_ = std::max(Now(), link_free_)
+                + (line.size() + 1) * seconds_per_byte;
+            SleepUntil(link_free_);
+            const int64_t received_usec = GetMonotonicUsec();
+            ProcessLine(line);
+            TraceWriter *const trace = trace_;
+            if (trace) {
+                trace->NameThread("emulator");
+                trace->Complete(line, "emulator", received_usec,
+                                GetMonotonicUsec());
+            }
+        }
+    }
+    stats_.machine_seconds = std::max(Now(), planner_.empty()
+                                      ? 0 : planner_.back());
+}
@@ -0,0 +1,128 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Emulation of a 3D-printer style controller on a pseudo terminal or a
+ * TCP port on the loopback interface, so that streaming to the machine can
+ * be tested and benchmarked without tying up a real one. Also emulates an
+ * SD card (M20, M23-M25, M27-M29, M524) and macro files on it (M98).
+ */
+
+#ifndef MACHINE_EMULATOR_H
+#define MACHINE_EMULATOR_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gcode-interpreter.h"
+
+class TraceWriter;
+
+class MachineEmulator {
+public:
+    struct Options {
+        int planner_slots = 16;         // Moves buffered in the planner.
+        int rx_buffer = 128;            // Bytes of serial receive buffer.
+        int baud = 115200;              // Emulated line speed.
+        float command_overhead_ms = 0.5;  // Parsing etc. per command.
+        float home_feedrate = 50;       // mm/s homing speed.
+        float speed = 1.0;              // Run this much faster than real time.
+        int tcp_port = -1;              // Listen on 127.0.0.1 instead of a
+                                        // pseudo terminal; 0: any free port.
+
+        // Error injection: probabilities per line.
+        float resend_rate = 0;          // Line garbled, ask for resend.
+        float busy_rate = 0;            // Busy for another "busy_ms".
+        float drop_rate = 0;            // Line silently lost; no 'ok'.
+        float busy_ms = 3000;
+        unsigned int seed = 1;
+    };
+
+    // Parse comma separated key=value options, e.g.
+    // "planner=16,rx=128,baud=250000,speed=10,resend=0.01,busy=0,drop=0",
+    // "tcp=4444".
+    // Returns 'false' and prints an error on invalid options.
+    static bool ParseOptions(const char *spec, Options *options);
+
+    struct Stats {
+        int64_t lines = 0;
+        int64_t bytes = 0;
+        int64_t moves = 0;
+        int64_t planner_full_waits = 0;  // Line blocked waiting for slot.
+        int64_t rx_overflow_bytes = 0;   // Lost, as RX buffer was full.
+        int64_t injected_resends = 0;
+        int64_t injected_busy = 0;
+        int64_t injected_drops = 0;
+        double machine_seconds = 0;      // Emulated time until last move done.
+    };
+
+    explicit MachineEmulator(const Options &options);
+    ~MachineEmulator();
+
+    // Show each line in the trace, from receiving it until it is
+    // acknowledged. Can be set while running.
+    void set_trace(TraceWriter *trace) { trace_ = trace; }
+
+    // Create the pseudo terminal, or listen on the TCP port, and start
+    // emulating in a separate thread. Returns 'false' if the pseudo terminal
+    // could not be created or the port not be bound.
+    bool Start();
+
+    // What the host connects to with OpenMachineConnection(): path of the
+    // pseudo terminal or "127.0.0.1:<port>". Over TCP, the first host to
+    // connect is the one served.
+    const std::string &device() const { return device_; }
+
+    // Stop emulating. Returns statistics.
+    Stats Stop();
+
+    // Print "stats" of a job that took "job_seconds" on the emulated
+    // machine "name" to stderr.
+    static void PrintStats(const char *name, const Stats &stats,
+                           double job_seconds);
+
+private:
+    bool StartPseudoTerminal();
+    bool StartTCP();
+    bool AcceptHost();   // Over TCP, wait for the host to connect.
+    void Run();
+    void ProcessLine(const std::string &line);  // Received from host.
+    void Execute(const std::string &line);      // Moves, dwells, ...
+    bool HandleSDCommand(const std::string &line);
+    void CallMacro(const std::string &line);
+    void PrintNextSDLine();
+    double Now() const;                // Emulated seconds since start.
+    void SleepUntil(double emulated_time);
+    void WaitForPlannerSlot();
+    void WaitForMovesDone(bool send_busy);
+    void Reply(const char *msg);
+    bool Inject(float rate);
+
+    const Options options_;
+    int master_fd_;                    // Our end of the connection to host.
+    int slave_fd_;
+    int listen_fd_;                    // With tcp_port.
+    std::string device_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+    double start_;                     // Monotonic seconds at start.
+    double link_free_;                 // Emulated time the link is idle.
+    GCodeInterpreter interpreter_;
+    std::vector<double> planner_;      // Finish times of queued moves.
+    unsigned int random_state_;
+    Stats stats_;
+    std::atomic<TraceWriter*> trace_;
+
+    // SD card.
+    std::map<std::string, std::string> sd_files_;
+    std::string sd_writing_;           // File currently uploaded, if any.
+    std::string sd_selected_;
+    size_t sd_pos_;
+    bool sd_printing_;
+};
+
+#endif  // MACHINE_EMULATOR_H
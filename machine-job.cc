@@ -0,0 +1,176 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "machine-job.h"
+
+#include <stdio.h>
+
+#include <map>
+#include <memory>
+
+#include "board.h"
+#include "checkpoint.h"
+#include "job-progress.h"
+#include "job-stats.h"
+#include "machine.h"
+#include "machine-profile.h"
+#include "monotonic-clock.h"
+#include "trace-writer.h"
+
+bool StreamJob(int fd, const JobPlan &plan, const Board &board,
+               PnPConfig *config, const MachineProfile &profile,
+               const StreamOptions &options, const std::string &comment,
+               double *seconds) {
+    const EmitOptions &job = options.job;
+    const bool dispensing = plan.dispensing();
+    const int total_steps = plan.size();
+    const float start_ms = job.start_ms >= 0
+        ? job.start_ms : profile.dispense_init_ms;
+    const float area_ms = job.start_ms >= 0
+        ? job.area_ms : profile.dispense_area_ms;
+
+    std::unique_ptr<JobCheckpoint> checkpoint;
+    int first_step = 0;
+    bool position_known = false;
+    if (!options.checkpoint_file.empty()) {
+        const char *const checkpoint_file = options.checkpoint_file.c_str();
+        checkpoint.reset(new JobCheckpoint(checkpoint_file));
+        if (options.resume) {
+            if (!checkpoint->Load())
+                return false;
+            if (checkpoint->plan_hash() != plan.Hash()
+                || checkpoint->total_steps() != total_steps) {
+                fprintf(stderr, "%s is from a different job (board, "
+                        "operation or options changed). Can't resume.\n",
+                        checkpoint_file);
+                return false;
+            }
+            first_step = checkpoint->steps_done();
+            if (first_step >= total_steps) {
+                fprintf(stderr, "Job in %s is already complete.\n",
+                        checkpoint_file);
+                return true;
+            }
+            position_known = checkpoint->position_known();
+            fprintf(stderr, "Resuming at step %d of %d%s.\n",
+                    first_step + 1, total_steps,
+                    position_known ? ", without homing: the motors were "
+                    "left on" : "");
+        }
+    }
+
+    // Follow the job with the time model to report progress: in the G-code
+    // with -i, and to the operator while streaming to the machine.
+    const bool host_progress = options.sd_filename.empty();
+    const bool follow_progress = host_progress || job.progress;
+    // If the machine was left in a known position, don't do unnecessary
+    // homing.
+    const bool homing = options.homing && !position_known;
+    double predicted_seconds = 0;
+    if (follow_progress) {
+        JobStats::Scope predict_scope(job.stats, JobStats::PHASE_PREDICT);
+        predicted_seconds = EstimateJobSeconds(
+            plan, board, config, profile, start_ms, area_ms, first_step,
+            homing);
+    }
+
+    GCodeMachine machine(fd, fd, start_ms, area_ms);
+    machine.set_homing(homing);
+    machine.set_emergency_stop(options.emergency_stop, job.stop);
+    machine.set_ack_timeout_slack_ms(options.ack_timeout_slack_ms);
+    if (!options.sd_filename.empty()) {
+        machine.set_sd_upload(options.sd_filename);
+    }
+    if (!options.link_stats_file.empty()) {
+        machine.set_link_stats_file(options.link_stats_file);
+    }
+    machine.set_profile(profile);
+    machine.set_job_stats(job.stats);
+    machine.set_trace(job.trace);
+    if (follow_progress && !machine.set_progress(job.progress,
+                                                 predicted_seconds)) {
+        return false;
+    }
+    if (job.macro_dialect && !machine.set_macro_dialect(job.macro_dialect)) {
+        return false;
+    }
+
+    // Dispensing: a part is done once all its pads are.
+    std::map<const Part*, int> pads_left;
+    if (dispensing) {
+        for (int i = 0; i < total_steps; ++i) pads_left[plan.part(i)]++;
+    }
+    const auto part_done_with = [&](int step) {
+        return !dispensing || --pads_left[plan.part(step)] == 0;
+    };
+    int parts_done = 0;
+    for (int i = 0; i < first_step; ++i) {
+        if (part_done_with(i)) ++parts_done;
+    }
+    std::unique_ptr<JobProgress> progress;
+    if (host_progress) {
+        if (dispensing) {
+            progress.reset(new JobProgress(stderr, pads_left.size(),
+                                           total_steps, predicted_seconds));
+        } else {
+            progress.reset(new JobProgress(stderr, total_steps, 0,
+                                           predicted_seconds));
+        }
+    }
+
+    const double job_start = GetMonotonicSeconds();
+    int steps_done = first_step;
+    {
+        JobStats::Scope emit_scope(job.stats, JobStats::PHASE_EMIT);
+        if (!machine.Init(config, comment, board.dimension())) {
+            fprintf(stderr, "Initialization failed\n");
+            return false;
+        }
+
+        // Steps are only done if the machine acknowledged them. After an
+        // emergency stop or stall, the commands of the current step are
+        // dropped. Each step is shown in the trace.
+        int64_t step_start_usec = GetMonotonicUsec();
+        const StepDoneCallback step_done = [&](int done) {
+            if (job.trace) {
+                const int64_t now = GetMonotonicUsec();
+                job.trace->Complete(plan.StepName(done - 1), "step",
+                                    step_start_usec, now);
+                step_start_usec = now;
+            }
+            if (machine.aborted())
+                return;
+            steps_done = done;
+            if (part_done_with(done - 1))
+                ++parts_done;
+            if (checkpoint)
+                checkpoint->Save(plan.Hash(), total_steps, done, false);
+            if (progress) {
+                progress->Update(parts_done, dispensing ? done : 0,
+                                 machine.predicted_seconds());
+            }
+        };
+        RunJob(plan, config, first_step, &machine, step_done, job.stop);
+        if (progress) progress->Finish();
+
+        machine.Finish();
+    }
+    if (seconds) *seconds = GetMonotonicSeconds() - job_start;
+
+    if (checkpoint) {
+        // Unless the motors were left on, Finish() homed x/y and turned them
+        // off; only homing tells where the machine is then.
+        checkpoint->Save(plan.Hash(), total_steps, steps_done,
+                         machine.position_held());
+        if (steps_done < total_steps) {
+            fprintf(stderr, "Stopped after step %d of %d. Continue with "
+                    "-R -K%s\n", steps_done, total_steps,
+                    options.checkpoint_file.c_str());
+        }
+    }
+
+    // Not done if stopped early, the machine stalled or the SD print failed.
+    // (With upload to SD card, steps are done once they are buffered.)
+    return !machine.aborted() && steps_done == total_steps;
+}
@@ -0,0 +1,38 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Doing a job on a machine connected to us, with progress shown to the
+ * operator and a checkpoint to resume from if it is interrupted.
+ */
+
+#ifndef MACHINE_JOB_H
+#define MACHINE_JOB_H
+
+#include <string>
+
+#include "librpt2pnp.h"
+
+struct StreamOptions {
+    EmitOptions job;              // Dispensing times, macros, progress, stop,
+                                  // stats and trace.
+    std::string emergency_stop;   // See GCodeMachine::set_emergency_stop()
+    int ack_timeout_slack_ms = 0;
+    bool homing = true;           // Otherwise the machine is at the origin.
+    std::string sd_filename;      // Upload to SD card, print from there.
+    std::string link_stats_file;  // See GCodeMachine::set_link_stats_file()
+    std::string checkpoint_file;  // Saved after each acknowledged step.
+    bool resume = false;          // Continue the job of checkpoint_file.
+};
+
+// Stream the job of the plan to the machine connected on "fd". Unless
+// printing from SD card, progress is shown on stderr. With a checkpoint
+// file, the job can be resumed where it stopped; without homing if the
+// motors were left on. "*seconds" (optional) is set to the time from
+// initializing the machine until the job is finished. Returns 'true' if
+// all steps of the job are done.
+bool StreamJob(int fd, const JobPlan &plan, const Board &board,
+               PnPConfig *config, const MachineProfile &profile,
+               const StreamOptions &options, const std::string &comment,
+               double *seconds);
+
+#endif  // MACHINE_JOB_H
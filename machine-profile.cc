@@ -0,0 +1,168 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "machine-profile.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "option-list.h"
+
+namespace {
+struct Field {
+    const char *key;
+    float *value;
+};
+}
+
+static std::vector<Field> ProfileFields(MachineProfile *p) {
+    typedef MachineProfile M;
+    return {
+        { "pnp-to-tape-speed",   &p->pnp_to_tape_speed },
+        { "pnp-to-board-speed",  &p->pnp_to_board_speed },
+        { "pnp-plunge-speed",    &p->pnp_plunge_speed },
+        { "pnp-hover",           &p->pnp_hover },
+        { "pnp-tape-thick",      &p->pnp_tape_thick },
+        { "pnp-angle-factor",    &p->pnp_angle_factor },
+        { "pnp-blow-ms",         &p->pnp_blow_ms },
+        { "dispense-move-speed", &p->dispense_move_speed },
+        { "dispense-speed",      &p->dispense_speed },
+        { "dispense-z-dispensing", &p->dispense_z_dispensing },
+        { "dispense-z-hover",    &p->dispense_z_hover },
+        { "dispense-z-separate", &p->dispense_z_separate },
+        { "dispense-init-ms",    &p->dispense_init_ms },
+        { "dispense-area-ms",    &p->dispense_area_ms },
+        { "speed-x",             &p->max_speed[M::AXIS_X] },
+        { "speed-y",             &p->max_speed[M::AXIS_Y] },
+        { "speed-z",             &p->max_speed[M::AXIS_Z] },
+        { "speed-e",             &p->max_speed[M::AXIS_E] },
+        { "accel-x",             &p->max_accel[M::AXIS_X] },
+        { "accel-y",             &p->max_accel[M::AXIS_Y] },
+        { "accel-z",             &p->max_accel[M::AXIS_Z] },
+        { "accel-e",             &p->max_accel[M::AXIS_E] },
+        { "junction-deviation",  &p->junction_deviation },
+        { "command-overhead-ms", &p->command_overhead_ms },
+        { "valve-ms",            &p->valve_ms },
+        { "home-speed",          &p->home_speed },
+    };
+}
+
+bool MachineProfile::Set(const std::string &key, const char *value) {
+    char *end;
+    const float v = strtof(value, &end);
+    if (end == value)
+        return false;
+    if (key == "speed-xy") {
+        max_speed[AXIS_X] = max_speed[AXIS_Y] = v;
+        return true;
+    }
+    if (key == "accel-xy") {
+        max_accel[AXIS_X] = max_accel[AXIS_Y] = v;
+        return true;
+    }
+    for (const Field &f : ProfileFields(this)) {
+        if (key == f.key) {
+            *f.value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+float MachineProfile::TravelSeconds(const Position &from, const Position &to,
+                                    float speed) const {
+    return TravelSeconds(ToMillimeters(to.x_um - from.x_um),
+                         ToMillimeters(to.y_um - from.y_um), speed);
+}
+
+float MachineProfile::TravelSeconds(float dx, float dy, float speed) const {
+    const float dist = sqrtf(dx * dx + dy * dy);
+    if (dist == 0) return 0;
+    float accel = 1e12;
+    const float share[2] = { fabsf(dx) / dist, fabsf(dy) / dist };
+    for (int i = AXIS_X; i <= AXIS_Y; ++i) {
+        if (share[i] == 0) continue;
+        speed = std::min(speed, max_speed[i] / share[i]);
+        accel = std::min(accel, max_accel[i] / share[i]);
+    }
+    if (dist < speed * speed / accel)
+        return 2 * sqrtf(dist / accel);  // Never reaching full speed.
+    return dist / speed + speed / accel;
+}
+
+float MachineProfile::MaxTravelDistance(float seconds, float speed) const {
+    // Diagonally, both axes add up.
+    speed = std::min(speed, (float)M_SQRT2 * std::max(max_speed[AXIS_X],
+                                                      max_speed[AXIS_Y]));
+    const float accel = M_SQRT2 * std::max(max_accel[AXIS_X],
+                                           max_accel[AXIS_Y]);
+    if (seconds < 2 * speed / accel)
+        return accel * seconds * seconds / 4;  // Never reaching full speed.
+    return (seconds - speed / accel) * speed;
+}
+
+void MachineProfile::Write(FILE *out) const {
+    fprintf(out, "# Machine profile. Lengths in mm, speeds mm/s, "
+            "accelerations mm/s^2, times ms.\n");
+    for (const Field &f : ProfileFields(const_cast<MachineProfile*>(this))) {
+        fprintf(out, "%s: %g\n", f.key, *f.value);
+    }
+}
+
+static bool CheckLimits(const MachineProfile &profile) {
+    for (int i = 0; i < MachineProfile::NUM_AXES; ++i) {
+        if (profile.max_speed[i] <= 0 || profile.max_accel[i] <= 0) {
+            fprintf(stderr, "Machine profile: speeds and accelerations need "
+                    "to be positive.\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ParseMachineProfile(const std::string &filename, MachineProfile *profile) {
+    FILE *in = fopen(filename.c_str(), "r");
+    if (!in) {
+        fprintf(stderr, "Can't open %s\n", filename.c_str());
+        return false;
+    }
+    char buffer[1024];
+    int line = 0;
+    bool success = true;
+    while (success && fgets(buffer, sizeof(buffer), in)) {
+        ++line;
+        char *comment = strchr(buffer, '#');
+        if (comment) *comment = '\0';
+        char key[256];
+        int value_pos = -1;
+        if (sscanf(buffer, " %255[^: \t\n] :%n", key, &value_pos) < 1)
+            continue;  // Empty line.
+        if (value_pos < 0 || !profile->Set(key, buffer + value_pos)) {
+            fprintf(stderr, "%s:%d: invalid profile line '%s'\n",
+                    filename.c_str(), line, key);
+            success = false;
+        }
+    }
+    fclose(in);
+    profile->from_file = true;
+    return success && CheckLimits(*profile);
+}
+
+bool ParseMachineProfileOptions(const char *spec, MachineProfile *profile) {
+    for (const std::string &option : SplitCommaSeparated(spec ? spec : "")) {
+        std::string key, value;
+        if (!SplitKeyValue(option, &key, &value)
+            || !profile->Set(key, value.c_str())) {
+            fprintf(stderr, "Invalid machine profile option '%s'\n",
+                    option.c_str());
+            return false;
+        }
+    }
+    return CheckLimits(*profile);
+}
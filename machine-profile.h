@@ -0,0 +1,83 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Speeds, accelerations, clearances and timing of a particular machine.
+ */
+
+#ifndef MACHINE_PROFILE_H
+#define MACHINE_PROFILE_H
+
+#include <stdio.h>
+
+#include <string>
+
+#include "rpt2pnp.h"
+
+// All lengths in mm, speeds in mm/s, accelerations in mm/s^2 and times in
+// milliseconds. Defaults are what works on our Printrbot; limits of the axes
+// are the Marlin defaults.
+struct MachineProfile {
+    enum { AXIS_X, AXIS_Y, AXIS_Z, AXIS_E, NUM_AXES };  // As GCodeInterpreter
+
+    // Pick'n place
+    float pnp_to_tape_speed = 1000;   // moving needle to tape
+    float pnp_to_board_speed = 100;   // moving component from tape to board
+    float pnp_plunge_speed = 4000 / 60.0;  // down to tape or board.
+    float pnp_hover = 10;             // Above tape/board while transporting.
+    // Components are a bit higher as they are resting on some card-board.
+    float pnp_tape_thick = 0;
+    // E-axis units per degree of rotation. This is specific to our stepper.
+    float pnp_angle_factor = 50.34965 / 360;
+    float pnp_blow_ms = 40;           // Blowing off component after place.
+
+    // Dispensing
+    float dispense_move_speed = 400;  // move dispensing unit to next pad
+    float dispense_speed = 100;       // speed when doing dispensing down/up
+    float dispense_z_dispensing = 0.3;  // Above board when dispensing
+    float dispense_z_hover = 2;       // Above board when moving around
+    float dispense_z_separate = 5;    // Above board right after dispensing.
+    float dispense_init_ms = 50;      // Pressure on: initial offset ...
+    float dispense_area_ms = 25;      // ... plus this per mm^2 pad area.
+
+    // Axis limits and firmware behavior, for estimating and optimizing.
+    float max_speed[NUM_AXES] = { 300, 300, 5, 25 };
+    float max_accel[NUM_AXES] = { 3000, 3000, 100, 10000 };
+    float junction_deviation = 0.013;
+    float command_overhead_ms = 0.5;  // Parsing etc. per command.
+    float valve_ms = 10;              // Vacuum or solenoid switching.
+    float home_speed = 50;
+
+    // Read from a file, so the axis limits are those of the actual machine:
+    // dispensing tours are ordered for the least travel time with them,
+    // otherwise for the shortest distance.
+    bool from_file = false;
+
+    // Set value by name as used in the profile file, e.g.
+    // "pnp-hover", "speed-z"; "speed-xy" and "accel-xy" set both axes.
+    // Returns 'false' if the key is unknown or the value not a number.
+    bool Set(const std::string &key, const char *value);
+
+    // Seconds for an XY move from standing to standing still, with
+    // "speed" limited by axis speeds and accelerations.
+    float TravelSeconds(const Position &from, const Position &to,
+                        float speed) const;
+    // Same for a move of "dx", "dy" millimetres.
+    float TravelSeconds(float dx, float dy, float speed) const;
+
+    // Longest XY distance any move could get in "seconds" at "speed";
+    // a move of a longer distance always takes longer.
+    float MaxTravelDistance(float seconds, float speed) const;
+
+    // Write all values in the profile file format.
+    void Write(FILE *out) const;
+};
+
+// Read profile; "key: value" per line, '#' comments. Values not mentioned
+// keep their default. Sets "from_file". Returns 'false' and prints an error
+// on parse errors.
+bool ParseMachineProfile(const std::string &filename, MachineProfile *profile);
+
+// Set values from comma separated key=value list, e.g. "speed-z=10,junction-deviation=0.02".
+bool ParseMachineProfileOptions(const char *spec, MachineProfile *profile);
+
+#endif  // MACHINE_PROFILE_H
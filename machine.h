@@ -5,12 +5,17 @@
 #ifndef MACHINE_H_
 #define MACHINE_H_
 
+#include <signal.h>
 #include <stdio.h>
 
 #include <string>
 #include <set>
 #include <functional>
 
+#include "gcode-interpreter.h"
+#include "link-stats.h"
+#include "machine-profile.h"
+
 struct PnPConfig;
 class Dimension;
 class Part;
@@ -47,14 +52,109 @@ public:
     virtual void Finish() = 0;
 };
 
+struct MacroDialect;  // Firmware macros, see gcode-machine.cc
+class JobTimeEstimator;
+class JobStats;
+class TraceWriter;
+
+// Progress in the G-code (-i) is reported that often, in predicted seconds,
+// unless given.
+#define DEFAULT_PROGRESS_INTERVAL_SEC 10
+
 // A machine
 class GCodeMachine : public Machine {
 public:
     GCodeMachine(FILE *output, float init_ms, float area_ms);
     GCodeMachine(int input_fd, int output_fd, float init_ms, float area_ms);
+    // Each line of G-code is passed to "write_line".
+    GCodeMachine(std::function<void(const char *str, size_t len)> write_line,
+                 float init_ms, float area_ms);
+    ~GCodeMachine() override;
 
     void set_homing(bool h) { do_homing_ = h; }
 
+    // Don't print informational messages on stderr.
+    void set_quiet(bool q) { quiet_ = q; }
+
+    // Speeds, clearances and timing to use. Default: built-in profile.
+    void set_profile(const MachineProfile &profile) { profile_ = profile; }
+
+    // Emergency stop when connected to a machine: as soon as
+    // "*stop_requested" becomes non-zero, "stop_command" (e.g. M410 quick-stop
+    // or M112) is sent right away, without waiting for the remaining lines
+    // of the current operation. After that, vacuum and solenoid are turned
+    // off and all further commands are dropped.
+    void set_emergency_stop(const std::string &stop_command,
+                            const volatile sig_atomic_t *stop_requested) {
+        emergency_stop_command_ = stop_command;
+        stop_requested_ = stop_requested;
+    }
+
+    // When connected to a machine: instead of streaming, collect the
+    // whole program, upload it to the SD card of the machine as
+    // "filename" and print it from there in Finish().
+    void set_sd_upload(const std::string &filename) { sd_filename_ = filename; }
+
+    // When connected to a machine, each command has to be acknowledged
+    // within its expected duration (derived from move length, feedrate and
+    // dwell time) plus this slack. Otherwise the machine is considered stalled
+    // and the job is aborted. Zero or negative: wait forever.
+    void set_ack_timeout_slack_ms(int ms) { ack_timeout_slack_ms_ = ms; }
+
+    // When connected to a machine, a summary of the link statistics is
+    // printed on Finish(). If set, they are also written to this JSON file.
+    void set_link_stats_file(const std::string &filename) {
+        link_stats_file_ = filename;
+    }
+
+    // Define pick and place as firmware macros in the preamble, so that each
+    // of them is a single call: "rrf" (RepRapFirmware M98) or "klipper"
+    // (gcode_macro in printer.cfg). Returns 'false' for unknown dialects.
+    bool set_macro_dialect(const std::string &dialect);
+
+    enum ProgressStyle {
+        PROGRESS_NONE,   // Only predict, see predicted_seconds()
+        PROGRESS_M73,    // "M73 P<percent> R<minutes-left>"
+        PROGRESS_M117,   // "M117 <percent>% <h:mm> left" on the display.
+    };
+
+    // Parse "<style>[,<interval-sec>]" as given with -i, style "m73" or
+    // "m117". "*interval_sec" is left alone if not given. Returns 'false'
+    // and prints an error if invalid.
+    static bool ParseProgressSpec(const char *spec, ProgressStyle *style,
+                                  float *interval_sec);
+
+    // Follow the job with the time model of the profile (set_profile()
+    // first). Every
+    // "interval_sec" of predicted machine time, progress of the job,
+    // predicted to take "total_sec", is reported in the G-code.
+    void set_progress(ProgressStyle style, float interval_sec,
+                      double total_sec);
+    // Same with "spec" as given with -i, see ParseProgressSpec(); NULL only
+    // predicts. Returns 'false' and prints an error if "spec" is invalid.
+    bool set_progress(const char *spec, double total_sec);
+
+    // Predicted machine time of the commands sent so far. Needs
+    // set_progress().
+    double predicted_seconds() const;
+
+    // Count lines and bytes generated and time streaming to the machine.
+    void set_job_stats(JobStats *stats) { stats_ = stats; }
+
+    // When connected to a machine, each line is shown in the trace from
+    // sending it until it is acknowledged.
+    void set_trace(TraceWriter *trace) { trace_ = trace; }
+
+    // Job was aborted by emergency stop, because the machine stalled or
+    // printing from SD card failed. Commands sent since then were dropped.
+    bool aborted() const { return aborted_; }
+
+    // After Finish(): the job was stopped on request between steps (e.g.
+    // Ctrl-C without emergency stop command) and the motors were left on
+    // instead of homing x/y and turning them off. So the machine still knows
+    // its position, as long as it isn't switched off in the meantime.
+    bool position_held() const { return position_held_; }
+
     bool Init(const PnPConfig *config, const std::string &init_comment,
               const Dimension &dimension) override;
     void PickPart(const Part &part, const Tape *tape) override;
@@ -63,9 +163,6 @@ public:
     void Finish() override;
 
 private:
-    GCodeMachine(std::function<void(const char *str, size_t len)> write_line,
-                 float init_ms, float area_ms);
-
     // Define this with empty, if you're not using gcc.
 #define PRINTF_FMT_CHECK(fmt_pos, args_pos)             \
     __attribute__ ((format (printf, fmt_pos, args_pos)))
@@ -73,13 +170,78 @@ private:
     // Send the commands to the write_line_() function, line by line.
     void SendFormattedCommands(const char *format, ...) PRINTF_FMT_CHECK(2, 3);
 
+    // Like SendFormattedCommands(), but if "macro_call" is set, that is
+    // sent instead. It takes the same parameters.
+    void SendCommandsOrMacroCall(const char *format, const char *macro_call,
+                                 ...) PRINTF_FMT_CHECK(2, 4);
+
 #undef PRINTF_FMT_CHECK
 
+    void SendLines(const char *buffer, int len);
+
+    // Feed commands to the time model of set_progress(), if any.
+    void PredictTime(const char *buffer, int len);
+
+    // Emit progress if the next report is due.
+    void ReportProgress(bool done);
+
+    bool EmergencyStopRequested() const {
+        return stop_requested_ != NULL && *stop_requested_
+            && !emergency_stop_command_.empty();
+    }
+
+    // Send line to machine connected via file descriptors and wait for
+    // it to be acknowledged.
+    void StreamLine(const char *str, size_t len);
+
+    // Milliseconds we expect until an 'ok' arrives for this line.
+    int ExpectedAckMillis(const char *str, size_t len);
+
+    // Send emergency stop command, bypassing everything else, then go to
+    // safe state. "pending_acks" are the number of 'ok's still outstanding
+    // from regular commands.
+    void EmergencyStop(int pending_acks);
+
+    // Turn off vacuum and solenoid; drop all further commands.
+    void EnterSafeState();
+
+    // Upload collected program to SD card, print and report progress.
+    void PrintFromSD();
+
     std::function<void(const char *str, size_t len)> const write_line_;
     const float init_ms_;
     const float area_ms_;
+    int input_fd_;    // Machine connection; -1 if writing to file.
+    int output_fd_;
     const PnPConfig *config_;
+    MachineProfile profile_;
     bool do_homing_;
+    bool quiet_;
+    std::string emergency_stop_command_;
+    const volatile sig_atomic_t *stop_requested_;
+    bool aborted_;
+    bool position_held_;
+    int ack_timeout_slack_ms_;
+    GCodeInterpreter interpreter_;
+    double pending_motion_sec_;   // Moves not known to be finished yet.
+    double pending_motion_update_ms_;  // When the above was last drained.
+    LinkStats link_stats_;
+    std::string link_stats_file_;
+    std::string sd_filename_;
+    std::string sd_program_;
+    bool sd_printing_;
+    const MacroDialect *macros_;
+    std::string macro_definitions_;   // Generated from gcode_pick/place.
+    std::string pick_call_;
+    std::string place_call_;
+    std::string macro_expansion_; // Commands the macro call stands for.
+    JobTimeEstimator *progress_estimator_;
+    ProgressStyle progress_style_;
+    float progress_interval_sec_;
+    double progress_total_sec_;
+    double next_progress_sec_;
+    JobStats *stats_;
+    TraceWriter *trace_;
 };
 
 // A machine simulation that just shows the oiutput in postscript.
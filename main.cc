@@ -3,9 +3,12 @@
  */
 
 #include <assert.h>
+#include <getopt.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <signal.h>
 
@@ -17,12 +20,25 @@
 #include <map>
 
 #include "board.h"
+#include "farm.h"
+#include "job-manifest.h"
+#include "job-server.h"
+#include "job-stats.h"
+#include "librpt2pnp.h"
+#include "monotonic-clock.h"
+#include "option-list.h"
 #include "tape.h"
 #include "pnp-config.h"
 #include "machine.h"
 #include "rpt-parser.h"
 #include "rpt2pnp.h"
+#include "session-recorder.h"
 #include "machine-connection.h"
+#include "machine-emulator.h"
+#include "machine-job.h"
+#include "machine-profile.h"
+#include "profile-sweep.h"
+#include "trace-writer.h"
 #include "terminal-jog-config.h"
 
 volatile sig_atomic_t interrupt_received = 0;
@@ -33,11 +49,18 @@ static void InterruptHandler(int signo) {
     interrupt_received = 1;
 }
 
-static const float minimum_milliseconds = 50;
-static const float area_to_milliseconds = 25;  // mm^2 to milliseconds.
+// Sent to the machine on Ctrl-C, ahead of any queued commands.
+static const char *const default_emergency_stop = "M410";
+
+// Parsed boards kept by --serve.
+static const int default_server_cache_boards = 32;
+
+// Extra time granted for each command to be acknowledged by the machine.
+static const int default_ack_timeout_slack_ms = 5000;
 
 static int usage(const char *prog) {
     fprintf(stderr, "Usage: %s [-l|-d|-p] <options> <rpt-file>\n"
+            "       %s --batch=<manifest> <options>\n"
             "Options:\n"
             "There are one of three operations to choose:\n"
             "[Operations. Choose one of these]\n"
@@ -45,12 +68,82 @@ static int usage(const char *prog) {
             "\t-p      : Pick'n place.\n"
             "\t-l      : Create BOM list <footprint>@<component> <count>\n"
             "\t          from parts found in rpt to stdout.\n"
+            "\t--batch=<manifest>: Run the jobs listed in manifest "
+            "concurrently,\n"
+            "\t          one per line: <rpt-file> <d|p>[b] <config|homer:"
+            "<file>|->\n"
+            "\t          [<option>=<value> ...]\n"
+            "\t          <gcode|ps|estimate|motion>:<output-file> ...\n"
+            "\t--serve=<socket>: Keep running and do jobs requested on this "
+            "Unix\n"
+            "\t          socket, keeping the last %d boards parsed.\n"
+            "\t--client=<socket>: Let the server on socket do the job of "
+            "-d or -p.\n"
             "\n[Output]\n"
             "\tDefault output is gcode to stdout\n"
             "\t-P      : Preview: Output as PostScript instead of GCode.\n"
+            "\t-e<opts>: Estimate job time instead of GCode output.\n"
+            "\t          Optional comma-separated machine profile values,\n"
+            "\t          e.g. -espeed-z=10,accel-z=200\n"
+            "\t--motion: Report travel, Z cycles, rotation and move lengths "
+            "per\n"
+            "\t          part kind and tape instead of GCode output.\n"
             "\t-O<file>: Output to specified file instead of stdout\n"
+            "\t--place-output=<file>: With both -d and -p: write the pick'n "
+            "place\n"
+            "\t          output here, dispensing to -O. Both are generated\n"
+            "\t          concurrently from the same board and config.\n"
+            "\t--stats[=<file>]: Time, CPU and counts per phase and peak "
+            "memory\n"
+            "\t          on stderr, or as JSON to file.\n"
+            "\t--trace=<file>: Timeline of phases, steps and lines sent to "
+            "the\n"
+            "\t          machine as trace events for Perfetto or "
+            "chrome://tracing.\n"
+            "\t-i<style>[,<sec>]: Progress in G-code every <sec> seconds "
+            "of\n"
+            "\t          predicted machine time (default: %d): m73 (M73 "
+            "P.. R..)\n"
+            "\t          or m117 (message on display).\n"
             "\t-m<tty> : Directly connect to machine. "
             "Sample \"/dev/ttyACM0,b115200\"\n"
+            "\t          or TCP \"hostname:port\"\n"
+            "\t-V<opts>: Benchmark against emulated machine instead of -m.\n"
+            "\t          Optional comma-separated options, e.g. -Vspeed=10\n"
+            "\t          planner=<moves>,rx=<bytes>,baud=<rate>,speed=<factor>\n"
+            "\t          overhead=<ms>,resend=<p>,busy=<p>,busy-ms=<ms>,"
+            "drop=<p>\n"
+            "\t          tcp=<port> (connect over TCP on 127.0.0.1 instead "
+            "of a tty)\n"
+            "\t--boards=<n>: With -m or -V: do the job on <n> boards, one\n"
+            "\t          after the other. Several -m or -V share the boards\n"
+            "\t          among the machines (default: one board each).\n"
+            "\t--board-change=<prompt|none>: Before a machine starts on\n"
+            "\t          another board, ask to put it in place (default\n"
+            "\t          unless all machines are emulated), or don't.\n"
+            "\t-M<dialect>: Define pick and place as firmware macros, so\n"
+            "\t          that each is a single line: rrf (RepRapFirmware),\n"
+            "\t          klipper\n"
+            "\t-K<file>: With -m: checkpoint file, updated after each "
+            "acknowledged\n"
+            "\t          pick'n place or dispensed pad.\n"
+            "\t-R      : Resume job from checkpoint given with -K.\n"
+            "\t-w<file>: With -m: record everything sent to and received "
+            "from\n"
+            "\t          the machine, with timestamps.\n"
+            "\t-r<file>: Instead of -m: replay machine responses recorded "
+            "with -w.\n"
+            "\t-U<name>: With -m: upload program to SD card of machine as\n"
+            "\t          <name> (e.g. RPT2PNP.GCO) and print from there.\n"
+            "\t-Q      : With -m: probe how many lines/s the machine link\n"
+            "\t          sustains, then exit. No rpt-file needed.\n"
+            "\t-E<gcode>: Emergency stop command sent to machine on Ctrl-C\n"
+            "\t          (default: %s). \"-Enone\" to finish current step.\n"
+            "\t-L<file>: With -m: write machine link latency statistics as "
+            "JSON.\n"
+            "\t-T<ms>  : With -m: slack on top of expected command duration\n"
+            "\t          before machine is considered stalled (default: %d).\n"
+            "\t          0 waits forever.\n"
             "\n[Choice of components to handle]\n"
             "\t-b      : Handle back-of-board (default: front)\n"
             "\t-x<list>: Comma-separated list of component references "
@@ -60,13 +153,23 @@ static int usage(const char *prog) {
             "\t-t          : Create human-editable config template to "
             "stdout\n"
             "\t-c <config> : read such a config\n"
+            "\t-k <profile>: machine profile with speeds, accelerations,\n"
+            "\t            clearances, dwell times (see README).\n"
+            "\t-S<ranges>: Find the fastest machine profile within bounds,\n"
+            "\t            e.g. -Spnp-hover=3:10:4,speed-z=5:20 "
+            "(<key>=<min>:<max>[:<steps>]).\n"
+            "\t            Writes the best profile to output.\n"
+            "\t-j<threads>: Threads used for -S, --batch and --serve (default: "
+            "one per CPU).\n"
             "\t-D<init-ms,area-to-ms> : Milliseconds to leave pressure on to\n"
             "\t            dispense. init-ms is initial offset, area-to-ms is\n"
             "\t            milliseconds per mm^2 area covered.\n"
             "\n[Homer config]\n"
             "\t-H          : Create homer configuration template to stdout.\n"
             "\t-C <config> : Use homer config created via homer from -H\n",
-            prog);
+            prog, prog, default_server_cache_boards,
+            DEFAULT_PROGRESS_INTERVAL_SEC, default_emergency_stop,
+            default_ack_timeout_slack_ms);
     return 1;
 }
 
@@ -104,7 +207,7 @@ void CreateConfigTemplate(const Board& board) {
     printf("Board:\norigin: %.0f %.0f 1.6 # x/y/z origin of the board; (z=thickness).\n\n", origin_x, origin_y);
 
     printf("# Where the tray with all the tapes start.\n");
-    printf("Tape-Tray-Origin: 0 %.1f 0\n\n", origin_y + board.dimension().h);
+    printf("Tape-Tray-Origin: 0 %.1f 0\n\n", origin_y + board.dimension().h());
 
     printf("# This template provides one <footprint>@<component> per tape,\n");
     printf("# but if you have multiple components that are indeed the same\n");
@@ -129,8 +232,9 @@ void CreateConfigTemplate(const Board& board) {
         const auto found_count = components.find(key);
         if (found_count == components.end())
             continue; // already printed
-        int width = abs(part->bounding_box.p1.x - part->bounding_box.p0.x) + 5;
-        int height = abs(part->bounding_box.p1.y - part->bounding_box.p0.y);
+        const Box &box = part->bounding_box;
+        int width = abs(box.p1.x_um - box.p0.x_um) / 1000 + 5;
+        int height = abs(box.p1.y_um - box.p0.y_um) / 1000;
         printf("\nTape: %s\n", key.c_str());
         printf("count: %d\n", found_count->second);
         printf("origin:  %d %d 2 # fill me\n", 10 + height/2, ypos + width/2);
@@ -171,93 +275,48 @@ void CreateHomerInstruction(const Board &board) {
         printf("board:%s\tfind component center on board (bottom left)\n",
                board_part->component_name.c_str());
     }
-    board_part = FindPartClosestTo(board.parts(), Position(board.dimension().w,
-                                                           board.dimension().h));
+    board_part = FindPartClosestTo(board.parts(),
+                                   Position(board.dimension().w(),
+                                            board.dimension().h()));
     if (board_part) {
         printf("board:%s\tfind component center on board (top right)\n",
                board_part->component_name.c_str());
     }
 }
 
-void SolderDispense(const Board &board, Machine *machine) {
-    OptimizeList all_pads;
-    for (const Part *part : board.parts()) {
-        for (const Pad &pad : part->pads) {
-            all_pads.push_back(std::make_pair(part, &pad));
-        }
-    }
-    OptimizeParts(&all_pads);
-
-    for (const auto &p : all_pads) {
-        if (interrupt_received)
-            break;
-        machine->Dispense(*p.first, *p.second);
-    }
+// Files are sent to the server of --client with their absolute path.
+static std::string AbsolutePath(const char *filename) {
+    char *path = realpath(filename, NULL);
+    const std::string result = path ? path : filename;
+    free(path);
+    return result;
 }
 
-static Tape *FindTapeForPart(const PnPConfig *config, const Part *part) {
-    const std::string key = part->footprint + "@" + part->value;
-    auto found = config->tape_for_component.find(key);
-    if (found == config->tape_for_component.end())
-        return NULL;
-    return found->second;
+// No SA_RESTART: a pending read from the machine is interrupted so that
+// an emergency stop can go out right away.
+static void InstallInterruptHandler() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = InterruptHandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
 }
 
-struct ComponentHeightComparator {
-    ComponentHeightComparator(const PnPConfig *config) : config_(config) {}
-
-    bool operator()(const Part *a, const Part *b) {
-        if (a == b) return 0;
-        const float a_height = GetHeight(a);
-        const float b_height = GetHeight(b);
-        if (a_height == b_height) {
-            return a->component_name < b->component_name;
-        }
-        return a_height < b_height;
-    }
-
-    float GetHeight(const Part *part) {
-        const Tape *tape = FindTapeForPart(config_, part);
-        return tape == NULL ? -1 : tape->height();
-    }
-    const PnPConfig *config_;
-};
-void PickNPlace(const PnPConfig *config, const Board &board, Machine *machine) {
-    // TODO: lowest height components first to not knock over bigger ones.
-    std::vector<const Part *> list(board.parts());
-    if (config) {
-        std::sort(list.begin(), list.end(), ComponentHeightComparator(config));
+// Print table of --stats or write it as JSON to "filename". Returns 'false'
+// and prints an error if it can't be written.
+static bool ReportJobStats(const JobStats *stats, const std::string &filename) {
+    if (stats == NULL)
+        return true;
+    if (filename.empty()) {
+        stats->PrintSummary(stderr);
+        return true;
     }
-    for (const Part *part : list) {
-        if (interrupt_received)
-            break;
-
-        Tape *tape = NULL;
-        if (config) {
-            tape = FindTapeForPart(config, part);
-            if (tape == NULL) {
-                fprintf(stderr, "No tape for '%s'\n",
-                        part->component_name.c_str());
-            }
-        }
-        machine->PickPart(*part, tape);
-        machine->PlacePart(*part, tape);
-        if (tape) tape->Advance();
+    if (!stats->WriteJson(filename)) {
+        fprintf(stderr, "Couldn't write --stats to %s\n", filename.c_str());
+        return false;
     }
-}
-
-std::set<std::string> ParseCommaSeparated(const char *start) {
-    // TODO: use absl::StrSplit instead.
-    std::set<std::string> result;
-    const char *end;
-    while ((end = strchr(start, ',')) != NULL) {
-        if (end > start)  // ignore empty strings.
-            result.insert(std::string(start, end - start));
-        start = end + 1;
-    }
-    std::string last(start);
-    if (!last.empty()) result.insert(last);
-    return result;
+    return true;
 }
 
 int main(int argc, char *argv[]) {
@@ -270,14 +329,11 @@ int main(int argc, char *argv[]) {
         OP_HOMER_INSTRUCTION,
     } do_operation = OP_NONE;
 
-    enum OutputOption {
-        OUT_POSTSCRIPT,
-        OUT_GCODE,
-        OUT_MACHINE,
-    } out_option = OUT_GCODE;
+    OutputFormat out_format = OUTPUT_GCODE;
+    bool to_machine = false;
 
-    float start_ms = minimum_milliseconds;
-    float area_ms = area_to_milliseconds;
+    float start_ms = -1;   // From machine profile unless given with -D
+    float area_ms = -1;
     const char *config_filename = NULL;
     const char *simple_config_filename = NULL;
     bool handle_top_of_board = true;
@@ -285,12 +341,108 @@ int main(int argc, char *argv[]) {
     std::set<std::string> blacklist;
     FILE *output = NULL;
     int tty_fd = -1;
+    std::string emergency_stop = default_emergency_stop;
+    std::string link_stats_file;
+    int ack_timeout_slack_ms = default_ack_timeout_slack_ms;
+    bool do_link_probe = false;
+    MachineEmulator *emulator = NULL;
+    std::vector<MachineEmulator*> emulators;
+    std::vector<FarmMachine> machines;
+    int farm_boards = 0;
+    std::string board_change;
+    std::string sd_filename;
+    std::string macro_dialect;
+    std::string checkpoint_file;
+    bool do_resume = false;
+    std::string record_file;
+    SessionReplay *replay = NULL;
+    std::string profile_filename;
+    std::string profile_options;
+    std::string sweep_spec;
+    int sweep_threads = 0;
+    std::string progress_spec;
+    bool print_stats = false;
+    std::string stats_file;
+    std::string trace_file;
+    std::string batch_manifest;
+    std::string serve_socket;
+    std::string client_socket;
+    bool dispense_given = false, pnp_given = false;
+    FILE *place_output = NULL;
+
+    enum LongOptions {
+        OPT_STATS = 1000,
+        OPT_TRACE,
+        OPT_MOTION,
+        OPT_PLACE_OUTPUT,
+        OPT_BATCH,
+        OPT_SERVE,
+        OPT_CLIENT,
+        OPT_BOARDS,
+        OPT_BOARD_CHANGE,
+    };
+    static const struct option long_options[] = {
+        { "stats", optional_argument, NULL, OPT_STATS },
+        { "trace", required_argument, NULL, OPT_TRACE },
+        { "motion", no_argument, NULL, OPT_MOTION },
+        { "place-output", required_argument, NULL, OPT_PLACE_OUTPUT },
+        { "batch", required_argument, NULL, OPT_BATCH },
+        { "serve", required_argument, NULL, OPT_SERVE },
+        { "client", required_argument, NULL, OPT_CLIENT },
+        { "boards", required_argument, NULL, OPT_BOARDS },
+        { "board-change", required_argument, NULL, OPT_BOARD_CHANGE },
+        { NULL, 0, NULL, 0 },
+    };
 
     int opt;
-    while ((opt = getopt(argc, argv, "Pc:C:D:tlHpdbx:O:m:a")) != -1) {
+    while ((opt = getopt_long(argc, argv, "Pc:C:D:tlHpdbx:O:m:aE:L:T:QV::U:M:K:Rw:r:e::k:S:j:i:", long_options, NULL)) != -1) {
         switch (opt) {
+        case OPT_STATS:
+            print_stats = true;
+            stats_file = optarg ? optarg : "";
+            break;
+        case OPT_TRACE:
+            trace_file = optarg;
+            break;
+        case OPT_MOTION:
+            out_format = OUTPUT_MOTION_REPORT;
+            break;
+        case OPT_BATCH:
+            batch_manifest = optarg;
+            break;
+        case OPT_SERVE:
+            serve_socket = optarg;
+            break;
+        case OPT_CLIENT:
+            client_socket = optarg;
+            break;
+        case OPT_BOARDS:
+            farm_boards = atoi(optarg);
+            if (farm_boards <= 0) {
+                fprintf(stderr, "Invalid --boards count\n");
+                return usage(argv[0]);
+            }
+            break;
+        case OPT_BOARD_CHANGE:
+            if (strcmp(optarg, "prompt") != 0 && strcmp(optarg, "none") != 0) {
+                fprintf(stderr, "--board-change is prompt or none\n");
+                return usage(argv[0]);
+            }
+            board_change = optarg;
+            break;
+        case OPT_PLACE_OUTPUT:
+            place_output = fopen(optarg, "w");
+            if (place_output == NULL) {
+                perror("Couldn't open requested output file for write");
+                return 1;
+            }
+            break;
         case 'P':
-            out_option = OUT_POSTSCRIPT;
+            out_format = OUTPUT_POSTSCRIPT;
+            break;
+        case 'e':
+            profile_options = optarg ? optarg : "";
+            out_format = OUTPUT_ESTIMATE;
             break;
         case 'm':
             tty_fd = OpenMachineConnection(optarg);
@@ -299,7 +451,33 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             DiscardPendingInput(tty_fd, 1000);  // Start with clean slate.
-            out_option = OUT_MACHINE;
+            machines.push_back({ optarg, tty_fd });
+            to_machine = true;
+            break;
+        case 'V': {
+            MachineEmulator::Options emulator_options;
+            if (!MachineEmulator::ParseOptions(optarg, &emulator_options))
+                return usage(argv[0]);
+            emulator = new MachineEmulator(emulator_options);
+            if (!emulator->Start())
+                return 1;
+            tty_fd = OpenMachineConnection(emulator->device().c_str());
+            if (tty_fd < 0)
+                return 1;
+            emulators.push_back(emulator);
+            machines.push_back({ emulator->device(), tty_fd });
+            to_machine = true;
+            break;
+        }
+        case 'r':
+            replay = new SessionReplay(optarg);
+            if (!replay->Start())
+                return 1;
+            tty_fd = replay->host_fd();
+            to_machine = true;
+            break;
+        case 'w':
+            record_file = optarg;
             break;
         case 'c':
             config_filename = strdup(optarg);
@@ -307,6 +485,24 @@ int main(int argc, char *argv[]) {
         case 'C':
             simple_config_filename = strdup(optarg);
             break;
+        case 'k':
+            profile_filename = optarg;
+            break;
+        case 'i': {
+            GCodeMachine::ProgressStyle style;
+            float interval_sec;
+            if (!GCodeMachine::ParseProgressSpec(optarg, &style,
+                                                 &interval_sec))
+                return usage(argv[0]);
+            progress_spec = optarg;
+            break;
+        }
+        case 'S':
+            sweep_spec = optarg;
+            break;
+        case 'j':
+            sweep_threads = atoi(optarg);
+            break;
         case 'D':
             if (2 != sscanf(optarg, "%f,%f", &start_ms, &area_ms)) {
                 fprintf(stderr, "Invalid -D spec\n");
@@ -323,6 +519,30 @@ int main(int argc, char *argv[]) {
         case 'a':
             do_origin_finder = true;
             break;
+        case 'E':
+            emergency_stop = (strcmp(optarg, "none") == 0) ? "" : optarg;
+            break;
+        case 'L':
+            link_stats_file = optarg;
+            break;
+        case 'T':
+            ack_timeout_slack_ms = atoi(optarg);
+            break;
+        case 'Q':
+            do_link_probe = true;
+            break;
+        case 'U':
+            sd_filename = optarg;
+            break;
+        case 'M':
+            macro_dialect = optarg;
+            break;
+        case 'K':
+            checkpoint_file = optarg;
+            break;
+        case 'R':
+            do_resume = true;
+            break;
         case 't':
             do_operation = OP_CONFIG_TEMPLATE;
             break;
@@ -334,49 +554,225 @@ int main(int argc, char *argv[]) {
             break;
         case 'p':
             do_operation = OP_PICKNPLACE;
+            pnp_given = true;
             break;
         case 'd':
             do_operation = OP_DISPENSING;
+            dispense_given = true;
             break;
         case 'b':
             handle_top_of_board = false;
             break;
-        case 'x':
-            blacklist = ParseCommaSeparated(optarg);
+        case 'x': {
+            const std::vector<std::string> names = SplitCommaSeparated(optarg);
+            blacklist = std::set<std::string>(names.begin(), names.end());
             break;
+        }
         default: /* '?' */
             return usage(argv[0]);
         }
     }
 
+    // Phases are timed for --stats and shown in --trace.
+    TraceWriter *trace = NULL;
+    if (!trace_file.empty()) {
+        trace = new TraceWriter(trace_file);
+        if (!trace->Open())
+            return 1;
+        for (MachineEmulator *e : emulators) e->set_trace(trace);
+    }
+    JobStats *stats = NULL;
+    if (print_stats || trace) {
+        stats = new JobStats();
+        stats->set_trace(trace);
+    }
+
+    MachineProfile profile;
+    if (!profile_filename.empty()
+        && !ParseMachineProfile(profile_filename, &profile))
+        return 1;
+    if (!profile_options.empty()
+        && !ParseMachineProfileOptions(profile_options.c_str(), &profile))
+        return usage(argv[0]);
+    const bool dispense_times_given = (start_ms >= 0);
+    if (!dispense_times_given) {
+        start_ms = profile.dispense_init_ms;
+        area_ms = profile.dispense_area_ms;
+    }
+    std::vector<SweepRange> sweep_ranges;
+    if (!sweep_spec.empty()
+        && !ParseSweepRanges(sweep_spec.c_str(), profile, &sweep_ranges))
+        return usage(argv[0]);
+    // The best profile is to be used with -k, so tours are estimated the way
+    // they will be ordered then.
+    if (!sweep_spec.empty()) profile.from_file = true;
+
+    EmitOptions emit_options;
+    emit_options.format = out_format;
+    emit_options.start_ms = dispense_times_given ? start_ms : -1;
+    emit_options.area_ms = area_ms;
+    emit_options.macro_dialect
+        = macro_dialect.empty() ? NULL : macro_dialect.c_str();
+    emit_options.progress
+        = progress_spec.empty() ? NULL : progress_spec.c_str();
+    emit_options.stop = &interrupt_received;
+
+    if (!batch_manifest.empty()) {
+        EmitOptions job_options = emit_options;
+        job_options.quiet = true;
+        bool success;
+        {
+            JobStats::Scope emit_scope(stats, JobStats::PHASE_EMIT);
+            success = RunBatch(batch_manifest, sweep_threads, profile,
+                               job_options, trace);
+        }
+        if (!ReportJobStats(print_stats ? stats : NULL, stats_file))
+            success = false;
+        delete stats;
+        delete trace;
+        return success ? 0 : 1;
+    }
+
+    if (!serve_socket.empty()) {
+        EmitOptions job_options = emit_options;
+        job_options.quiet = true;
+        InstallInterruptHandler();
+        const bool success = ServeJobs(serve_socket, sweep_threads,
+                                       default_server_cache_boards, profile,
+                                       job_options, &interrupt_received);
+        delete stats;
+        delete trace;
+        return success ? 0 : 1;
+    }
+
+    // Several machines or boards: each machine is driven by its own thread.
+    const bool farm = (machines.size() > 1 || farm_boards > 0);
+    if (farm && (machines.empty() || replay || !record_file.empty()
+                 || do_link_probe || !checkpoint_file.empty()
+                 || !sd_filename.empty() || !link_stats_file.empty()
+                 || !sweep_spec.empty() || do_origin_finder
+                 || (dispense_given && pnp_given))) {
+        fprintf(stderr, "Several -m or -V, or --boards, need a machine "
+                "connection and can't be combined with -r, -w, -Q, -K, -U, "
+                "-L, -S, -a or -d together with -p.\n\n");
+        return usage(argv[0]);
+    }
+
+    SessionRecorder *recorder = NULL;
+    if (!record_file.empty()) {
+        if (tty_fd < 0) {
+            fprintf(stderr, "Recording -w needs a machine connection -m\n");
+            return usage(argv[0]);
+        }
+        recorder = new SessionRecorder(tty_fd, record_file);
+        if (!recorder->Start())
+            return 1;
+        tty_fd = recorder->host_fd();
+    }
+
+    if (do_link_probe) {
+        if (tty_fd < 0) {
+            fprintf(stderr, "Link probe -Q needs a machine connection -m\n");
+            return usage(argv[0]);
+        }
+        const bool success = ProbeLinkThroughput(tty_fd, 200);
+        delete recorder;
+        return success ? 0 : 1;
+    }
+
     if (optind >= argc) {
         return usage(argv[0]);
     }
 
-    if (output != NULL && out_option == OUT_MACHINE) {
+    if (output != NULL && to_machine) {
         fprintf(stderr, "Machine output is chosen with -m. "
                 "But also output file with -O. Choose only one.\n\n");
         return usage(argv[0]);
     }
 
+    if (!checkpoint_file.empty() && (!to_machine || !sd_filename.empty())) {
+        // Only streaming tells us when a step is done.
+        fprintf(stderr, "-K needs a machine connection (-m or -V) without "
+                "-U.\n\n");
+        return usage(argv[0]);
+    }
+    if (do_resume && checkpoint_file.empty()) {
+        fprintf(stderr, "-R needs the checkpoint file given with -K.\n\n");
+        return usage(argv[0]);
+    }
+
+    // Both -d and -p: two programs from one parse, written concurrently.
+    const bool combined_job = dispense_given && pnp_given;
+    if (combined_job && (place_output == NULL || to_machine
+                         || !sweep_spec.empty() || do_origin_finder)) {
+        fprintf(stderr, "-d together with -p writes the pick'n place "
+                "program to --place-output, and can't be combined with -m, "
+                "-V, -r, -S or -a.\n\n");
+        return usage(argv[0]);
+    }
+    if (place_output && !combined_job) {
+        fprintf(stderr, "--place-output needs both -d and -p.\n\n");
+        return usage(argv[0]);
+    }
+
+    if (!sd_filename.empty() && !macro_dialect.empty()) {
+        // Macros are uploaded with M28 themselves; also no need to save
+        // bytes on the wire when printing from SD card.
+        fprintf(stderr, "-M and -U can't be combined.\n\n");
+        return usage(argv[0]);
+    }
+
     if (output == NULL) {
         output = stdout;
     }
 
     const char *rpt_file = argv[optind];
 
-    Board::ReadFilter inclusion_filter
-        = [handle_top_of_board, &blacklist](const Part &part) {
-        if (part.is_front_layer != handle_top_of_board)
-            return false;
-        return blacklist.find(part.component_name) == blacklist.end();
-    };
+    if (!client_socket.empty()) {
+        if (do_operation != OP_DISPENSING && do_operation != OP_PICKNPLACE) {
+            fprintf(stderr, "--client needs -d or -p\n\n");
+            return usage(argv[0]);
+        }
+        if (combined_job || to_machine) {
+            fprintf(stderr, "--client does one job written to -O or "
+                    "stdout.\n\n");
+            return usage(argv[0]);
+        }
+        // The server might run in another directory.
+        BatchJob job;
+        job.rpt_file = AbsolutePath(rpt_file);
+        job.dispensing = (do_operation == OP_DISPENSING);
+        job.back_of_board = !handle_top_of_board;
+        if (config_filename) {
+            job.config_file = AbsolutePath(config_filename);
+        } else if (simple_config_filename) {
+            job.config_file = AbsolutePath(simple_config_filename);
+            job.homer_config = true;
+        }
+        // Options that change the output go along with the job.
+        job.exclude = blacklist;
+        if (dispense_times_given) {
+            job.start_ms = start_ms;
+            job.area_ms = area_ms;
+        }
+        job.macro_dialect = macro_dialect;
+        job.progress = progress_spec;
+        if (!profile_filename.empty())
+            job.profile_file = AbsolutePath(profile_filename.c_str());
+        job.profile_options = profile_options;
+        job.outputs.push_back({ out_format, "" });
+        const bool success = SendRequest(client_socket, FormatJobLine(job),
+                                         output);
+        if (output != stdout) fclose(output);
+        return success ? 0 : 1;
+    }
 
-    Board board;
-    if (!board.ParseFromRpt(rpt_file, inclusion_filter))
+    const std::shared_ptr<Board> board
+        = LoadBoard(rpt_file, handle_top_of_board, blacklist, stats);
+    if (board == NULL)
         return 1;
     fprintf(stderr, "Board: %s, %.1fmm x %.1fmm\n",
-            rpt_file, board.dimension().w, board.dimension().h);
+            rpt_file, board->dimension().w(), board->dimension().h());
 
     /*
      * Simple operations: output some metadata.
@@ -386,13 +782,13 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Please choose operation with -d or -p\n");
         return usage(argv[0]);
     case OP_CONFIG_TEMPLATE:
-        CreateConfigTemplate(board);
+        CreateConfigTemplate(*board);
         return 0;
     case OP_CONFIG_LIST:
-        CreateList(board.parts());
+        CreateList(board->parts());
         return 0;
     case OP_HOMER_INSTRUCTION:
-        CreateHomerInstruction(board);
+        CreateHomerInstruction(*board);
         return 0;
 
     case OP_DISPENSING:
@@ -403,65 +799,134 @@ int main(int argc, char *argv[]) {
         break;
     }
 
-    PnPConfig *config = NULL;
-
+    std::shared_ptr<PnPConfig> config;
     if (config_filename != NULL) {
-        config = ParsePnPConfiguration(config_filename);
+        config = LoadConfig(config_filename, false, *board, stats);
     }
     else if (simple_config_filename != NULL) {
-        config = ParseSimplePnPConfiguration(board, simple_config_filename);
+        config = LoadConfig(simple_config_filename, true, *board, stats);
     }
-    else if (do_operation == OP_DISPENSING) {
-        // Only in the dispensing operation, a very simple config is feasible.
+    else if (do_operation == OP_DISPENSING || combined_job) {
+        // Only in the dispensing operation, a very simple config is
+        // feasible.
         fprintf(stderr, "Didn't get configuration. Creating a simple one "
                 "for dispensing\n");
-        config = CreateEmptyConfiguration();
+        config.reset(CreateEmptyConfiguration());
     }
 
-    if (do_origin_finder) {
-        if (!TerminalJogConfig(board, tty_fd, config))
-            return 1;
-    }
-
-    Machine *machine = NULL;
-    switch (out_option) {
-    case OUT_GCODE:
-        machine = new GCodeMachine(output, start_ms, area_ms);
-        break;
-    case OUT_POSTSCRIPT:
-        machine = new PostScriptMachine(output);
-        break;
-    case OUT_MACHINE:
-        machine = new GCodeMachine(tty_fd, tty_fd, start_ms, area_ms);
-        if (do_origin_finder) {
-            // If we manually found the origin, don't do unnecessary homing.
-            static_cast<GCodeMachine*>(machine)->set_homing(false);
-        }
-        break;
-    }
-
-    signal(SIGTERM, InterruptHandler);
-    signal(SIGINT, InterruptHandler);
-
     std::string all_args;
     for (int i = 0; i < argc; ++i) {
         all_args.append(argv[i]).append(" ");
     }
-    if (!machine->Init(config, all_args, board.dimension())) {
-        fprintf(stderr, "Initialization failed\n");
-        return 1;
-    }
-
-    if (do_operation == OP_DISPENSING) {
-        SolderDispense(board, machine);
+    if (!progress_spec.empty() && out_format != OUTPUT_GCODE) {
+        fprintf(stderr, "-i only applies to G-code output.\n");
+        emit_options.progress = NULL;
     }
-    else if (do_operation == OP_PICKNPLACE) {
-        PickNPlace(config, board, machine);
+    if (!macro_dialect.empty() && out_format == OUTPUT_POSTSCRIPT)
+        fprintf(stderr, "-M only applies to G-code output.\n");
+
+    bool success;
+    const bool dispensing = (do_operation == OP_DISPENSING);
+    if (combined_job) {
+        // Both are planned and written in parallel, so this is all the
+        // emit phase.
+        InstallInterruptHandler();
+        EmitOptions job_options = emit_options;
+        job_options.trace = trace;
+        {
+            JobStats::Scope emit_scope(stats, JobStats::PHASE_EMIT);
+            success = EmitDispenseAndPlace(*board, config.get(), profile,
+                                           job_options, all_args,
+                                           FileSink(output),
+                                           FileSink(place_output));
+        }
+        fclose(place_output);
+    } else if (!sweep_spec.empty()) {
+        EmitOptions job_options = emit_options;
+        job_options.trace = trace;
+        MachineProfile best;
+        {
+            JobStats::Scope optimize_scope(stats, JobStats::PHASE_OPTIMIZE);
+            SweepJobProfile(dispensing, *board, config.get(), profile,
+                            sweep_ranges, job_options, sweep_threads, &best);
+        }
+        best.Write(output);
+        success = true;
+    } else if (do_origin_finder
+               && !TerminalJogConfig(*board, tty_fd, config.get())) {
+        success = false;
+    } else {
+        JobPlan plan;
+        {
+            JobStats::Scope optimize_scope(stats, JobStats::PHASE_OPTIMIZE);
+            plan = dispensing ? JobPlan::Dispense(*board, profile)
+                : JobPlan::PickNPlace(*board, config.get());
+        }
+        emit_options.stats = stats;
+        emit_options.trace = trace;
+        InstallInterruptHandler();
+        if (farm) {
+            FarmOptions farm_options;
+            farm_options.job = emit_options;
+            farm_options.job.stats = NULL;   // Not thread-safe.
+            farm_options.emergency_stop = emergency_stop;
+            farm_options.ack_timeout_slack_ms = ack_timeout_slack_ms;
+            // Boards on real machines are changed by the operator.
+            const bool prompt = !board_change.empty()
+                ? board_change == "prompt"
+                : emulators.size() < machines.size();
+            if (prompt) {
+                farm_options.board_ready
+                    = PromptBoardChange(machines, &interrupt_received);
+            }
+            const double farm_start = GetMonotonicSeconds();
+            {
+                JobStats::Scope emit_scope(stats, JobStats::PHASE_EMIT);
+                success = RunFarm(machines, farm_boards > 0
+                                  ? farm_boards : machines.size(),
+                                  plan, *board, config.get(), profile,
+                                  farm_options, all_args);
+            }
+            const double farm_seconds = GetMonotonicSeconds() - farm_start;
+            for (size_t i = 0; i < emulators.size(); ++i) {
+                const std::string name = "Emulated machine "
+                    + std::to_string(i + 1);
+                MachineEmulator::PrintStats(name.c_str(), emulators[i]->Stop(),
+                                            farm_seconds);
+            }
+        } else if (!to_machine) {
+            JobStats::Scope emit_scope(stats, JobStats::PHASE_EMIT);
+            success = EmitJob(plan, *board, config.get(), profile,
+                              emit_options, all_args, FileSink(output));
+        } else {
+            StreamOptions stream_options;
+            stream_options.job = emit_options;
+            stream_options.emergency_stop = emergency_stop;
+            stream_options.ack_timeout_slack_ms = ack_timeout_slack_ms;
+            // If we manually found the origin, don't do unnecessary homing.
+            stream_options.homing = !do_origin_finder;
+            stream_options.sd_filename = sd_filename;
+            stream_options.link_stats_file = link_stats_file;
+            stream_options.checkpoint_file = checkpoint_file;
+            stream_options.resume = do_resume;
+            double job_seconds = 0;
+            success = StreamJob(tty_fd, plan, *board, config.get(), profile,
+                                stream_options, all_args, &job_seconds);
+            if (emulator) {
+                MachineEmulator::PrintStats("Emulated machine",
+                                            emulator->Stop(), job_seconds);
+            }
+            if (replay)
+                SessionReplay::PrintStats(replay->Stop(), job_seconds);
+        }
     }
 
-    machine->Finish();
-
-    delete machine;
-    delete config;
-    return 0;
+    if (!ReportJobStats(print_stats ? stats : NULL, stats_file))
+        success = false;
+    for (MachineEmulator *e : emulators) delete e;  // Might use the trace.
+    delete replay;
+    delete recorder;
+    delete stats;
+    delete trace;
+    return success ? 0 : 1;
 }
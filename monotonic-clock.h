@@ -0,0 +1,17 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Time on the monotonic clock, for durations and timeouts that don't jump
+ * when the wall clock is set.
+ */
+
+#ifndef MONOTONIC_CLOCK_H
+#define MONOTONIC_CLOCK_H
+
+#include <stdint.h>
+
+double GetMonotonicSeconds();
+double GetMonotonicMillis();
+int64_t GetMonotonicUsec();
+
+#endif  // MONOTONIC_CLOCK_H
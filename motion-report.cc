@@ -0,0 +1,124 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "motion-report.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+typedef GCodeInterpreter G;
+
+// Upper limits of the move length buckets in mm; the last is open.
+static const float kLengthBuckets[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500 };
+static const int kNumLengthBuckets
+    = sizeof(kLengthBuckets) / sizeof(kLengthBuckets[0]);
+
+// Groups without part: setup and finish of the job.
+static const char kNoGroup[] = "(setup/finish)";
+
+MotionReport::MotionReport(float angle_factor)
+    : angle_factor_(angle_factor), last_z_direction_(0),
+      current_kind_(NULL), current_tape_(NULL) {
+    SetGroup("", "");
+}
+
+void MotionReport::SetGroup(const std::string &part_kind,
+                            const std::string &tape) {
+    current_kind_ = &by_kind_[part_kind.empty() ? kNoGroup : part_kind];
+    current_tape_ = tape.empty() ? NULL : &by_tape_[tape];
+}
+
+void MotionReport::AddLine(const char *line, size_t len) {
+    std::vector<G::Step> steps;
+    interpreter_.Interpret(line, len, &steps);
+    for (const G::Step &step : steps) {
+        if (step.kind == G::Step::MOVE)
+            AddMove(step);
+    }
+}
+
+void MotionReport::AddMove(const G::Step &step) {
+    const double xy = hypot(step.delta[G::AXIS_X], step.delta[G::AXIS_Y]);
+    const double z = fabs(step.delta[G::AXIS_Z]);
+    const double rotation = fabs(step.delta[G::AXIS_E]);
+    const double length = sqrt(xy * xy + z * z);
+    if (length == 0 && rotation == 0)
+        return;
+
+    // Going up after going down completes a Z cycle.
+    bool z_cycle = false;
+    if (step.delta[G::AXIS_Z] != 0) {
+        const int direction = step.delta[G::AXIS_Z] > 0 ? 1 : -1;
+        z_cycle = (direction > 0 && last_z_direction_ < 0);
+        last_z_direction_ = direction;
+    }
+
+    Motion *const motions[] = { &total_, current_kind_, current_tape_ };
+    for (Motion *m : motions) {
+        if (m == NULL) continue;
+        m->moves++;
+        m->xy += xy;
+        m->z += z;
+        m->rotation += rotation;
+        m->z_cycles += z_cycle;
+        m->longest = std::max(m->longest, length);
+    }
+    if (length > 0) {
+        const int bucket = std::upper_bound(kLengthBuckets,
+                                            kLengthBuckets + kNumLengthBuckets,
+                                            length) - kLengthBuckets;
+        length_histogram_[bucket]++;
+    }
+}
+
+void MotionReport::PrintTable(FILE *out, const char *title,
+                              const MotionByName &motions) const {
+    size_t longest_name = strlen(title);
+    for (const auto &m : motions)
+        longest_name = std::max(longest_name, m.first.length());
+    fprintf(out, "%-*s %6s %10s %9s %8s %9s %11s\n", (int)longest_name,
+            title, "moves", "xy[mm]", "z[mm]", "z-cycles", "rot[deg]",
+            "longest[mm]");
+    for (const auto &p : motions) {
+        const Motion &m = p.second;
+        if (m.moves == 0) continue;
+        fprintf(out, "%-*s %6ld %10.1f %9.1f %8ld %9.1f %11.1f\n",
+                (int)longest_name, p.first.c_str(), m.moves, m.xy, m.z,
+                m.z_cycles, angle_factor_ > 0 ? m.rotation / angle_factor_ : 0,
+                m.longest);
+    }
+}
+
+void MotionReport::Print(FILE *out) const {
+    fprintf(out, "Motion: %ld moves; XY %.1fmm, Z %.1fmm in %ld Z cycles, "
+            "rotation %.1fdeg; longest move %.1fmm\n", total_.moves,
+            total_.xy, total_.z, total_.z_cycles,
+            angle_factor_ > 0 ? total_.rotation / angle_factor_ : 0,
+            total_.longest);
+
+    fprintf(out, "\nMove length (XYZ)   moves\n");
+    for (const auto &h : length_histogram_) {
+        char range[32];
+        if (h.first == 0) {
+            snprintf(range, sizeof(range), "< %gmm", kLengthBuckets[0]);
+        } else if (h.first == kNumLengthBuckets) {
+            snprintf(range, sizeof(range), ">= %gmm",
+                     kLengthBuckets[kNumLengthBuckets - 1]);
+        } else {
+            snprintf(range, sizeof(range), "%g..%gmm",
+                     kLengthBuckets[h.first - 1], kLengthBuckets[h.first]);
+        }
+        fprintf(out, "  %-16s %7ld\n", range, h.second);
+    }
+
+    fprintf(out, "\n");
+    PrintTable(out, "part kind", by_kind_);
+    if (!by_tape_.empty()) {
+        fprintf(out, "\n");
+        PrintTable(out, "tape", by_tape_);
+    }
+}
@@ -0,0 +1,61 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * How much the machine moves for a job, from the G-code sent to it.
+ */
+
+#ifndef MOTION_REPORT_H
+#define MOTION_REPORT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+
+#include "gcode-interpreter.h"
+
+// Travel in XY and Z, Z cycles (down and up again), rotation and the
+// longest move, for the whole job and broken down per part kind
+// (footprint@value) and per tape. Also the distribution of move lengths.
+class MotionReport {
+public:
+    // "angle_factor" are E-axis units per degree of rotation.
+    explicit MotionReport(float angle_factor);
+
+    // Following lines belong to a step handling this kind of part from
+    // this tape; empty for setup or finish, or if there is no tape.
+    void SetGroup(const std::string &part_kind, const std::string &tape);
+
+    // Add a line of G-code.
+    void AddLine(const char *line, size_t len);
+
+    void Print(FILE *out) const;
+
+private:
+    struct Motion {
+        long moves = 0;
+        double xy = 0;           // mm
+        double z = 0;            // mm
+        long z_cycles = 0;
+        double rotation = 0;     // E-axis units
+        double longest = 0;      // mm
+    };
+    typedef std::map<std::string, Motion> MotionByName;
+
+    void AddMove(const GCodeInterpreter::Step &step);
+    void PrintTable(FILE *out, const char *title,
+                    const MotionByName &motions) const;
+
+    const float angle_factor_;
+    GCodeInterpreter interpreter_;
+    int last_z_direction_;       // -1 down, 1 up, 0: not moved yet.
+    Motion total_;
+    MotionByName by_kind_;
+    MotionByName by_tape_;
+    Motion *current_kind_;
+    Motion *current_tape_;
+    std::map<int, long> length_histogram_;  // bucket -> moves
+};
+
+#endif  // MOTION_REPORT_H
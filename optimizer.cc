@@ -8,41 +8,114 @@
 #include "rpt2pnp.h"
 
 #include <math.h>
+#include <stdint.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "board.h"  // definition of Part
+#include "machine-profile.h"
 
 static float euklid(float a, float b) { return sqrtf(a*a + b*b); }
 float Distance(const Position& a, const Position& b) {
-    return euklid(a.x - b.x, a.y - b.y);
+    return euklid(ToMillimeters(a.x_um - b.x_um),
+                  ToMillimeters(a.y_um - b.y_um));
 }
-static void Swap(OptimizeList *list, size_t i, size_t j) {
-    const auto tmp = (*list)[i];
-    (*list)[i] = (*list)[j];
-    (*list)[j] = tmp;
+
+// Absolute positions of the pads in list order, one lane per coordinate in
+// micrometres. Computed once, so that the search below doesn't need any
+// trigonometry and the distance loop works on packed integers.
+// Pads at (nearly) the same distance are decided by their position in
+// float millimetres, computed as before geometry was stored in micrometres,
+// so that the order of pads doesn't change with the representation.
+struct PadLanes {
+    std::vector<Micrometers> x;
+    std::vector<Micrometers> y;
+    std::vector<float> mm_x;
+    std::vector<float> mm_y;
+
+    void Add(const Part &part, const Pad &pad) {
+        const Position pos = part.padAbsPos(pad);
+        x.push_back(pos.x_um);
+        y.push_back(pos.y_um);
+        const float angle = 2 * M_PI * part.angle / 360.0;
+        mm_x.push_back(part.pos.x() + pad.pos.x() * cos(angle)
+                       - pad.pos.y() * sin(angle));
+        mm_y.push_back(part.pos.y() + pad.pos.x() * sin(angle)
+                       + pad.pos.y() * cos(angle));
+    }
+};
+
+// Where the search starts from: a pad or the origin.
+struct Reference {
+    Micrometers x, y;
+    float mm_x, mm_y;
+};
+
+static Reference PadReference(const PadLanes &lanes, size_t i) {
+    return { lanes.x[i], lanes.y[i], lanes.mm_x[i], lanes.mm_y[i] };
 }
 
-// Extract position from part and pad. The pad is positioned relative to the
-// part, thus we need to combine these, including rotation.
-static Position ExtractPosition(const std::pair<const Part *, const Pad *> &p) {
-    const Part &part = *p.first;
-    const Pad &pad = *p.second;
-    const float angle = 2 * M_PI * part.angle / 360.0;
-    const float x = part.pos.x + pad.pos.x * cos(angle) - pad.pos.y * sin(angle);
-    const float y = part.pos.y + pad.pos.x * sin(angle) + pad.pos.y * cos(angle);
-    return Position(x, y);
+static void Swap(OptimizeList *list, PadLanes *lanes, size_t i, size_t j) {
+    std::swap((*list)[i], (*list)[j]);
+    std::swap(lanes->x[i], lanes->x[j]);
+    std::swap(lanes->y[i], lanes->y[j]);
+    std::swap(lanes->mm_x[i], lanes->mm_x[j]);
+    std::swap(lanes->mm_y[i], lanes->mm_y[j]);
 }
 
-static int FindSmallestDistanceIndex(const OptimizeList &parts,
-                                     size_t range_start,
-                                     const Position &reference_pos) {
-    float smallest_distance;
-    int best = -1;
-    for (size_t j = range_start; j < parts.size(); ++j) {
-        float distance = Distance(reference_pos, ExtractPosition(parts[j]));
-        if (best < 0 || distance < smallest_distance) {
+static size_t FindSmallestDistanceIndex(const PadLanes &lanes,
+                                        size_t range_start,
+                                        const Reference &reference,
+                                        const MachineProfile *profile,
+                                        std::vector<int64_t> *squares) {
+    // Squared distances on the packed integer lanes. Differences fit in
+    // 32 bits, their squares need 64.
+    const size_t n = lanes.x.size();
+    const Micrometers rx = reference.x, ry = reference.y;
+    const Micrometers *const x = lanes.x.data();
+    const Micrometers *const y = lanes.y.data();
+    int64_t *const square = squares->data();
+    for (size_t j = range_start; j < n; ++j) {
+        const int64_t dx = x[j] - rx;
+        const int64_t dy = y[j] - ry;
+        square[j] = dx * dx + dy * dy;
+    }
+    size_t closest = range_start;
+    for (size_t j = range_start + 1; j < n; ++j) {
+        if (square[j] < square[closest]) closest = j;
+    }
+
+    // Distance or travel time in float millimetres of the pads that could
+    // be the best. Same as going through all in order: the first of the
+    // smallest.
+    const auto cost = [&](size_t j) {
+        const float dx = lanes.mm_x[j] - reference.mm_x;
+        const float dy = lanes.mm_y[j] - reference.mm_y;
+        return profile
+            ? profile->TravelSeconds(dx, dy, profile->dispense_move_speed)
+            : euklid(dx, dy);
+    };
+    size_t best = closest;
+    float best_cost = cost(best);
+
+    // Rounding to micrometres moves pads less than a micrometre. Without
+    // profile, only pads that close to the closest distance can be the best.
+    // Travel time depends on the direction, but only pads within the
+    // distance the machine could possibly travel in the best time so far
+    // can be faster to get to.
+    const double reach = 1000 * (profile
+        ? 1.001 * profile->MaxTravelDistance(best_cost,
+                                              profile->dispense_move_speed)
+        : best_cost) + 2;
+    const int64_t reach_square = ceil(reach * reach);
+    for (size_t j = range_start; j < n; ++j) {
+        if (square[j] > reach_square || j == closest)
+            continue;
+        const float c = cost(j);
+        if (c < best_cost || (c == best_cost && j < best)) {
             best = j;
-            smallest_distance = distance;
+            best_cost = c;
         }
     }
     return best;
@@ -50,15 +123,21 @@ static int FindSmallestDistanceIndex(const OptimizeList &parts,
 
 // Very crude, O(n^2) optimization looking for nearest neighbor.
 // Not TSP solution, but better than random
-void OptimizeParts(OptimizeList *list) {
-    int left_botton_corner = FindSmallestDistanceIndex(*list, 0, Position(0,0));
-    if (left_botton_corner < 0)
+void OptimizeParts(OptimizeList *list, const MachineProfile *profile) {
+    if (list->empty())
         return;  // empty board.
-    Swap(list, 0, left_botton_corner);  // Make that our first component.
+    PadLanes lanes;
+    std::vector<int64_t> squares(list->size());
+    for (const auto &p : *list) {
+        lanes.Add(*p.first, *p.second);
+    }
+    // Make the one closest to the left bottom corner our first component.
+    Swap(list, &lanes, 0,
+         FindSmallestDistanceIndex(lanes, 0, Reference{ 0, 0, 0, 0 }, profile,
+                                   &squares));
     for (size_t i = 0; i < list->size() - 1; ++i) {
-        Swap(list,
-             i + 1, FindSmallestDistanceIndex(*list, i + 1,
-                                              ExtractPosition((*list)[i])));
+        Swap(list, &lanes, i + 1,
+             FindSmallestDistanceIndex(lanes, i + 1, PadReference(lanes, i),
+                                       profile, &squares));
     }
 }
-
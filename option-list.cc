@@ -0,0 +1,27 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "option-list.h"
+
+std::vector<std::string> SplitCommaSeparated(const std::string &list) {
+    std::vector<std::string> result;
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        if (end > pos) result.push_back(list.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return result;
+}
+
+bool SplitKeyValue(const std::string &option,
+                   std::string *key, std::string *value) {
+    const size_t eq = option.find('=');
+    if (eq == std::string::npos)
+        return false;
+    *key = option.substr(0, eq);
+    *value = option.substr(eq + 1);
+    return true;
+}
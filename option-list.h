@@ -0,0 +1,22 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Comma separated option lists as given on the command line, e.g.
+ * "R1,C3" or "speed=10,planner=16".
+ */
+
+#ifndef OPTION_LIST_H
+#define OPTION_LIST_H
+
+#include <string>
+#include <vector>
+
+// Elements of "list" in order, leaving out empty ones.
+std::vector<std::string> SplitCommaSeparated(const std::string &list);
+
+// Split "option" at the first '=' into "key" and "value". Returns 'false'
+// if there is none.
+bool SplitKeyValue(const std::string &option,
+                   std::string *key, std::string *value);
+
+#endif  // OPTION_LIST_H
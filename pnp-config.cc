@@ -10,6 +10,7 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <set>
 #include <sstream>
 #include <stdio.h>
 
@@ -18,6 +19,32 @@
 
 #define TYPICAL_BOARD_THICKNESS 1.6
 
+PnPConfig::PnPConfig(const PnPConfig &other) {
+    *this = other;
+}
+
+PnPConfig &PnPConfig::operator=(const PnPConfig &other) {
+    if (this == &other)
+        return *this;
+    PnPConfig old;   // Takes our tapes, to be deleted when done.
+    old.tape_for_component.swap(tape_for_component);
+    board = other.board;
+    bed_level = other.bed_level;
+    std::map<const Tape*, Tape*> copies;   // Shared tapes stay shared.
+    for (const auto &t : other.tape_for_component) {
+        Tape *&copy = copies[t.second];
+        if (copy == NULL) copy = new Tape(*t.second);
+        tape_for_component[t.first] = copy;
+    }
+    return *this;
+}
+
+PnPConfig::~PnPConfig() {
+    std::set<Tape*> tapes;
+    for (const auto &t : tape_for_component) tapes.insert(t.second);
+    for (Tape *tape : tapes) delete tape;
+}
+
 PnPConfig *ParsePnPConfiguration(const std::string& filename) {
     std::unique_ptr<PnPConfig> result(new PnPConfig());
 
@@ -32,6 +59,10 @@ PnPConfig *ParsePnPConfiguration(const std::string& filename) {
     float tape_tray_height = 0.0f;
 
     std::ifstream in(filename);
+    if (!in) {
+        fprintf(stderr, "Can't open %s\n", filename.c_str());
+        return NULL;
+    }
     while (!in.eof()) {
         token.clear();
         in >> token;
@@ -47,14 +78,12 @@ PnPConfig *ParsePnPConfiguration(const std::string& filename) {
             if (current_tape) current_tape = NULL;
         } else if (token == "Tape-Tray-Origin:") {
             if (current_tape) current_tape = NULL;
-            if (2 > sscanf(buffer, "%f %f %f",
-                           &tape_tray_origin.x,
-                           &tape_tray_origin.y,
-                           &tape_tray_height)) {
+            if (2 > sscanf(buffer, "%f %f %f", &x, &y, &tape_tray_height)) {
                 fprintf(stderr, "%s:%d: Parse problem tape-tray origin: '%s'\n",
                         filename.c_str(), line, buffer);
                 return NULL;
             }
+            tape_tray_origin.Set(x, y);
         } else if (token == "Tape:") {
             current_tape = new Tape();
             current_tape->SetAngle(90);
@@ -74,19 +103,17 @@ PnPConfig *ParsePnPConfiguration(const std::string& filename) {
                             filename.c_str(), line, buffer);
                     return NULL;
                 }
+                const Position pos = Position(x, y) + tape_tray_origin;
                 current_tape->SetFirstComponentPosition(
-                    x + tape_tray_origin.x,
-                    y + tape_tray_origin.y,
-                    z + tape_tray_height);
+                    pos.x(), pos.y(), z + tape_tray_height);
             } else {
-                if (2 > sscanf(buffer, "%f %f %f",
-                               &result->board.origin.x,
-                               &result->board.origin.y,
+                if (2 > sscanf(buffer, "%f %f %f", &x, &y,
                                &result->board.top)) {  // optional top
                     fprintf(stderr, "%s:%d: Parse problem board origin: '%s'\n",
                             filename.c_str(), line, buffer);
                     return NULL;
                 }
+                result->board.origin.Set(x, y);
             }
         } else if (token == "spacing:") {
             if (!current_tape) {
@@ -199,8 +226,7 @@ PnPConfig *ParseSimplePnPConfiguration(const Board &board,
                                &x, &y, &z)) {
             Position part_pos;
             if (FindPartPos(board, designator, &part_pos)) {
-                result->board.origin.x = x - part_pos.x;
-                result->board.origin.y = y - part_pos.y;
+                result->board.origin = Position(x, y) - part_pos;
             } else {
                 fprintf(stderr, "Trouble finding '%s'\n", designator);
             }
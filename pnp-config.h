@@ -17,6 +17,9 @@ class Board;
 //  - reference position on board
 //  - multiple boards
 //  - different board-height for dispense-needle and pick'n place
+//
+// The config owns its tapes; several components can share one. A copy gets
+// its own tapes, so taking components off them doesn't affect the original.
 struct PnPConfig {
     typedef std::map<std::string, Tape*> PartToTapeMap;
     struct BoardConfig {
@@ -24,6 +27,11 @@ struct PnPConfig {
         float top = 0;    // Z position of top-surface of board.
     };
 
+    PnPConfig() {}
+    PnPConfig(const PnPConfig &other);
+    PnPConfig &operator=(const PnPConfig &other);
+    ~PnPConfig();
+
     BoardConfig board;
     PartToTapeMap tape_for_component;
 
@@ -31,6 +39,21 @@ struct PnPConfig {
     float bed_level = -1;
 };
 
+// Copy of a configuration with its own tapes, so that a job can take
+// components off them without affecting other jobs on the same config.
+class PrivateTapes {
+public:
+    explicit PrivateTapes(const PnPConfig *config)
+        : has_config_(config), config_(config ? *config : PnPConfig()) {}
+
+    // The copied configuration; NULL if there was none.
+    PnPConfig *config() { return has_config_ ? &config_ : NULL; }
+
+private:
+    const bool has_config_;
+    PnPConfig config_;
+};
+
 // Parse configuration and return newly allocated config object or NULL on
 // parse error.
 // (TODO: maybe get rid of this in favor of simple pnp config)
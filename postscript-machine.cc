@@ -115,9 +115,9 @@ bool PostScriptMachine::Init(const PnPConfig *config,
     if (config_->tape_for_component.size() == 0) {
         fprintf(output_,
                 "%%!PS-Adobe-3.0\n%%%%BoundingBox: %.0f %.0f %.0f %.0f\n\n",
-                config_->board.origin.x * mm_to_point,
-                config_->board.origin.y * mm_to_point,
-                board_dim.w * mm_to_point, board_dim.h * mm_to_point);
+                config_->board.origin.x() * mm_to_point,
+                config_->board.origin.y() * mm_to_point,
+                board_dim.w() * mm_to_point, board_dim.h() * mm_to_point);
     } else {
         fprintf(output_,
                 "%%!PS-Adobe-3.0\n%%%%BoundingBox: %.0f %.0f %.0f %.0f\n\n",
@@ -128,25 +128,25 @@ bool PostScriptMachine::Init(const PnPConfig *config,
     fprintf(output_, "%s", ps_preamble);
 
     // Draw board
-    fprintf(output_, "%.1f %.1f %.1f %.1f rect\n", board_dim.w, board_dim.h,
-            config_->board.origin.x, config_->board.origin.y);
+    fprintf(output_, "%.1f %.1f %.1f %.1f rect\n", board_dim.w(), board_dim.h(),
+            config_->board.origin.x(), config_->board.origin.y());
     fprintf(output_, "%.1f %.1f moveto (%.1fmm) show\n",
-            config_->board.origin.x + board_dim.w + 1,
-            config_->board.origin.y + board_dim.h / 2,
-            board_dim.h);
+            config_->board.origin.x() + board_dim.w() + 1,
+            config_->board.origin.y() + board_dim.h() / 2,
+            board_dim.h());
     fprintf(output_, "%.1f %.1f moveto (%.1fmm) show\n",
-            config_->board.origin.x + board_dim.w / 2,
-            config_->board.origin.y - 2,
-            board_dim.w);
+            config_->board.origin.x() + board_dim.w() / 2,
+            config_->board.origin.y() - 2,
+            board_dim.w());
 
 #if 0
     fprintf(output_, "%.1f %.1f showmark\n",
-            config_->board.origin.x, config_->board.origin.y);
+            config_->board.origin.x(), config_->board.origin.y());
 #endif
     // Push a currentpoint on stack (dispense draws a line from here)
     fprintf(output_, "%.1f %.1f moveto %.1f %.1f grid\n",
-            config_->board.origin.x, config_->board.origin.y,
-            board_dim.w, board_dim.h);
+            config_->board.origin.x(), config_->board.origin.y(),
+            board_dim.w(), board_dim.h());
     return true;
 }
 
@@ -160,13 +160,13 @@ static void PrintPads(FILE *output,
     for (const Pad &pad : part.pads) {
         fprintf(output, " 0.7 0.9 0 setrgbcolor\n");
         fprintf(output, " %.3f %.3f %.3f %.3f fillrect\n",
-                pad.size.w, pad.size.h,
-                pad.pos.x - pad.size.w/2,
-                pad.pos.y - pad.size.h/2);
+                pad.size.w(), pad.size.h(),
+                pad.pos.x() - pad.size.w()/2,
+                pad.pos.y() - pad.size.h()/2);
         fprintf(output, " 0 0 0 setrgbcolor\n");
         fprintf(output, " %.3f %.3f moveto (%s) show stroke\n",
-                pad.pos.x - pad.size.w/2,
-                pad.pos.y - pad.size.h/2,
+                pad.pos.x() - pad.size.w()/2,
+                pad.pos.y() - pad.size.h()/2,
                 pad.name.c_str());
     }
     fprintf(output, " stroke\ngrestore\n");
@@ -179,9 +179,9 @@ void PostScriptMachine::PickPart(const Part &part, const Tape *tape) {
         // Print component on tape
         PrintPads(output_, part, tx, ty, tape->angle());
         fprintf(output_, "%.3f %.3f   %.3f %.3f %s (%s) %.3f %.3f %.3f pc\n",
-                part.bounding_box.p1.x - part.bounding_box.p0.x,
-                part.bounding_box.p1.y - part.bounding_box.p0.y,
-                part.bounding_box.p0.x, part.bounding_box.p0.y,
+                part.bounding_box.p1.x() - part.bounding_box.p0.x(),
+                part.bounding_box.p1.y() - part.bounding_box.p0.y(),
+                part.bounding_box.p0.x(), part.bounding_box.p0.y(),
                 PICK_COLOR,
                 part.component_name.c_str(),
                 tape->angle(),
@@ -192,8 +192,8 @@ void PostScriptMachine::PickPart(const Part &part, const Tape *tape) {
 void PostScriptMachine::PlacePart(const Part &part, const Tape *tape) {
     // Print pads first, so that the bounding box is nice and black.
     PrintPads(output_, part,
-              config_->board.origin.x + part.pos.x,
-              config_->board.origin.y + part.pos.y,
+              (config_->board.origin + part.pos).x(),
+              (config_->board.origin + part.pos).y(),
               part.angle);
 
     // Not available parts because tape is not there or exhausted are still
@@ -202,43 +202,36 @@ void PostScriptMachine::PlacePart(const Part &part, const Tape *tape) {
         ? PLACE_COLOR
         : PLACE_MISSING_PART;
     fprintf(output_, "%.3f %.3f   %.3f %.3f %s (%s) %.3f %.3f %.3f pc\n",
-            part.bounding_box.p1.x - part.bounding_box.p0.x,
-            part.bounding_box.p1.y - part.bounding_box.p0.y,
-            part.bounding_box.p0.x, part.bounding_box.p0.y,
+            part.bounding_box.p1.x() - part.bounding_box.p0.x(),
+            part.bounding_box.p1.y() - part.bounding_box.p0.y(),
+            part.bounding_box.p0.x(), part.bounding_box.p0.y(),
             color,
             //(part.footprint + "@" + part.value) +
             part.component_name.c_str(),
             part.angle,
-            part.pos.x + config_->board.origin.x,
-            part.pos.y + config_->board.origin.y);
+            (part.pos + config_->board.origin).x(),
+            (part.pos + config_->board.origin).y());
 }
 
 void PostScriptMachine::Dispense(const Part &part, const Pad &pad) {
     if (dispense_parts_printed_.find(&part) == dispense_parts_printed_.end()) {
         // First time we see this component.
         fprintf(output_, "%.3f %.3f   %.3f %.3f %s (%s) %.3f %.3f %.3f pc\n",
-                part.bounding_box.p1.x - part.bounding_box.p0.x,
-                part.bounding_box.p1.y - part.bounding_box.p0.y,
-                part.bounding_box.p0.x, part.bounding_box.p0.y,
+                part.bounding_box.p1.x() - part.bounding_box.p0.x(),
+                part.bounding_box.p1.y() - part.bounding_box.p0.y(),
+                part.bounding_box.p0.x(), part.bounding_box.p0.y(),
                 DISPENSE_PART_COLOR,
                 part.component_name.c_str(),
                 part.angle,
-                part.pos.x + config_->board.origin.x,
-                part.pos.y + config_->board.origin.y);
+                (part.pos + config_->board.origin).x(),
+                (part.pos + config_->board.origin).y());
         dispense_parts_printed_.insert(&part);
     }
 
-    // TODO: so this part looks like we shouldn't have to do it here.
-    const float angle = 2 * M_PI * part.angle / 360.0;
-    const float part_x = config_->board.origin.x + part.pos.x;
-    const float part_y = config_->board.origin.y + part.pos.y;
-    const float area = pad.size.w * pad.size.h;
-    const float pad_x = pad.pos.x;
-    const float pad_y = pad.pos.y;
-    const float x = part_x + pad_x * cos(angle) - pad_y * sin(angle);
-    const float y = part_y + pad_x * sin(angle) + pad_y * cos(angle);
+    const Position pos = config_->board.origin + part.padAbsPos(pad);
+    const float area = pad.size.w() * pad.size.h();
     fprintf(output_, "%.3f %.3f m %.3f pp \n%.3f %.3f moveto ",
-            x, y, sqrtf(area / M_PI), x, y);
+            pos.x(), pos.y(), sqrtf(area / M_PI), pos.x(), pos.y());
 
 }
 
@@ -0,0 +1,110 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "profile-sweep.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <mutex>
+
+#include "monotonic-clock.h"
+#include "option-list.h"
+#include "thread-pool.h"
+#include "trace-writer.h"
+
+#define DEFAULT_SWEEP_STEPS 5
+
+bool ParseSweepRanges(const char *spec, const MachineProfile &base,
+                      std::vector<SweepRange> *ranges) {
+    for (const std::string &option : SplitCommaSeparated(spec)) {
+        SweepRange range;
+        range.steps = DEFAULT_SWEEP_STEPS;
+        std::string value;
+        MachineProfile probe = base;
+        if (!SplitKeyValue(option, &range.key, &value)
+            || sscanf(value.c_str(), "%f:%f:%d",
+                      &range.min, &range.max, &range.steps) < 2
+            || range.steps < 1 || range.min > range.max
+            || !probe.Set(range.key, "0")) {
+            fprintf(stderr, "Invalid sweep range '%s'; expected "
+                    "<profile-key>=<min>:<max>[:<steps>]\n", option.c_str());
+            return false;
+        }
+        ranges->push_back(range);
+    }
+    return !ranges->empty();
+}
+
+void SweepMachineProfile(
+    const MachineProfile &base, const std::vector<SweepRange> &ranges,
+    const std::function<double(const MachineProfile &)> &seconds_for,
+    int threads, MachineProfile *best, double *best_seconds) {
+    long combinations = 1;
+    for (const SweepRange &r : ranges) combinations *= r.steps;
+
+    const double start = GetMonotonicSeconds();
+    std::mutex best_mutex;
+    *best = base;
+    *best_seconds = -1;
+    long best_index = -1;
+    ThreadPool pool(threads);
+    for (long i = 0; i < combinations; ++i) {
+        pool.Submit([&, i]() {
+            // Combination number is a mixed-radix number, a digit per range.
+            MachineProfile candidate = base;
+            long digits = i;
+            for (const SweepRange &r : ranges) {
+                const int step = digits % r.steps;
+                digits /= r.steps;
+                const float value = (r.steps == 1) ? r.min
+                    : r.min + (r.max - r.min) * step / (r.steps - 1);
+                candidate.Set(r.key, std::to_string(value).c_str());
+            }
+            const double seconds = seconds_for(candidate);
+            std::unique_lock<std::mutex> l(best_mutex);
+            // Ties go to the first, so that the result doesn't depend on
+            // thread timing.
+            if (best_index < 0 || seconds < *best_seconds
+                || (seconds == *best_seconds && i < best_index)) {
+                *best = candidate;
+                *best_seconds = seconds;
+                best_index = i;
+            }
+        });
+    }
+    pool.Wait();
+    fprintf(stderr, "Evaluated %ld profiles in %.2fs on %d threads.\n",
+            combinations, GetMonotonicSeconds() - start, pool.size());
+}
+
+void SweepJobProfile(bool dispensing, const Board &board,
+                     const PnPConfig *config, const MachineProfile &base,
+                     const std::vector<SweepRange> &ranges,
+                     const EmitOptions &options, int threads,
+                     MachineProfile *best) {
+    const JobPlan pnp_plan = dispensing
+        ? JobPlan() : JobPlan::PickNPlace(board, config);
+    auto seconds_for = [&](const MachineProfile &candidate) {
+        const int64_t start_usec = GetMonotonicUsec();
+        const double seconds = EstimateJobSeconds(
+            dispensing ? JobPlan::Dispense(board, candidate) : pnp_plan,
+            board, config, candidate, options.start_ms, options.area_ms,
+            0, true);
+        if (options.trace) {
+            options.trace->NameThread("sweep");
+            options.trace->Complete("estimate", "sweep", start_usec,
+                                    GetMonotonicUsec());
+        }
+        return seconds;
+    };
+    const double baseline = seconds_for(base);
+    double best_seconds;
+    SweepMachineProfile(base, ranges, seconds_for, threads, best,
+                        &best_seconds);
+    fprintf(stderr, "Estimated job time %.1fs with given profile, "
+            "%.1fs (%.1f%%) with best.\n", baseline, best_seconds,
+            baseline > 0 ? 100.0 * (best_seconds - baseline) / baseline
+            : 0.0);
+}
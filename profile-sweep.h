@@ -0,0 +1,49 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Find the machine profile with the shortest job time by trying all
+ * combinations of values within given bounds.
+ */
+
+#ifndef PROFILE_SWEEP_H
+#define PROFILE_SWEEP_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "librpt2pnp.h"
+#include "machine-profile.h"
+
+struct SweepRange {
+    std::string key;     // As in the profile file, e.g. "pnp-hover"
+    float min, max;
+    int steps;           // Values evenly spaced from min to max.
+};
+
+// Parse comma separated "key=min:max[:steps]" list, e.g.
+// "pnp-to-board-speed=50:200:4,pnp-hover=3:10". Default are 5 steps.
+// Returns 'false' and prints an error if the spec is invalid.
+bool ParseSweepRanges(const char *spec, const MachineProfile &base,
+                      std::vector<SweepRange> *ranges);
+
+// Evaluates all combinations of the ranges applied to "base" with
+// "seconds_for" on "threads" threads (zero: one per CPU). The fastest
+// profile is stored in "best", its time in "best_seconds".
+// "seconds_for" needs to be thread-safe.
+void SweepMachineProfile(
+    const MachineProfile &base, const std::vector<SweepRange> &ranges,
+    const std::function<double(const MachineProfile &)> &seconds_for,
+    int threads, MachineProfile *best, double *best_seconds);
+
+// Fastest profile in "best" for dispensing or pick'n place the board, with
+// the dispensing times and trace of "options". Dispensing tours are
+// optimized for each profile tried. Prints how the job time compares to
+// that with "base".
+void SweepJobProfile(bool dispensing, const Board &board,
+                     const PnPConfig *config, const MachineProfile &base,
+                     const std::vector<SweepRange> &ranges,
+                     const EmitOptions &options, int threads,
+                     MachineProfile *best);
+
+#endif  // PROFILE_SWEEP_H
@@ -0,0 +1,383 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * End-to-end scaling benchmark of rpt2pnp: generates synthetic rpt files
+ * from a few to a million pads and runs the operations on them, output
+ * into /dev/null. Reports time, throughput and peak memory for each, so
+ * that it is visible where things stop scaling linearly.
+ *
+ * The generated files only depend on the options, so the same corpus can
+ * be used to compare builds.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "monotonic-clock.h"
+#include "option-list.h"
+
+// Distance between parts on the generated boards, in mm.
+#define PART_PITCH 5.0
+#define PANEL_GAP 5.0
+
+struct Footprint {
+    std::string name;
+    int pads;
+    float weight;          // Relative frequency on the board.
+};
+
+struct Result {
+    long pads;
+    std::string operation;
+    bool success;          // Otherwise there are no measurements.
+    bool timeout;
+    double min_sec, median_sec;
+    long peak_rss_kib;
+};
+
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "Options:\n"
+            "\t-b <binary> : rpt2pnp to benchmark (default: ./rpt2pnp)\n"
+            "\t-s <sizes>  : Comma-separated pad counts "
+            "(default: 100,1000,10000,100000,1000000)\n"
+            "\t-f <mix>    : Footprint mix <name>:<pads>:<weight>,... "
+            "(default:\n"
+            "\t              R_0805:2:50,C_0603:2:35,SOT23:3:10,SOIC8:8:5)\n"
+            "\t-v <count>  : Values per footprint (default: 4)\n"
+            "\t-P <c>x<r>  : Panelize: columns x rows of the board "
+            "(default: 1x1)\n"
+            "\t-o <ops>    : Operations to run, of l,t,d,p (default: all)\n"
+            "\t-r <count>  : Runs per measurement (default: 3)\n"
+            "\t-T <sec>    : Timeout per run; larger sizes are skipped after "
+            "that\n"
+            "\t              (default: 120)\n"
+            "\t-C <dir>    : Directory for the generated corpus "
+            "(default: /tmp/rpt2pnp-bench)\n"
+            "\t-S <seed>   : Random seed of the corpus (default: 1)\n"
+            "\t-j <file>   : Also write results as JSON.\n"
+            "\t-g          : Only generate the corpus.\n",
+            prog);
+    return 1;
+}
+
+static bool ParseFootprintMix(const char *spec, std::vector<Footprint> *mix) {
+    for (const std::string &entry : SplitCommaSeparated(spec)) {
+        char name[64];
+        Footprint f;
+        if (sscanf(entry.c_str(), "%63[^:]:%d:%f", name, &f.pads,
+                   &f.weight) != 3 || f.pads < 1 || f.weight <= 0) {
+            fprintf(stderr, "Invalid footprint '%s'; expected "
+                    "<name>:<pads>:<weight>\n", entry.c_str());
+            return false;
+        }
+        f.name = name;
+        mix->push_back(f);
+    }
+    return !mix->empty();
+}
+
+// Pads are in one row for small parts, in two rows for larger ones.
+static void WritePads(FILE *out, int pads) {
+    const int per_row = (pads <= 3) ? pads : (pads + 1) / 2;
+    for (int i = 0; i < pads; ++i) {
+        const int row = i / per_row;
+        const int col = i % per_row;
+        const float x = (col - (per_row - 1) / 2.0) * (pads <= 3 ? 2.0 : 1.27);
+        const float y = (pads <= 3) ? 0 : (row == 0 ? -2.5 : 2.5);
+        fprintf(out, "$PAD \"%d\"\nshape \"rect\"\nposition %.3f %.3f\n"
+                "size %s\ndrill 0\n$EndPAD\n", i + 1, x, y,
+                pads <= 3 ? "1.2 1.4" : "0.6 1.5");
+    }
+}
+
+// Write board with about "total_pads" pads, as "panel_cols" x "panel_rows"
+// copies of the same layout.
+static bool WriteRpt(const std::string &filename, long total_pads,
+                     const std::vector<Footprint> &mix, int values,
+                     int panel_cols, int panel_rows, unsigned int seed) {
+    FILE *out = fopen(filename.c_str(), "w");
+    if (out == NULL) {
+        perror(filename.c_str());
+        return false;
+    }
+    float weights = 0, mean_pads = 0;
+    for (const Footprint &f : mix) weights += f.weight;
+    for (const Footprint &f : mix) mean_pads += f.pads * f.weight / weights;
+
+    // One panel; the other copies are shifted.
+    struct Placed { const Footprint *f; int value; float x, y; int angle; };
+    const int panels = panel_cols * panel_rows;
+    const long parts = std::max(1L, lroundf(total_pads / mean_pads / panels));
+    const int grid = ceil(sqrt(parts));
+    const float w = grid * PART_PITCH, h = grid * PART_PITCH;
+    std::vector<Placed> layout;
+    for (long i = 0; i < parts; ++i) {
+        float pick = rand_r(&seed) / (RAND_MAX + 1.0) * weights;
+        const Footprint *f = &mix.back();
+        for (const Footprint &candidate : mix) {
+            if (pick < candidate.weight) { f = &candidate; break; }
+            pick -= candidate.weight;
+        }
+        Placed p;
+        p.f = f;
+        p.value = rand_r(&seed) % values;
+        p.x = (i % grid + 0.5) * PART_PITCH;
+        p.y = (i / grid + 0.5) * PART_PITCH;
+        p.angle = 90 * (rand_r(&seed) % 4);
+        layout.push_back(p);
+    }
+
+    fprintf(out, "$BOARD\nunit MM\nupper_left_corner 0 0\n"
+            "lower_right_corner %.3f %.3f\n$EndBOARD\n",
+            panel_cols * (w + PANEL_GAP), panel_rows * (h + PANEL_GAP));
+    long ref = 0;
+    for (int panel = 0; panel < panels; ++panel) {
+        const float dx = (panel % panel_cols) * (w + PANEL_GAP);
+        const float dy = (panel / panel_cols) * (h + PANEL_GAP);
+        for (const Placed &p : layout) {
+            ++ref;
+            fprintf(out, "$MODULE \"U%ld\"\nreference \"U%ld\"\n"
+                    "value \"V%d\"\nfootprint \"%s\"\nattribut smd\n"
+                    "position %.3f %.3f\norientation %d\nlayer front\n",
+                    ref, ref, p.value, p.f->name.c_str(), p.x + dx, p.y + dy,
+                    p.angle);
+            WritePads(out, p.f->pads);
+            fprintf(out, "$EndMODULE\n");
+        }
+    }
+    return fclose(out) == 0;
+}
+
+// Configuration with a tape for each footprint and value.
+static bool WriteConfig(const std::string &filename,
+                        const std::vector<Footprint> &mix, int values,
+                        long max_pads) {
+    FILE *out = fopen(filename.c_str(), "w");
+    if (out == NULL) {
+        perror(filename.c_str());
+        return false;
+    }
+    fprintf(out, "Board:\norigin: 10 10 1.6\n\nTape-Tray-Origin: 0 -50 0\n");
+    int row = 0;
+    for (const Footprint &f : mix) {
+        for (int v = 0; v < values; ++v, ++row) {
+            fprintf(out, "\nTape: %s@V%d\ncount: %ld\norigin: 10 %d 2\n"
+                    "spacing: 4 0\n", f.name.c_str(), v, max_pads, 8 * row);
+        }
+    }
+    return fclose(out) == 0;
+}
+
+// Run binary with args, all output into /dev/null. Returns 'false' if it
+// failed or ran into the timeout.
+static bool RunOnce(const std::vector<std::string> &args, int timeout_sec,
+                    double *seconds, long *peak_rss_kib, bool *timeout) {
+    *timeout = false;
+    const double start = GetMonotonicSeconds();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        const int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        alarm(timeout_sec);   // Survives exec; kills it if too slow.
+        std::vector<char*> argv;
+        for (const std::string &a : args) argv.push_back((char*)a.c_str());
+        argv.push_back(NULL);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            perror("wait4");
+            return false;
+        }
+    }
+    *seconds = GetMonotonicSeconds() - start;
+    *peak_rss_kib = usage.ru_maxrss;
+    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM) {
+        *timeout = true;
+        return false;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s -%s failed with status 0x%x\n", args[0].c_str(),
+                args[1].c_str() + 1, status);
+        return false;
+    }
+    return true;
+}
+
+static void WriteJson(const std::string &filename,
+                      const std::vector<Result> &results) {
+    FILE *out = fopen(filename.c_str(), "w");
+    if (out == NULL) {
+        perror(filename.c_str());
+        return;
+    }
+    fprintf(out, "[");
+    const char *separator = "\n";
+    for (const Result &r : results) {
+        fprintf(out, "%s  { \"pads\": %ld, \"operation\": \"%s\", "
+                "\"status\": \"%s\"", separator, r.pads, r.operation.c_str(),
+                r.success ? "ok" : r.timeout ? "timeout" : "failed");
+        if (r.success) {
+            fprintf(out, ", \"min_sec\": %.6f, \"median_sec\": %.6f, "
+                    "\"pads_per_sec\": %.1f, \"peak_rss_kib\": %ld",
+                    r.min_sec, r.median_sec,
+                    r.median_sec > 0 ? r.pads / r.median_sec : 0,
+                    r.peak_rss_kib);
+        }
+        fprintf(out, " }");
+        separator = ",\n";
+    }
+    fprintf(out, "\n]\n");
+    fclose(out);
+}
+
+int main(int argc, char *argv[]) {
+    std::string binary = "./rpt2pnp";
+    std::vector<std::string> sizes
+        = SplitCommaSeparated("100,1000,10000,100000,1000000");
+    const char *mix_spec = "R_0805:2:50,C_0603:2:35,SOT23:3:10,SOIC8:8:5";
+    int values = 4;
+    int panel_cols = 1, panel_rows = 1;
+    std::vector<std::string> operations = SplitCommaSeparated("l,t,d,p");
+    int runs = 3;
+    int timeout_sec = 120;
+    std::string corpus_dir = "/tmp/rpt2pnp-bench";
+    unsigned int seed = 1;
+    const char *json_file = NULL;
+    bool generate_only = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:s:f:v:P:o:r:T:C:S:j:g")) != -1) {
+        switch (opt) {
+        case 'b': binary = optarg; break;
+        case 's': sizes = SplitCommaSeparated(optarg); break;
+        case 'f': mix_spec = optarg; break;
+        case 'v': values = std::max(1, atoi(optarg)); break;
+        case 'P':
+            if (sscanf(optarg, "%dx%d", &panel_cols, &panel_rows) != 2
+                || panel_cols < 1 || panel_rows < 1) {
+                fprintf(stderr, "Invalid panel '%s'\n", optarg);
+                return usage(argv[0]);
+            }
+            break;
+        case 'o': operations = SplitCommaSeparated(optarg); break;
+        case 'r': runs = std::max(1, atoi(optarg)); break;
+        case 'T': timeout_sec = std::max(1, atoi(optarg)); break;
+        case 'C': corpus_dir = optarg; break;
+        case 'S': seed = atoi(optarg); break;
+        case 'j': json_file = optarg; break;
+        case 'g': generate_only = true; break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    std::vector<Footprint> mix;
+    if (!ParseFootprintMix(mix_spec, &mix))
+        return usage(argv[0]);
+    for (const std::string &op : operations) {
+        if (op != "l" && op != "t" && op != "d" && op != "p") {
+            fprintf(stderr, "Unknown operation '%s'\n", op.c_str());
+            return usage(argv[0]);
+        }
+    }
+
+    mkdir(corpus_dir.c_str(), 0755);
+    // Smallest first: after a timeout, the larger sizes are skipped.
+    std::vector<long> pad_counts;
+    for (const std::string &s : sizes) {
+        pad_counts.push_back(atol(s.c_str()));
+    }
+    std::sort(pad_counts.begin(), pad_counts.end());
+    pad_counts.erase(std::unique(pad_counts.begin(), pad_counts.end()),
+                     pad_counts.end());
+    const long max_pads = pad_counts.empty() ? 0 : pad_counts.back();
+    const std::string config = corpus_dir + "/config.txt";
+    if (!WriteConfig(config, mix, values, max_pads))
+        return 1;
+    std::vector<std::string> rpt_files;
+    for (long pads : pad_counts) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "/board-%ld.rpt", pads);
+        rpt_files.push_back(corpus_dir + filename);
+        const double start = GetMonotonicSeconds();
+        if (!WriteRpt(rpt_files.back(), pads, mix, values,
+                      panel_cols, panel_rows, seed)) {
+            return 1;
+        }
+        fprintf(stderr, "Generated %s in %.2fs\n", rpt_files.back().c_str(),
+                GetMonotonicSeconds() - start);
+    }
+    if (generate_only)
+        return 0;
+
+    std::vector<Result> results;
+    printf("%9s %2s %11s %11s %12s %9s %10s\n", "pads", "op", "median[s]",
+           "min[s]", "pads/s", "us/pad", "peak[MiB]");
+    for (const std::string &op : operations) {
+        for (size_t i = 0; i < pad_counts.size(); ++i) {
+            std::vector<std::string> args = { binary, "-" + op,
+                                              rpt_files[i], "-O/dev/null" };
+            if (op == "p") args.push_back("-c" + config);
+            Result r;
+            r.pads = pad_counts[i];
+            r.operation = op;
+            r.timeout = false;
+            r.peak_rss_kib = 0;
+            std::vector<double> times;
+            r.success = true;
+            for (int run = 0; run < runs && r.success; ++run) {
+                double seconds = 0;
+                long rss = 0;
+                r.success = RunOnce(args, timeout_sec, &seconds, &rss,
+                                    &r.timeout);
+                times.push_back(seconds);
+                r.peak_rss_kib = std::max(r.peak_rss_kib, rss);
+            }
+            std::sort(times.begin(), times.end());
+            r.min_sec = times.front();
+            r.median_sec = times[times.size() / 2];
+            results.push_back(r);
+            if (r.timeout) {
+                printf("%9ld %2s timeout; skipping larger sizes\n",
+                       r.pads, op.c_str());
+                break;
+            }
+            if (!r.success) {
+                printf("%9ld %2s failed\n", r.pads, op.c_str());
+                continue;
+            }
+            printf("%9ld %2s %11.4f %11.4f %12.0f %9.2f %10.1f\n",
+                   r.pads, op.c_str(), r.median_sec, r.min_sec,
+                   r.pads / r.median_sec, 1e6 * r.median_sec / r.pads,
+                   r.peak_rss_kib / 1024.0);
+            fflush(stdout);
+        }
+    }
+    if (json_file)
+        WriteJson(json_file, results);
+    return 0;
+}
@@ -5,31 +5,80 @@
 #ifndef RPT2PNP_H
 #define RPT2PNP_H
 
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
 #include <vector>
 #include <string>
 
 struct Part;
 struct Pad;
+struct MachineProfile;
+
+// Stored geometry is in whole micrometres, so that adding offsets is exact
+// and equal positions compare and hash equal. Millimetres as float are only
+// used to compute, e.g. with trigonometry, and for output.
+typedef int32_t Micrometers;   // Up to 2km; plenty for any machine bed.
+
+inline Micrometers ToMicrometers(double mm) {
+    return (Micrometers) lround(mm * 1000.0);
+}
+inline float ToMillimeters(Micrometers um) { return um / 1000.0f; }
 
 struct Position {
-    Position(float xx, float yy) : x(xx), y(yy) {}
-    Position() : x(0), y(0) {}
-    void Set(float xx, float yy) { x = xx; y = yy; }
+    Position(float xx, float yy) { Set(xx, yy); }   // Millimetres.
+    Position() : x_um(0), y_um(0) {}
+    void Set(float xx, float yy) {
+        x_um = ToMicrometers(xx);
+        y_um = ToMicrometers(yy);
+    }
+    static Position FromMicrometers(Micrometers xx, Micrometers yy) {
+        Position p;
+        p.x_um = xx;
+        p.y_um = yy;
+        return p;
+    }
+
+    float x() const { return ToMillimeters(x_um); }
+    float y() const { return ToMillimeters(y_um); }
 
-    float x, y;
+    Micrometers x_um, y_um;
 };
 
 inline Position operator+(const Position &a, const Position &b) {
-    return { a.x + b.x, a.y + b.y };
+    return Position::FromMicrometers(a.x_um + b.x_um, a.y_um + b.y_um);
 }
 inline Position operator-(const Position &a, const Position &b) {
-    return { a.x - b.x, a.y - b.y };
+    return Position::FromMicrometers(a.x_um - b.x_um, a.y_um - b.y_um);
+}
+inline bool operator==(const Position &a, const Position &b) {
+    return a.x_um == b.x_um && a.y_um == b.y_um;
 }
+inline bool operator!=(const Position &a, const Position &b) {
+    return !(a == b);
+}
+
+// Equal positions hash equal, so they can be keys of unordered containers.
+namespace std {
+template <> struct hash<Position> {
+    size_t operator()(const Position &p) const {
+        return hash<uint64_t>()((uint64_t)(uint32_t)p.x_um << 32
+                                | (uint32_t)p.y_um);
+    }
+};
+}  // namespace std
 
 struct Dimension {
-    Dimension(float ww, float hh) : w(ww), h(hh) {}
-    Dimension() : w(0), h(0) {}
-    float w, h;
+    Dimension(float ww, float hh)   // Millimetres.
+        : w_um(ToMicrometers(ww)), h_um(ToMicrometers(hh)) {}
+    Dimension() : w_um(0), h_um(0) {}
+
+    float w() const { return ToMillimeters(w_um); }
+    float h() const { return ToMillimeters(h_um); }
+
+    Micrometers w_um, h_um;
 };
 
 struct Box {
@@ -40,8 +89,9 @@ struct Box {
 float Distance(const Position& a, const Position& b);
 
 // Find acceptable route for pad visiting. Ideally solves TSP, but
-// heuristics are good as well.
+// heuristics are good as well. With a machine profile, the travel time of
+// the dispenser is minimized, otherwise the distance.
 typedef std::vector<std::pair<const Part *, const Pad *> > OptimizeList;
-void OptimizeParts(OptimizeList *list);
+void OptimizeParts(OptimizeList *list, const MachineProfile *profile = NULL);
 
 #endif // RPT2PNP_H
@@ -0,0 +1,143 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "sd-card.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "machine-connection.h"
+#include "monotonic-clock.h"
+
+#define SD_COMMAND_TIMEOUT_MS 10000
+
+// Send a single command and collect what the machine says until 'ok'.
+static bool SendCommand(int fd, const std::string &command,
+                        std::string *response) {
+    const std::string line = command + "\n";
+    write(fd, line.data(), line.size());
+    return WaitForOkAckCollect(fd, SD_COMMAND_TIMEOUT_MS, response);
+}
+
+// Only what the machine needs: no comments, no empty lines, no trailing space.
+static void ExtractCommands(const std::string &program,
+                            std::vector<std::string> *commands) {
+    size_t pos = 0;
+    while (pos < program.size()) {
+        size_t eol = program.find('\n', pos);
+        if (eol == std::string::npos) eol = program.size();
+        std::string line;
+        bool in_comment = false;
+        for (size_t i = pos; i < eol; ++i) {
+            const char c = program[i];
+            if (c == ';') break;
+            if (c == '(') in_comment = true;
+            if (!in_comment) line.append(1, c);
+            if (c == ')') in_comment = false;
+        }
+        pos = eol + 1;
+        const size_t last = line.find_last_not_of(" \t\r");
+        if (last == std::string::npos)
+            continue;
+        line.erase(last + 1);
+        commands->push_back(line.substr(line.find_first_not_of(" \t")));
+    }
+}
+
+bool UploadToSDCard(int fd, const std::string &filename,
+                    const std::string &program) {
+    std::vector<std::string> commands;
+    ExtractCommands(program, &commands);
+    long bytes = 0;
+    for (const std::string &c : commands) bytes += c.size() + 1;
+
+    fprintf(stderr, "Uploading %d lines, %ld bytes to SD card as %s\n",
+            (int)commands.size(), bytes, filename.c_str());
+    const double start = GetMonotonicSeconds();
+    std::string response;
+    if (!SendCommand(fd, "M28 " + filename, &response)
+        || response.find("open failed") != std::string::npos) {
+        fprintf(stderr, "Can't open %s for writing on SD card: %s\n",
+                filename.c_str(), response.c_str());
+        return false;
+    }
+    for (const std::string &c : commands) {
+        const std::string line = c + "\n";
+        write(fd, line.data(), line.size());
+        if (!WaitForOkAck(fd, SD_COMMAND_TIMEOUT_MS)) {
+            fprintf(stderr, "Upload failed at '%s'\n", c.c_str());
+            SendCommand(fd, "M29", &response);
+            return false;
+        }
+    }
+    response.clear();
+    if (!SendCommand(fd, "M29", &response)) {
+        fprintf(stderr, "Finishing upload failed: %s\n", response.c_str());
+        return false;
+    }
+    const double duration = GetMonotonicSeconds() - start;
+    fprintf(stderr, "Upload took %.1fs (%.0f bytes/s)\n", duration,
+            duration > 0 ? bytes / duration : 0);
+
+    // Selecting the file tells us how big the firmware thinks it is.
+    // Depending on firmware, lines end with \n or \r\n on the card.
+    response.clear();
+    if (!SendCommand(fd, "M23 " + filename, &response)
+        || response.find("open failed") != std::string::npos) {
+        fprintf(stderr, "Can't select %s on SD card: %s\n",
+                filename.c_str(), response.c_str());
+        return false;
+    }
+    const size_t size_pos = response.find("Size:");
+    if (size_pos == std::string::npos) {
+        fprintf(stderr, "Firmware doesn't report file size; "
+                "can't verify upload.\n");
+        return true;
+    }
+    const long card_size = atol(response.c_str() + size_pos + 5);
+    if (card_size != bytes && card_size != bytes + (long)commands.size()) {
+        fprintf(stderr, "Upload incomplete: SD card has %ld bytes, "
+                "sent %ld\n", card_size, bytes);
+        return false;
+    }
+    return true;
+}
+
+bool StartSDPrint(int fd) {
+    std::string response;
+    if (!SendCommand(fd, "M24", &response)) {
+        fprintf(stderr, "Starting SD print failed: %s\n", response.c_str());
+        return false;
+    }
+    return true;
+}
+
+SDPrintState PollSDPrint(int fd, long *done, long *total) {
+    std::string response;
+    if (!SendCommand(fd, "M27", &response)) {
+        fprintf(stderr, "\nAsking for SD print progress failed: %s\n",
+                response.c_str());
+        return SD_PRINT_ERROR;
+    }
+    const size_t pos = response.find("SD printing byte");
+    if (pos == std::string::npos)
+        return SD_PRINT_FINISHED;  // "Not SD printing", "Done printing file"
+    if (sscanf(response.c_str() + pos, "SD printing byte %ld/%ld",
+               done, total) != 2) {
+        fprintf(stderr, "\nCan't read SD print progress: %s\n",
+                response.c_str());
+        return SD_PRINT_ERROR;
+    }
+    return SD_PRINTING;
+}
+
+void AbortSDPrint(int fd) {
+    std::string response;
+    SendCommand(fd, "M524", &response);
+}
@@ -0,0 +1,35 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Printing from the SD card of Marlin-style firmware: upload the program
+ * once, then the machine runs it without being limited by the serial line.
+ */
+
+#ifndef SD_CARD_H
+#define SD_CARD_H
+
+#include <string>
+
+// Upload "program" to the SD card as "filename" (M28 ... M29). Comments and
+// empty lines are not uploaded. Then select the file (M23) and verify that
+// the size the firmware reports matches what we sent.
+// Returns 'false' on failure.
+bool UploadToSDCard(int fd, const std::string &filename,
+                    const std::string &program);
+
+// Start printing the selected file (M24).
+bool StartSDPrint(int fd);
+
+enum SDPrintState {
+    SD_PRINTING,        // "done" and "total" are filled in.
+    SD_PRINT_FINISHED,  // Machine is not printing (anymore).
+    SD_PRINT_ERROR,     // No or unexpected answer: we don't know.
+};
+
+// Ask for progress of the SD print (M27).
+SDPrintState PollSDPrint(int fd, long *done, long *total);
+
+// Abort the SD print (M524).
+void AbortSDPrint(int fd);
+
+#endif  // SD_CARD_H
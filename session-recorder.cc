@@ -0,0 +1,264 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "session-recorder.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "monotonic-clock.h"
+
+static const char kMagic[] = "RPT2PNP-SESSION1";
+
+// Ctrl-C needs to interrupt the host waiting in the main thread, so it must
+// not be delivered to us.
+static void BlockTerminationSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
+
+static bool WriteAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        const ssize_t w = write(fd, data, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        data += w;
+        len -= w;
+    }
+    return true;
+}
+
+static void WriteVarint(FILE *out, uint64_t value) {
+    while (value >= 0x80) {
+        fputc((value & 0x7f) | 0x80, out);
+        value >>= 7;
+    }
+    fputc(value, out);
+}
+
+static bool ReadVarint(FILE *in, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const int c = fgetc(in);
+        if (c == EOF) return false;
+        *value |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+SessionRecorder::SessionRecorder(int machine_fd, const std::string &filename)
+    : machine_fd_(machine_fd), filename_(filename), out_(NULL),
+      host_fd_(-1), relay_fd_(-1), running_(false), last_usec_(0) {}
+
+SessionRecorder::~SessionRecorder() {
+    if (running_) Stop();
+}
+
+bool SessionRecorder::Start() {
+    out_ = fopen(filename_.c_str(), "wb");
+    if (out_ == NULL) {
+        perror(filename_.c_str());
+        return false;
+    }
+    fwrite(kMagic, 1, strlen(kMagic), out_);
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("Session recorder");
+        return false;
+    }
+    host_fd_ = fds[0];
+    relay_fd_ = fds[1];
+    last_usec_ = GetMonotonicUsec();
+    running_ = true;
+    thread_ = std::thread(&SessionRecorder::Run, this);
+    return true;
+}
+
+void SessionRecorder::Stop() {
+    running_ = false;
+    if (thread_.joinable()) thread_.join();
+    if (out_) fclose(out_);
+    if (host_fd_ >= 0) close(host_fd_);
+    if (relay_fd_ >= 0) close(relay_fd_);
+    out_ = NULL;
+    host_fd_ = relay_fd_ = -1;
+}
+
+void SessionRecorder::Record(char direction, const char *data, size_t len) {
+    const int64_t now = GetMonotonicUsec();
+    fputc(direction, out_);
+    WriteVarint(out_, now - last_usec_);
+    WriteVarint(out_, len);
+    fwrite(data, 1, len, out_);
+    last_usec_ = now;
+}
+
+void SessionRecorder::Run() {
+    BlockTerminationSignals();
+    char buffer[4096];
+    bool machine_open = true;
+    while (running_) {
+        struct pollfd pfd[2] = {
+            { relay_fd_, POLLIN, 0 },
+            { machine_open ? machine_fd_ : -1, POLLIN, 0 },
+        };
+        if (poll(pfd, 2, 50) <= 0)
+            continue;
+        if (pfd[0].revents) {
+            const ssize_t r = read(relay_fd_, buffer, sizeof(buffer));
+            if (r <= 0)
+                break;  // Host is gone.
+            Record('>', buffer, r);
+            WriteAll(machine_fd_, buffer, r);
+        }
+        if (pfd[1].revents) {
+            const ssize_t r = read(machine_fd_, buffer, sizeof(buffer));
+            if (r <= 0) {
+                // Machine is gone. Let the host see that, too.
+                shutdown(relay_fd_, SHUT_WR);
+                machine_open = false;
+                continue;
+            }
+            Record('<', buffer, r);
+            WriteAll(relay_fd_, buffer, r);
+        }
+        fflush(out_);  // We want the recording in particular if we crash.
+    }
+}
+
+SessionReplay::SessionReplay(const std::string &filename)
+    : filename_(filename), host_fd_(-1), replay_fd_(-1), running_(false) {}
+
+SessionReplay::~SessionReplay() {
+    if (running_) Stop();
+}
+
+bool SessionReplay::Load() {
+    FILE *in = fopen(filename_.c_str(), "rb");
+    if (in == NULL) {
+        perror(filename_.c_str());
+        return false;
+    }
+    char magic[sizeof(kMagic) - 1];
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic)
+        || memcmp(magic, kMagic, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s: not a session recording.\n", filename_.c_str());
+        fclose(in);
+        return false;
+    }
+    int64_t now = 0;
+    int64_t line_sent = 0;
+    std::string partial_line;
+    int direction;
+    while ((direction = fgetc(in)) != EOF) {
+        uint64_t delta, len;
+        if (!ReadVarint(in, &delta) || !ReadVarint(in, &len))
+            break;
+        std::string data(len, '\0');
+        if (fread(&data[0], 1, len, in) != len)
+            break;
+        now += delta;
+        if (direction == '>') {
+            for (char c : data) {
+                partial_line.push_back(c);
+                if (c != '\n') continue;
+                exchanges_.push_back(Exchange());
+                exchanges_.back().line.swap(partial_line);
+                line_sent = now;
+            }
+        } else if (exchanges_.empty()) {
+            greeting_.push_back({ now, data });
+        } else {
+            exchanges_.back().responses.push_back({ now - line_sent, data });
+        }
+    }
+    fclose(in);
+    fprintf(stderr, "Replaying %s: %d lines.\n", filename_.c_str(),
+            (int)exchanges_.size());
+    return true;
+}
+
+bool SessionReplay::Start() {
+    if (!Load())
+        return false;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("Session replay");
+        return false;
+    }
+    host_fd_ = fds[0];
+    replay_fd_ = fds[1];
+    running_ = true;
+    thread_ = std::thread(&SessionReplay::Run, this);
+    return true;
+}
+
+SessionReplay::Stats SessionReplay::Stop() {
+    running_ = false;
+    if (thread_.joinable()) thread_.join();
+    if (host_fd_ >= 0) close(host_fd_);
+    if (replay_fd_ >= 0) close(replay_fd_);
+    host_fd_ = replay_fd_ = -1;
+    return stats_;
+}
+
+void SessionReplay::PrintStats(const Stats &stats, double job_seconds) {
+    fprintf(stderr, "Replay: job completed in %.2fs. %lld lines, "
+            "%lld differ from recording (first: line %lld), "
+            "%lld beyond recording.\n", job_seconds,
+            (long long)stats.lines, (long long)stats.diverged,
+            (long long)stats.first_divergence,
+            (long long)stats.beyond_recording);
+}
+
+void SessionReplay::Respond(const std::vector<Response> &responses) {
+    const int64_t start = GetMonotonicUsec();
+    for (const Response &response : responses) {
+        const int64_t wait = start + response.delay_usec - GetMonotonicUsec();
+        if (wait > 0) usleep(wait);
+        WriteAll(replay_fd_, response.data.data(), response.data.size());
+    }
+}
+
+void SessionReplay::Run() {
+    BlockTerminationSignals();
+    Respond(greeting_);
+    std::string rx;
+    char buffer[4096];
+    size_t next = 0;
+    while (running_) {
+        struct pollfd pfd = { replay_fd_, POLLIN, 0 };
+        if (poll(&pfd, 1, 50) <= 0)
+            continue;
+        const ssize_t r = read(replay_fd_, buffer, sizeof(buffer));
+        if (r <= 0)
+            break;
+        rx.append(buffer, r);
+        size_t eol;
+        while ((eol = rx.find('\n')) != std::string::npos) {
+            const std::string line = rx.substr(0, eol + 1);
+            rx.erase(0, eol + 1);
+            ++stats_.lines;
+            if (next >= exchanges_.size()) {
+                ++stats_.beyond_recording;
+                WriteAll(replay_fd_, "ok\n", 3);
+                continue;
+            }
+            const Exchange &exchange = exchanges_[next++];
+            if (exchange.line != line && stats_.diverged++ == 0)
+                stats_.first_divergence = stats_.lines;
+            Respond(exchange.responses);
+        }
+    }
+}
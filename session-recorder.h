@@ -0,0 +1,108 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Recording of all bytes exchanged with the machine, and replaying the
+ * machine side of such a recording, to debug and compare streaming offline.
+ *
+ * File format: "RPT2PNP-SESSION1" followed by records of
+ *   direction  1 byte, '>' host to machine, '<' machine to host.
+ *   delta      varint, microseconds since the previous record.
+ *   length     varint
+ *   data       "length" bytes.
+ * Varints are 7 bits per byte, least significant first; high bit set if
+ * more bytes follow.
+ */
+
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sits between host and machine and records everything that goes by.
+class SessionRecorder {
+public:
+    SessionRecorder(int machine_fd, const std::string &filename);
+    ~SessionRecorder();
+
+    // Open recording and start relaying in a separate thread. Returns
+    // 'false' if that is not possible.
+    bool Start();
+
+    // The host talks to this file descriptor instead of the machine.
+    int host_fd() const { return host_fd_; }
+
+    // Stop relaying and close recording.
+    void Stop();
+
+private:
+    void Run();
+    void Record(char direction, const char *data, size_t len);
+
+    const int machine_fd_;
+    const std::string filename_;
+    FILE *out_;
+    int host_fd_;
+    int relay_fd_;             // Our end of the host connection.
+    std::thread thread_;
+    std::atomic<bool> running_;
+    int64_t last_usec_;
+};
+
+// Plays the machine side of a recording: each line the host sends is
+// answered with what the machine answered to the same line in the recording,
+// with the same delay.
+class SessionReplay {
+public:
+    struct Stats {
+        int64_t lines = 0;
+        int64_t diverged = 0;        // Not the same as in the recording.
+        int64_t first_divergence = 0;  // Line number, 1-based; 0 if none.
+        int64_t beyond_recording = 0;  // Acknowledged right away.
+    };
+
+    explicit SessionReplay(const std::string &filename);
+    ~SessionReplay();
+
+    // Read recording and start replaying in a separate thread. Returns
+    // 'false' if the recording can't be read.
+    bool Start();
+
+    // The host talks to this file descriptor instead of the machine.
+    int host_fd() const { return host_fd_; }
+
+    Stats Stop();
+
+    // Print "stats" of a job that took "job_seconds" to stderr.
+    static void PrintStats(const Stats &stats, double job_seconds);
+
+private:
+    struct Response {
+        int64_t delay_usec;   // After the line was sent.
+        std::string data;
+    };
+    struct Exchange {
+        std::string line;     // Sent by host, including newline.
+        std::vector<Response> responses;
+    };
+
+    bool Load();
+    void Run();
+    void Respond(const std::vector<Response> &responses);
+
+    const std::string filename_;
+    std::vector<Exchange> exchanges_;
+    std::vector<Response> greeting_;   // Before the first line was sent.
+    int host_fd_;
+    int replay_fd_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+    Stats stats_;
+};
+
+#endif  // SESSION_RECORDER_H
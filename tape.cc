@@ -9,14 +9,14 @@
 
 Tape::Tape()
     : x_(0), y_(0), z_(0),
-      dx_(0), dy_(0),
+      dx_(0), dy_(0), taken_(0),
       angle_(0), slant_angle_(0),
       count_(1000) {
 }
 
 void Tape::SetFirstComponentPosition(float x, float y, float z) {
-    x_ = x;
-    y_ = y;
+    x_ = ToMicrometers(x);
+    y_ = ToMicrometers(y);
     z_ = z;
 }
 
@@ -36,8 +36,8 @@ bool Tape::GetPos(float *x, float *y) const {
     if (count_ <= 0)
         return false;
 
-    *x = x_;
-    *y = y_;
+    *x = ToMillimeters(x_ + ToMicrometers(taken_ * dx_));
+    *y = ToMillimeters(y_ + ToMicrometers(taken_ * dy_));
     return true;
 }
 
@@ -45,10 +45,7 @@ bool Tape::Advance() {
     if (count_ <= 0)
         return false;
 
-    // Advance
-    x_ = x_ + dx_;
-    y_ = y_ + dy_;
-    // z stays the same.
+    ++taken_;
     --count_;
 
     return true;
@@ -56,5 +53,6 @@ bool Tape::Advance() {
 
 void Tape::DebugPrint() const {
     fprintf(stderr, "%p: origin: (%.2f, %.2f, %.2f) delta: (%.2f,%.2f) "
-            "count: %d", this, x_, y_, z_, dx_, dy_, count_);
+            "count: %d", this, ToMillimeters(x_), ToMillimeters(y_), z_,
+            dx_, dy_, count_);
 }
@@ -9,6 +9,8 @@
 
 #include <string>
 
+#include "rpt2pnp.h"
+
 class Tape {
 public:
     Tape();
@@ -33,8 +35,12 @@ public:
     bool parts_available() const { return count_ > 0; }
 
 private:
-    float x_, y_, z_;
-    float dx_, dy_;
+    // The n-th component is computed from the first, so that advancing
+    // doesn't add up rounding errors.
+    Micrometers x_, y_;    // First component.
+    float z_;
+    double dx_, dy_;       // Millimetres.
+    int taken_;            // Components taken from the tape.
     float angle_, slant_angle_;
     int count_;
 };
@@ -118,8 +118,8 @@ static int getChar() {
 static bool JogTo(int machine_fd, Position *out, float *z) {
     const Position start_pos = *out;
     const float start_z = *z - kSafeHovering;
-    const float kSmallJog = 0.1;
-    const float kBigJog = 1.0;
+    const Micrometers kSmallJog = 100;
+    const Micrometers kBigJog = 1000;
     fprintf(stderr,
             "-----------------------------------------\n"
             "Cursor keys: move x/y on bed\n"
@@ -131,11 +131,11 @@ static bool JogTo(int machine_fd, Position *out, float *z) {
     bool done = false;
     while (!done) {
         SendMachineLine(machine_fd, "G1 X%.3f Y%.3f Z%.3f\n",
-                        out->x, out->y, *z);
+                        out->x(), out->y(), *z);
         for (int i = 0; i < 50; ++i) write(STDERR_FILENO, "\x08", 1);
         const Position delta = *out - start_pos;
         fprintf(stderr, "Delta: (%.1f, %.1f) ; top-of-board: %.1f  ",
-                delta.x, delta.y, *z - start_z);
+                delta.x(), delta.y(), *z - start_z);
         const int c = getChar();
         switch (c) {
         case KEY_U :
@@ -153,31 +153,31 @@ static bool JogTo(int machine_fd, Position *out, float *z) {
             break;
 
         case CURSOR_UP:
-            out->y += kSmallJog;
+            out->y_um += kSmallJog;
             break;
         case SHIFT_CURSOR_UP: case CTRL_CURSOR_UP:
-            out->y += kBigJog;
+            out->y_um += kBigJog;
             break;
 
         case CURSOR_DN:
-            out->y -= kSmallJog;
+            out->y_um -= kSmallJog;
             break;
         case SHIFT_CURSOR_DN: case CTRL_CURSOR_DN:
-            out->y -= kBigJog;
+            out->y_um -= kBigJog;
             break;
 
         case CURSOR_RIGHT:
-            out->x += kSmallJog;
+            out->x_um += kSmallJog;
             break;
         case SHIFT_CURSOR_RIGHT: case CTRL_CURSOR_RIGHT:
-            out->x += kBigJog;
+            out->x_um += kBigJog;
             break;
 
         case CURSOR_LEFT:
-            out->x -= kSmallJog;
+            out->x_um -= kSmallJog;
             break;
         case SHIFT_CURSOR_LEFT: case CTRL_CURSOR_LEFT:
-            out->x -= kBigJog;
+            out->x_um -= kBigJog;
             break;
 
         case 3:   // CTRL-C
@@ -205,7 +205,7 @@ static bool JogTo(int machine_fd, Position *out, float *z) {
 }
 
 static void PrintPos(const char *msg, const Position &p) {
-    fprintf(stderr, "%s(%.1f, %.1f)\n", msg, p.x, p.y);
+    fprintf(stderr, "%s(%.1f, %.1f)\n", msg, p.x(), p.y());
 }
 
 bool TerminalJogConfig(const Board &board, int machine_fd, PnPConfig *config) {
@@ -236,7 +236,7 @@ bool TerminalJogConfig(const Board &board, int machine_fd, PnPConfig *config) {
         board_part->padAbsPos(board_part->pads[0]);
     fprintf(stderr, "Find pad '%s' of %s (%.1f, %.1f) and touch needle.\n",
             board_part->pads[0].name.c_str(),
-            board_part->component_name.c_str(), pad_pos.x, pad_pos.y);
+            board_part->component_name.c_str(), pad_pos.x(), pad_pos.y());
     Position new_pos = pad_pos;
     float z = config->board.top + kSafeHovering;
     if (!JogTo(machine_fd, &new_pos, &z))
@@ -249,8 +249,8 @@ bool TerminalJogConfig(const Board &board, int machine_fd, PnPConfig *config) {
     PrintPos("Delta to original: ", delta);
 
     board_part = FindPartClosestTo(board.parts(),
-                                   Position(board.dimension().w,
-                                            board.dimension().h));
+                                   Position(board.dimension().w(),
+                                            board.dimension().h()));
     pad_pos = config->board.origin
         + board_part->padAbsPos(board_part->pads[0]);
 
@@ -261,10 +261,10 @@ bool TerminalJogConfig(const Board &board, int machine_fd, PnPConfig *config) {
             "      If this doesn't match, please CTRL-C now and straighten\n"
             "      board to be perfectly square with the bed.\n",
             board_part->pads[0].name.c_str(),
-            board_part->component_name.c_str(), pad_pos.x, pad_pos.y);
+            board_part->component_name.c_str(), pad_pos.x(), pad_pos.y());
 
     SendMachineLine(machine_fd, "G1 Z%.3f\n", z + 10);
-    SendMachineLine(machine_fd, "G1 X%.3f Y%.3f\n", pad_pos.x, pad_pos.y);
+    SendMachineLine(machine_fd, "G1 X%.3f Y%.3f\n", pad_pos.x(), pad_pos.y());
     SendMachineLine(machine_fd, "G1 Z%.3f\n", z);
 
     fprintf(stderr, "\n[ OK ? RETURN. Otherwise: CTRL-C]\n");
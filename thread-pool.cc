@@ -0,0 +1,54 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "thread-pool.h"
+
+ThreadPool::ThreadPool(int threads) : busy_(0), exiting_(false) {
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    for (int i = 0; i < threads; ++i)
+        threads_.push_back(std::thread(&ThreadPool::Worker, this));
+}
+
+ThreadPool::~ThreadPool() {
+    Wait();
+    {
+        std::unique_lock<std::mutex> l(mutex_);
+        exiting_ = true;
+    }
+    work_available_.notify_all();
+    for (std::thread &t : threads_) t.join();
+}
+
+void ThreadPool::Submit(std::function<void()> work) {
+    {
+        std::unique_lock<std::mutex> l(mutex_);
+        queue_.push_back(std::move(work));
+    }
+    work_available_.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> l(mutex_);
+    all_done_.wait(l, [this]() { return queue_.empty() && busy_ == 0; });
+}
+
+void ThreadPool::Worker() {
+    std::unique_lock<std::mutex> l(mutex_);
+    for (;;) {
+        work_available_.wait(l, [this]() {
+                return exiting_ || !queue_.empty(); });
+        if (queue_.empty())
+            return;  // exiting.
+        std::function<void()> work = std::move(queue_.front());
+        queue_.pop_front();
+        ++busy_;
+        l.unlock();
+        work();
+        l.lock();
+        --busy_;
+        if (queue_.empty() && busy_ == 0)
+            all_done_.notify_all();
+    }
+}
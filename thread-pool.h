@@ -0,0 +1,41 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed number of threads working off a queue of functions.
+class ThreadPool {
+public:
+    // Number of threads; zero or negative: one per CPU.
+    explicit ThreadPool(int threads);
+    ~ThreadPool();   // Finishes all submitted work first.
+
+    void Submit(std::function<void()> work);
+
+    // Wait until all submitted work is done.
+    void Wait();
+
+    int size() const { return threads_.size(); }
+
+private:
+    void Worker();
+
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable all_done_;
+    std::deque<std::function<void()> > queue_;
+    int busy_;
+    bool exiting_;
+    std::vector<std::thread> threads_;
+};
+
+#endif  // THREAD_POOL_H
@@ -0,0 +1,158 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "time-estimator.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+typedef GCodeInterpreter G;
+static_assert((int)MachineProfile::NUM_AXES == (int)G::NUM_AXES,
+              "Same axes in profile and interpreter");
+
+JobTimeEstimator::JobTimeEstimator(const MachineProfile &profile)
+    : profile_(profile), commands_(0), moves_(0) {
+    for (int i = 0; i < NUM_PHASES; ++i) seconds_[i] = 0;
+}
+
+void JobTimeEstimator::AddLine(const char *line, size_t len) {
+    float home_distance = 0;  // Where homing would start.
+    for (int a = 0; a < G::AXIS_E; ++a) {
+        home_distance = std::max(home_distance,
+                                 fabsf(interpreter_.position((G::Axis) a)));
+    }
+    std::vector<G::Step> steps;
+    interpreter_.Interpret(line, len, &steps);
+    for (const G::Step &step : steps) {
+        ++commands_;
+        seconds_[PHASE_OVERHEAD] += profile_.command_overhead_ms / 1000.0;
+        switch (step.kind) {
+        case G::Step::MOVE:
+            AddMove(step);
+            break;
+        case G::Step::DWELL:
+            PlanQueuedMoves();
+            seconds_[PHASE_DWELL] += step.dwell_ms / 1000.0;
+            break;
+        case G::Step::WAIT_FOR_MOVES:
+            PlanQueuedMoves();
+            break;
+        case G::Step::HOME:
+            PlanQueuedMoves();
+            seconds_[PHASE_HOMING] += home_distance / profile_.home_speed;
+            break;
+        case G::Step::OTHER:
+            if (step.code == -42 || step.code == -106 || step.code == -107)
+                seconds_[PHASE_VACUUM] += profile_.valve_ms / 1000.0;
+            break;
+        }
+    }
+}
+
+void JobTimeEstimator::Finish() {
+    PlanQueuedMoves();
+}
+
+void JobTimeEstimator::AddMove(const G::Step &step) {
+    Move move;
+    double len_sq = 0;
+    for (int i = 0; i < G::NUM_AXES; ++i) len_sq += step.delta[i] * step.delta[i];
+    move.length = sqrt(len_sq);
+    if (move.length < 1e-6 || step.feedrate <= 0)
+        return;
+    ++moves_;
+    // Feedrate and acceleration along the move, so that no axis exceeds
+    // its limits.
+    move.nominal_speed = step.feedrate;
+    move.accel = 1e12;
+    for (int i = 0; i < G::NUM_AXES; ++i) {
+        move.unit[i] = step.delta[i] / move.length;
+        const double share = fabs(move.unit[i]);
+        if (share < 1e-9) continue;
+        move.nominal_speed = std::min(move.nominal_speed,
+                                      profile_.max_speed[i] / share);
+        move.accel = std::min(move.accel, profile_.max_accel[i] / share);
+    }
+    move.phase = (step.delta[G::AXIS_X] != 0 || step.delta[G::AXIS_Y] != 0
+                  || step.delta[G::AXIS_Z] == 0)
+        ? PHASE_TRAVEL : PHASE_Z;
+
+    // Cornering speed with the previous move, the way grbl and Marlin
+    // derive it from the junction deviation.
+    move.max_entry_speed = 0;
+    if (!queue_.empty()) {
+        const Move &prev = queue_.back();
+        double cos_theta = 0;
+        for (int i = 0; i < G::NUM_AXES; ++i)
+            cos_theta -= prev.unit[i] * move.unit[i];
+        const double limit = std::min(prev.nominal_speed, move.nominal_speed);
+        if (cos_theta < -0.999999) {
+            move.max_entry_speed = limit;   // Straight on.
+        } else if (cos_theta < 0.999999) {  // Not a full reversal.
+            const double sin_theta_d2 = sqrt(0.5 * (1.0 - cos_theta));
+            move.max_entry_speed = std::min(limit, sqrt(
+                move.accel * profile_.junction_deviation * sin_theta_d2
+                / (1.0 - sin_theta_d2)));
+        }
+    }
+    queue_.push_back(move);
+}
+
+// Time to go "length" starting with v0, ending with v1, not exceeding
+// "v_max" and accelerating/decelerating with "a".
+static double TrapezoidSeconds(double length, double v0, double v1,
+                               double v_max, double a) {
+    const double accel_dist = (v_max * v_max - v0 * v0) / (2 * a);
+    const double decel_dist = (v_max * v_max - v1 * v1) / (2 * a);
+    if (accel_dist + decel_dist <= length) {
+        return (v_max - v0) / a + (v_max - v1) / a
+            + (length - accel_dist - decel_dist) / v_max;
+    }
+    // Never reaching v_max: triangle.
+    const double v_peak = sqrt((2 * a * length + v0 * v0 + v1 * v1) / 2);
+    return (v_peak - v0) / a + (v_peak - v1) / a;
+}
+
+void JobTimeEstimator::PlanQueuedMoves() {
+    const size_t n = queue_.size();
+    if (n == 0) return;
+    // speed[i] is the speed at the start of move i; we start and end at rest.
+    std::vector<double> speed(n + 1, 0);
+    for (size_t i = 1; i < n; ++i) speed[i] = queue_[i].max_entry_speed;
+    // Need to be able to decelerate in time for what comes next...
+    for (size_t i = n; i-- > 0; ) {
+        const Move &m = queue_[i];
+        speed[i] = std::min(speed[i], sqrt(speed[i + 1] * speed[i + 1]
+                                           + 2 * m.accel * m.length));
+    }
+    // ... and can only get as fast as acceleration allows.
+    for (size_t i = 0; i < n; ++i) {
+        const Move &m = queue_[i];
+        speed[i + 1] = std::min(speed[i + 1], sqrt(speed[i] * speed[i]
+                                                   + 2 * m.accel * m.length));
+        seconds_[m.phase] += TrapezoidSeconds(m.length, speed[i], speed[i + 1],
+                                              m.nominal_speed, m.accel);
+    }
+    queue_.clear();
+}
+
+double JobTimeEstimator::total_seconds() const {
+    double total = 0;
+    for (int i = 0; i < NUM_PHASES; ++i) total += seconds_[i];
+    return total;
+}
+
+void JobTimeEstimator::PrintSummary(FILE *out) const {
+    static const char *const kPhaseName[NUM_PHASES] = {
+        "travel", "z", "dwell", "vacuum", "homing", "overhead"
+    };
+    const double total = total_seconds();
+    fprintf(out, "Estimated job time: %.1fs (%ld commands, %ld moves)\n",
+            total, commands_, moves_);
+    for (int i = 0; i < NUM_PHASES; ++i) {
+        fprintf(out, "  %-9s %9.1fs %5.1f%%\n", kPhaseName[i], seconds_[i],
+                total > 0 ? 100.0 * seconds_[i] / total : 0);
+    }
+}
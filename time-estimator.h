@@ -0,0 +1,69 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Estimate how long a job takes on the machine, from the G-code sent to it.
+ */
+
+#ifndef TIME_ESTIMATOR_H
+#define TIME_ESTIMATOR_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "gcode-interpreter.h"
+#include "machine-profile.h"
+
+// Moves are planned like the firmware does: trapezoidal velocity profiles
+// with per-axis speed and acceleration limits, and cornering speed between
+// moves from the junction deviation. Moves only blend until the next
+// command that waits for them to finish (G4, M400, G28).
+// Axis limits and timing come from the machine profile.
+class JobTimeEstimator {
+public:
+    enum Phase {
+        PHASE_TRAVEL,     // Moves in XY (and rotation with them).
+        PHASE_Z,          // Z-only moves
+        PHASE_DWELL,      // G4
+        PHASE_VACUUM,     // Switching vacuum, blow or dispense solenoid.
+        PHASE_HOMING,
+        PHASE_OVERHEAD,   // Per-command firmware overhead.
+        NUM_PHASES
+    };
+
+    explicit JobTimeEstimator(const MachineProfile &profile);
+
+    // Add a line of G-code.
+    void AddLine(const char *line, size_t len);
+
+    // Account for moves that are still queued up.
+    void Finish();
+
+    double seconds(Phase phase) const { return seconds_[phase]; }
+    double total_seconds() const;
+
+    void PrintSummary(FILE *out) const;
+
+private:
+    struct Move {
+        float unit[GCodeInterpreter::NUM_AXES];  // Direction
+        double length;
+        double nominal_speed;   // mm/s, within axis limits.
+        double accel;           // mm/s^2, within axis limits.
+        double max_entry_speed; // Junction with previous move.
+        Phase phase;
+    };
+
+    void AddMove(const GCodeInterpreter::Step &step);
+    void PlanQueuedMoves();   // Execute all queued moves until standstill.
+
+    const MachineProfile profile_;
+    GCodeInterpreter interpreter_;
+    std::vector<Move> queue_;
+    double seconds_[NUM_PHASES];
+    long commands_;
+    long moves_;
+};
+
+#endif  // TIME_ESTIMATOR_H
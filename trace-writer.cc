@@ -0,0 +1,111 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ */
+
+#include "trace-writer.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "monotonic-clock.h"
+
+static long CurrentThreadId() {
+    return syscall(SYS_gettid);
+}
+
+// Names are G-code lines or part names; quote what JSON needs quoted.
+static std::string JsonEscape(const std::string &s) {
+    std::string result;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            result.push_back('\\');
+            result.push_back(c);
+        } else if ((unsigned char)c < 0x20) {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            result.append(buffer);
+        } else {
+            result.push_back(c);
+        }
+    }
+    return result;
+}
+
+TraceWriter::TraceWriter(const std::string &filename)
+    : filename_(filename), start_usec_(GetMonotonicUsec()), out_(NULL),
+      first_event_(true) {}
+
+TraceWriter::~TraceWriter() {
+    if (out_ == NULL)
+        return;
+    fprintf(out_, "\n]}\n");
+    if (fclose(out_) != 0)
+        perror(filename_.c_str());
+}
+
+bool TraceWriter::Open() {
+    out_ = fopen(filename_.c_str(), "w");
+    if (out_ == NULL) {
+        perror(filename_.c_str());
+        return false;
+    }
+    fprintf(out_, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    NameThread("main");
+    return true;
+}
+
+void TraceWriter::WriteEvent(const std::string &event) {
+    if (out_ == NULL) return;
+    fprintf(out_, "%s\n%s", first_event_ ? "" : ",", event.c_str());
+    first_event_ = false;
+}
+
+void TraceWriter::Begin(const char *name, const char *category) {
+    // Names can be of any length; only the fixed part is formatted.
+    char times[128];
+    snprintf(times, sizeof(times),
+             "\"ph\": \"B\", \"ts\": %lld, \"pid\": %d, \"tid\": %ld}",
+             (long long)(GetMonotonicUsec() - start_usec_), getpid(),
+             CurrentThreadId());
+    const std::string event = "{\"name\": \"" + JsonEscape(name)
+        + "\", \"cat\": \"" + category + "\", " + times;
+    std::lock_guard<std::mutex> l(mutex_);
+    WriteEvent(event);
+}
+
+void TraceWriter::End() {
+    char event[128];
+    snprintf(event, sizeof(event),
+             "{\"ph\": \"E\", \"ts\": %lld, \"pid\": %d, \"tid\": %ld}",
+             (long long)(GetMonotonicUsec() - start_usec_), getpid(),
+             CurrentThreadId());
+    std::lock_guard<std::mutex> l(mutex_);
+    WriteEvent(event);
+}
+
+void TraceWriter::Complete(const std::string &name, const char *category,
+                           int64_t start_usec, int64_t end_usec) {
+    char times[128];
+    snprintf(times, sizeof(times),
+             "\"ph\": \"X\", \"ts\": %lld, \"dur\": %lld, \"pid\": %d, "
+             "\"tid\": %ld}",
+             (long long)(start_usec - start_usec_),
+             (long long)(end_usec - start_usec), getpid(), CurrentThreadId());
+    const std::string event = "{\"name\": \"" + JsonEscape(name)
+        + "\", \"cat\": \"" + category + "\", " + times;
+    std::lock_guard<std::mutex> l(mutex_);
+    WriteEvent(event);
+}
+
+void TraceWriter::NameThread(const char *name) {
+    const long tid = CurrentThreadId();
+    char ids[128];
+    snprintf(ids, sizeof(ids),
+             "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+             "\"tid\": %ld, ", getpid(), tid);
+    const std::string event = ids + ("\"args\": {\"name\": \""
+                                     + JsonEscape(name) + "\"}}");
+    std::lock_guard<std::mutex> l(mutex_);
+    if (named_threads_.insert(tid).second)
+        WriteEvent(event);
+}
@@ -0,0 +1,51 @@
+/* -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * (c) h.zeller@acm.org. Free Software. GNU Public License v3.0 and above
+ *
+ * Timeline of a run in the trace event format, to be viewed in Perfetto
+ * (ui.perfetto.dev) or chrome://tracing.
+ */
+
+#ifndef TRACE_WRITER_H
+#define TRACE_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <mutex>
+#include <set>
+#include <string>
+
+// Events are written as they happen. All functions can be called from any
+// thread; events are shown per thread.
+class TraceWriter {
+public:
+    explicit TraceWriter(const std::string &filename);
+    ~TraceWriter();   // Closes the file.
+
+    // Returns 'false' if the file could not be created.
+    bool Open();
+
+    // Span on the current thread, nested like function calls.
+    void Begin(const char *name, const char *category);
+    void End();
+
+    // Span on the current thread that already finished. Times as returned
+    // by GetMonotonicUsec().
+    void Complete(const std::string &name, const char *category,
+                  int64_t start_usec, int64_t end_usec);
+
+    // Name of the current thread in the timeline.
+    void NameThread(const char *name);
+
+private:
+    void WriteEvent(const std::string &event);   // Needs mutex_ held.
+
+    const std::string filename_;
+    const int64_t start_usec_;
+    std::mutex mutex_;
+    FILE *out_;
+    bool first_event_;
+    std::set<long> named_threads_;
+};
+
+#endif  // TRACE_WRITER_H